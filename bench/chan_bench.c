@@ -0,0 +1,228 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <time.h>
+#include "../common.h"
+#include "../msg_struct.h"
+#include "../proto.h"
+
+// Channel membership benchmark: one user following <channels> channels, held
+// either as one session in every channel or as one session per channel.
+// A sender in all the channels posts one line to each channel per round and
+// the benchmark times how long the user takes to receive them.
+
+#define CHAT_LINE "see you at the demo!"
+#define DEFAULT_ROUNDS 200
+
+typedef struct Layout {
+    const char *name;
+    int sessions;             // Sessions opened for the user
+    double setup;             // Seconds to log in, create and join
+    double deliver;           // Seconds for all the rounds
+    long frames;              // Channel lines received by the user
+} Layout;
+
+// Function to get a monotonic timestamp in seconds
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to send one v1 frame
+int send_msg(int sfd, enum msg_type type, const char *nick, const char *infos, const char *payload) {
+    struct message msgstruct;
+    memset(&msgstruct, 0, sizeof(struct message));
+    msgstruct.type = type;
+    strncpy(msgstruct.nick_sender, nick, NICK_LEN - 1);
+    strncpy(msgstruct.infos, infos, INFOS_LEN - 1);
+    msgstruct.pld_len = strlen(payload);
+
+    char frame[PROTO_V1_HEADER_LEN + MSG_LEN];
+    size_t len = proto_encode(PROTO_V1, (uint8_t *)frame, &msgstruct, payload, msgstruct.pld_len);
+    return send(sfd, frame, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+// Function to read frames until one of the given type arrives
+int wait_for(int sfd, enum msg_type type) {
+    struct message reply;
+    char payload[MSG_LEN];
+    for (;;) {
+        if (recv(sfd, &reply, PROTO_V1_HEADER_LEN, MSG_WAITALL) != PROTO_V1_HEADER_LEN ||
+            reply.pld_len < 0 || reply.pld_len > MSG_LEN) {
+            return -1;
+        }
+        if (reply.pld_len > 0 && recv(sfd, payload, reply.pld_len, MSG_WAITALL) != reply.pld_len) {
+            return -1;
+        }
+        if (reply.type == type) {
+            return 0;
+        }
+    }
+}
+
+// Function to open one session and log it in
+int open_session(struct addrinfo *addr, const char *nick) {
+    int sfd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (sfd == -1) {
+        return -1;
+    }
+    if (connect(sfd, addr->ai_addr, addr->ai_addrlen) == -1) {
+        close(sfd);
+        return -1;
+    }
+
+    struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+    setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    // The login frame carries no payload, the nickname travels in infos
+    if (send_msg(sfd, NICKNAME_NEW, nick, nick, "") < 0 || wait_for(sfd, NICKNAME_SUCCESS) < 0) {
+        close(sfd);
+        return -1;
+    }
+    return sfd;
+}
+
+// Function to run one layout: user_fds[i] is the session following channel i
+int run_layout(struct addrinfo *addr, Layout *layout, int channels, int rounds) {
+    int split = layout->sessions > 1;
+    int *user_fds = calloc(channels, sizeof(int));
+    char nick[NICK_LEN];
+    char c_name[CHAN_LEN];
+    int ret = -1;
+    int sender = -1;
+
+    // Unique names so several runs can share one server
+    int tag = (int)(getpid() % 100000);
+    double start = now_sec();
+
+    for (int i = 0; i < channels; i++) {
+        user_fds[i] = -1;
+    }
+    for (int i = 0; i < channels; i++) {
+        if (split || i == 0) {
+            snprintf(nick, NICK_LEN, "%s%du%d", layout->name, tag, i);
+            user_fds[i] = open_session(addr, nick);
+        } else {
+            user_fds[i] = user_fds[0];
+        }
+        if (user_fds[i] < 0) {
+            fprintf(stderr, "[Error] %s: could not open user session %d.\n", layout->name, i);
+            goto out;
+        }
+        snprintf(nick, NICK_LEN, "%s%du%d", layout->name, tag, split ? i : 0);
+        snprintf(c_name, CHAN_LEN, "%s%dc%d", layout->name, tag, i);
+        if (send_msg(user_fds[i], MULTICAST_CREATE, nick, c_name, "") < 0 ||
+            wait_for(user_fds[i], MULTICAST_SEND_SUCCESS) < 0) {
+            fprintf(stderr, "[Error] %s: could not create channel %s.\n", layout->name, c_name);
+            goto out;
+        }
+    }
+
+    snprintf(nick, NICK_LEN, "%s%ds", layout->name, tag);
+    sender = open_session(addr, nick);
+    if (sender < 0) {
+        fprintf(stderr, "[Error] %s: could not open the sender session.\n", layout->name);
+        goto out;
+    }
+    for (int i = 0; i < channels; i++) {
+        snprintf(c_name, CHAN_LEN, "%s%dc%d", layout->name, tag, i);
+        if (send_msg(sender, MULTICAST_JOIN, nick, c_name, "") < 0 ||
+            wait_for(sender, MULTICAST_SEND_SUCCESS) < 0 ||
+            wait_for(user_fds[i], MULTICAST_SEND) < 0) {
+            fprintf(stderr, "[Error] %s: the sender could not join %s.\n", layout->name, c_name);
+            goto out;
+        }
+    }
+    layout->setup = now_sec() - start;
+
+    start = now_sec();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < channels; i++) {
+            snprintf(c_name, CHAN_LEN, "%s%dc%d", layout->name, tag, i);
+            if (send_msg(sender, MULTICAST_SEND, nick, c_name, CHAT_LINE) < 0) {
+                goto out;
+            }
+        }
+        for (int i = 0; i < channels; i++) {
+            if (wait_for(user_fds[i], MULTICAST_SEND) < 0) {
+                fprintf(stderr, "[Error] %s: line %d of round %d never arrived.\n", layout->name, i, r);
+                goto out;
+            }
+            layout->frames++;
+        }
+        for (int i = 0; i < channels; i++) {
+            if (wait_for(sender, MULTICAST_SEND_SUCCESS) < 0) {
+                goto out;
+            }
+        }
+    }
+    layout->deliver = now_sec() - start;
+    ret = 0;
+
+out:
+    if (sender >= 0) {
+        close(sender);
+    }
+    for (int i = 0; i < channels; i++) {
+        if (user_fds[i] >= 0 && (split || i == 0)) {
+            close(user_fds[i]);
+        }
+    }
+    free(user_fds);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > 5) {
+        fprintf(stderr, "Usage: %s <server_name> <server_port> [channels] [rounds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int channels = argc > 3 ? atoi(argv[3]) : 50;
+    int rounds = argc > 4 ? atoi(argv[4]) : DEFAULT_ROUNDS;
+    if (channels < 1 || channels > MAX_CLIENT_CHANNELS || rounds < 1) {
+        fprintf(stderr, "channels must be between 1 and %d, rounds at least 1\n", MAX_CLIENT_CHANNELS);
+        exit(EXIT_FAILURE);
+    }
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[1], argv[2], &hints, &result) != 0) {
+        perror("getaddrinfo()");
+        exit(EXIT_FAILURE);
+    }
+
+    Layout layouts[] = {
+        { "multi", 1, 0, 0, 0 },
+        { "split", channels, 0, 0, 0 },
+    };
+    int failed = 0;
+
+    printf("%d channels, %d rounds of one %zu-byte line per channel\n\n", channels, rounds, strlen(CHAT_LINE));
+    printf("%-8s %9s %10s %12s %12s %12s\n", "layout", "sessions", "setup", "deliver", "lines/s", "per line");
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        Layout *layout = &layouts[i];
+        if (run_layout(result, layout, channels, rounds) < 0) {
+            failed = 1;
+            continue;
+        }
+        printf("%-8s %9d %8.1fms %10.1fms %12.0f %10.2fus\n", layout->name, layout->sessions,
+               layout->setup * 1e3, layout->deliver * 1e3, layout->frames / layout->deliver,
+               layout->deliver * 1e6 / layout->frames);
+    }
+
+    // Per-session server state the split layout multiplies, next to one extra membership
+    printf("\nserver bookkeeping: session %zu B + %d B read buffer, membership %zu B + %zu B slot\n",
+           sizeof(ClientInfo), RECV_BUF_SIZE, sizeof(Membership), sizeof(Membership *));
+
+    freeaddrinfo(result);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
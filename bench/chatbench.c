@@ -0,0 +1,588 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <time.h>
+#include "../common.h"
+#include "../msg_struct.h"
+#include "../proto.h"
+#include "../latency.h"
+
+// Chat load generator: <clients> sessions connect over the v1 framing, log in
+// with NICKNAME_NEW and share <channels> channels round-robin. Then each
+// session keeps one command in flight, drawn from the mix of unicast,
+// broadcast, channel messages and /who, until the run is over. One epoll loop
+// drives every socket without blocking. The report gives commands per second
+// and the time from sending a command to its reply by command type, the time
+// messages took to reach their recipients, and every error seen on the way.
+
+#define CB_RECV_LEN 4096           // Receive buffer of a session, holds at least one whole frame
+#define CB_LOGIN_WINDOW 256        // Sessions logging in at once, below the server's pending cap
+#define CB_SETUP_TIMEOUT_MS 30000  // Setup gives up on sessions that did not answer by then
+#define CB_DRAIN_MS 2000           // Wait for the replies still in flight when the run ends
+#define CB_STAMP "chatbench "      // Payloads carry the send time after this tag
+
+enum cb_op {
+    OP_UNICAST,
+    OP_BROADCAST,
+    OP_MULTICAST,
+    OP_WHO,
+    OP_KINDS
+};
+
+static const char *op_names[OP_KINDS] = { "unicast", "broadcast", "multicast", "who" };
+static const enum msg_type op_types[OP_KINDS] = { UNICAST_SEND, BROADCAST_SEND, MULTICAST_SEND, NICKNAME_LIST };
+static const enum msg_type op_success[OP_KINDS] = { UNICAST_SUCCESS, BROADCAST_SUCCESS, MULTICAST_SEND_SUCCESS, NICKNAME_LIST };
+static const enum msg_type op_error[OP_KINDS] = { UNICAST_ERROR, BROADCAST_ERROR, MULTICAST_SEND_ERROR, NICKNAME_LIST };
+
+enum cb_stage {
+    STAGE_IDLE,                    // Not connected yet
+    STAGE_CONNECTING,
+    STAGE_LOGGING_IN,
+    STAGE_LOGGED_IN,
+    STAGE_JOINING,                 // Creating or joining its channel
+    STAGE_READY,                   // Free to send the next command
+    STAGE_WAITING,                 // One command in flight
+    STAGE_CLOSED
+};
+
+typedef struct Session {
+    int fd;
+    enum cb_stage stage;
+    int channel;                   // Channel joined, -1 if setup failed
+    int op;                        // Command in flight
+    long long sent_ns;             // When it was sent
+    long long next_ns;             // Earliest time the next command may go out
+    size_t in_len;
+    size_t out_len, out_off;       // Part of a frame the socket did not take yet
+    char in[CB_RECV_LEN];
+    char out[PROTO_V1_HEADER_LEN + MSG_LEN];
+} Session;
+
+typedef struct OpStats {
+    unsigned long long sent, ok, errors, lost;
+    unsigned long long delivered;              // Frames received by other sessions
+    unsigned long long reply_hist[LATENCY_BUCKETS];
+    unsigned long long deliver_hist[LATENCY_BUCKETS];
+} OpStats;
+
+static Session *sessions;
+static int session_count;
+static int channel_count;
+static int epfd;
+static int tag;
+static OpStats stats[OP_KINDS];
+static unsigned long long connect_errors, login_errors, setup_errors, disconnects;
+
+// Function to get a monotonic timestamp in seconds
+double now_sec(void) {
+    return latency_now_ns() / 1e9;
+}
+
+// Function to name a session or a channel, tagged so several runs can share one server
+void session_nick(int index, char *nick) {
+    snprintf(nick, NICK_LEN, "cb%dn%d", tag, index);
+}
+
+void channel_name(int index, char *c_name) {
+    snprintf(c_name, CHAN_LEN, "cb%dc%d", tag, index);
+}
+
+// Function to watch a session for input, and for output while a frame is half sent
+void watch(Session *s, int op) {
+    struct epoll_event ev = { .data.u32 = (uint32_t)(s - sessions) };
+    ev.events = EPOLLIN | (s->stage == STAGE_CONNECTING || s->out_off < s->out_len ? EPOLLOUT : 0);
+    epoll_ctl(epfd, op, s->fd, &ev);
+}
+
+// Function to drop a session; a command in flight is counted as lost
+void close_session(Session *s) {
+    if (s->stage == STAGE_WAITING) {
+        stats[s->op].lost++;
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+    s->stage = STAGE_CLOSED;
+}
+
+// Function to write what is left of the current frame
+int flush_session(Session *s) {
+    while (s->out_off < s->out_len) {
+        ssize_t n = send(s->fd, s->out + s->out_off, s->out_len - s->out_off, MSG_NOSIGNAL);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watch(s, EPOLL_CTL_MOD);
+            return 0;
+        }
+        if (n <= 0) {
+            disconnects++;
+            close_session(s);
+            return -1;
+        }
+        s->out_off += n;
+    }
+    s->out_off = s->out_len = 0;
+    return 0;
+}
+
+// Function to send one v1 frame; a session has at most one frame being written
+int send_session_frame(Session *s, enum msg_type type, int index, const char *infos, const char *payload) {
+    struct message msgstruct;
+    memset(&msgstruct, 0, sizeof(struct message));
+    msgstruct.type = type;
+    session_nick(index, msgstruct.nick_sender);
+    strncpy(msgstruct.infos, infos, INFOS_LEN - 1);
+    msgstruct.pld_len = strlen(payload);
+
+    s->out_len = proto_encode(PROTO_V1, (uint8_t *)s->out, &msgstruct, payload, msgstruct.pld_len);
+    s->out_off = 0;
+    return flush_session(s);
+}
+
+// Function to start a non-blocking connect
+void start_session(Session *s, struct addrinfo *addr) {
+    s->fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+    if (s->fd == -1 || (connect(s->fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS)) {
+        connect_errors++;
+        close_session(s);
+        return;
+    }
+    s->stage = STAGE_CONNECTING;
+    watch(s, EPOLL_CTL_ADD);
+}
+
+// Function to send the nickname request once the connection is up
+void send_login(Session *s) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+        connect_errors++;
+        close_session(s);
+        return;
+    }
+
+    char nick[NICK_LEN];
+    int index = (int)(s - sessions);
+    session_nick(index, nick);
+    s->stage = STAGE_LOGGING_IN;
+    // The login frame carries no payload, the nickname travels in infos
+    send_session_frame(s, NICKNAME_NEW, index, nick, "");
+}
+
+// Function to record the time a message took to reach this session
+void record_delivery(int op, const char *payload) {
+    const char *stamp = strstr(payload, CB_STAMP);
+    if (stamp == NULL) {
+        return;
+    }
+    long long sent_ns = strtoll(stamp + strlen(CB_STAMP), NULL, 10);
+    long long ns = latency_now_ns() - sent_ns;
+    stats[op].delivered++;
+    stats[op].deliver_hist[latency_bucket(ns > 0 ? ns : 0)]++;
+}
+
+// Function to act on one frame received by a session
+void on_frame(Session *s, const struct message *msg, const char *payload, long long interval_ns) {
+    switch (msg->type) {
+        case UNICAST_SEND:
+            record_delivery(OP_UNICAST, payload);
+            return;
+        case BROADCAST_SEND:
+            record_delivery(OP_BROADCAST, payload);
+            return;
+        case MULTICAST_SEND:
+            record_delivery(OP_MULTICAST, payload);
+            return;
+        default:
+            break;
+    }
+
+    if (s->stage == STAGE_LOGGING_IN) {
+        if (msg->type == NICKNAME_SUCCESS) {
+            s->stage = STAGE_LOGGED_IN;
+        } else {
+            login_errors++;
+            close_session(s);
+        }
+    } else if (s->stage == STAGE_JOINING) {
+        // Creating or joining ends with the server's own channel notice being acknowledged
+        if (msg->type == MULTICAST_CREATE_ERROR || msg->type == MULTICAST_JOIN_ERROR) {
+            setup_errors++;
+            s->channel = -1;
+            s->stage = STAGE_READY;
+        } else if (msg->type == MULTICAST_SEND_SUCCESS || msg->type == MULTICAST_SEND_ERROR) {
+            s->stage = STAGE_READY;
+        }
+    } else if (s->stage == STAGE_WAITING && msg->type == NICKNAME_LIST && strcmp(msg->infos, "more") == 0) {
+        // Only the last chunk of a /who page acknowledges it
+    } else if (s->stage == STAGE_WAITING && (msg->type == op_success[s->op] || msg->type == op_error[s->op])) {
+        long long now = latency_now_ns();
+        long long ns = now - s->sent_ns;
+        if (msg->type == op_success[s->op]) {
+            stats[s->op].ok++;
+        } else {
+            stats[s->op].errors++;
+        }
+        stats[s->op].reply_hist[latency_bucket(ns > 0 ? ns : 0)]++;
+        s->stage = STAGE_READY;
+        s->next_ns = s->sent_ns + interval_ns > now ? s->sent_ns + interval_ns : now;
+    }
+}
+
+// Function to read what arrived on a session and handle every whole frame
+void read_session(Session *s, long long interval_ns) {
+    for (;;) {
+        ssize_t n = recv(s->fd, s->in + s->in_len, CB_RECV_LEN - s->in_len, 0);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n <= 0) {
+            if (s->stage == STAGE_LOGGING_IN) {
+                login_errors++;
+            } else {
+                disconnects++;
+            }
+            close_session(s);
+            return;
+        }
+        s->in_len += n;
+
+        size_t off = 0;
+        while (s->in_len - off >= PROTO_V1_HEADER_LEN) {
+            struct message msg;
+            char payload[MSG_LEN + 1];
+            memcpy(&msg, s->in + off, PROTO_V1_HEADER_LEN);
+            if (msg.pld_len < 0 || msg.pld_len > MSG_LEN) {
+                disconnects++;
+                close_session(s);
+                return;
+            }
+            if (s->in_len - off < PROTO_V1_HEADER_LEN + msg.pld_len) {
+                break;
+            }
+            memcpy(payload, s->in + off + PROTO_V1_HEADER_LEN, msg.pld_len);
+            payload[msg.pld_len] = '\0';
+            off += PROTO_V1_HEADER_LEN + msg.pld_len;
+            on_frame(s, &msg, payload, interval_ns);
+            if (s->stage == STAGE_CLOSED) {
+                return;
+            }
+        }
+        memmove(s->in, s->in + off, s->in_len - off);
+        s->in_len -= off;
+    }
+}
+
+// Function to wait for events once and handle them
+void pump(int timeout_ms, long long interval_ns) {
+    struct epoll_event events[256];
+    int n = epoll_wait(epfd, events, 256, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        Session *s = &sessions[events[i].data.u32];
+        if (s->stage == STAGE_CLOSED) {
+            continue;
+        }
+        if (s->stage == STAGE_CONNECTING) {
+            send_login(s);
+            continue;
+        }
+        if ((events[i].events & EPOLLOUT) && flush_session(s) == 0 && s->out_len == 0) {
+            watch(s, EPOLL_CTL_MOD);
+        }
+        if (s->stage != STAGE_CLOSED && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+            read_session(s, interval_ns);
+        }
+    }
+}
+
+// Function to count the sessions in a stage
+int count_stage(enum cb_stage stage) {
+    int count = 0;
+    for (int i = 0; i < session_count; i++) {
+        count += sessions[i].stage == stage;
+    }
+    return count;
+}
+
+// Function to log every session in, CB_LOGIN_WINDOW at a time
+void login_all(struct addrinfo *addr) {
+    double deadline = now_sec() + CB_SETUP_TIMEOUT_MS / 1000.0;
+    int next = 0;
+    while (now_sec() < deadline) {
+        int in_progress = count_stage(STAGE_CONNECTING) + count_stage(STAGE_LOGGING_IN);
+        while (next < session_count && in_progress < CB_LOGIN_WINDOW) {
+            start_session(&sessions[next++], addr);
+            in_progress++;
+        }
+        if (next == session_count && in_progress == 0) {
+            return;
+        }
+        pump(10, 0);
+    }
+    for (int i = 0; i < session_count; i++) {
+        if (sessions[i].stage != STAGE_LOGGED_IN && sessions[i].stage != STAGE_CLOSED) {
+            login_errors++;
+            close_session(&sessions[i]);
+        }
+    }
+}
+
+// Function to create the channels, then have every other session join one of them
+void join_all(void) {
+    char c_name[CHAN_LEN];
+    for (int step = 0; step < 2; step++) {
+        for (int i = 0; i < session_count; i++) {
+            Session *s = &sessions[i];
+            // The first session of each channel creates it
+            if (s->stage != STAGE_LOGGED_IN || (step == 0) != (i < channel_count)) {
+                continue;
+            }
+            channel_name(s->channel, c_name);
+            s->stage = STAGE_JOINING;
+            send_session_frame(s, step == 0 ? MULTICAST_CREATE : MULTICAST_JOIN, i, c_name, "");
+        }
+
+        double deadline = now_sec() + CB_SETUP_TIMEOUT_MS / 1000.0;
+        while (count_stage(STAGE_JOINING) > 0 && now_sec() < deadline) {
+            pump(10, 0);
+        }
+    }
+    for (int i = 0; i < session_count; i++) {
+        if (sessions[i].stage == STAGE_JOINING) {
+            setup_errors++;
+            close_session(&sessions[i]);
+        }
+    }
+}
+
+// Function to draw a command from the mix, weights add up to total
+int pick_op(const int *mix, int total, unsigned int *seed) {
+    int r = rand_r(seed) % total;
+    for (int op = 0; op < OP_KINDS; op++) {
+        if (r < mix[op]) {
+            return op;
+        }
+        r -= mix[op];
+    }
+    return OP_WHO;
+}
+
+// Function to send the next command of a session
+void send_command(Session *s, int op, unsigned int *seed) {
+    int index = (int)(s - sessions);
+    char infos[INFOS_LEN] = "";
+    char payload[64];
+
+    if (op == OP_UNICAST) {
+        // Anyone still connected but the sender
+        int to = index;
+        for (int tries = 0; tries < 8 && (to == index || sessions[to].stage < STAGE_READY || sessions[to].stage == STAGE_CLOSED); tries++) {
+            to = rand_r(seed) % session_count;
+        }
+        if (to == index) {
+            op = OP_WHO;
+        } else {
+            session_nick(to, infos);
+        }
+    } else if (op == OP_MULTICAST) {
+        if (s->channel < 0) {
+            op = OP_WHO;
+        } else {
+            channel_name(s->channel, infos);
+        }
+    }
+
+    s->op = op;
+    s->sent_ns = latency_now_ns();
+    s->stage = STAGE_WAITING;
+    if (op == OP_WHO) {
+        payload[0] = '\0';
+    } else {
+        snprintf(payload, sizeof(payload), CB_STAMP "%lld", s->sent_ns);
+    }
+    stats[op].sent++;
+    send_session_frame(s, op_types[op], index, infos, payload);
+}
+
+// Function to print the percentiles of one histogram, in milliseconds
+void print_percentiles(const unsigned long long *hist) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    unsigned long long total = 0, seen = 0;
+    double values[5] = { 0 };
+    int q = 0;
+
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        total += hist[b];
+    }
+    for (int b = 0; b < LATENCY_BUCKETS && total > 0; b++) {
+        if (hist[b] == 0) {
+            continue;
+        }
+        seen += hist[b];
+        while (q < 4 && seen >= quantiles[q] * total) {
+            values[q++] = latency_bucket_high(b) / 1e6;
+        }
+        values[4] = latency_bucket_high(b) / 1e6;
+    }
+    printf(" %9.3f %9.3f %9.3f %9.3f %9.3f\n", values[0], values[1], values[2], values[3], values[4]);
+}
+
+// Function to parse "unicast,broadcast,multicast,who" weights
+int parse_mix(const char *arg, int *mix) {
+    return sscanf(arg, "%d,%d,%d,%d", &mix[OP_UNICAST], &mix[OP_BROADCAST], &mix[OP_MULTICAST], &mix[OP_WHO]) == 4 &&
+           mix[OP_UNICAST] >= 0 && mix[OP_BROADCAST] >= 0 && mix[OP_MULTICAST] >= 0 && mix[OP_WHO] >= 0 &&
+           mix[OP_UNICAST] + mix[OP_BROADCAST] + mix[OP_MULTICAST] + mix[OP_WHO] > 0 ? 0 : -1;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c clients] [-C channels] [-d seconds] [-r commands_per_sec] "
+                    "[-m unicast,broadcast,multicast,who] <server_name> <server_port>\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int mix[OP_KINDS] = { 60, 2, 30, 8 };
+    double duration = 10;
+    double rate = 0;               // Commands per second per session, 0 sends as soon as the reply is in
+    int opt;
+
+    session_count = 1000;
+    channel_count = 10;
+    while ((opt = getopt(argc, argv, "c:C:d:r:m:")) != -1) {
+        switch (opt) {
+            case 'c': session_count = atoi(optarg); break;
+            case 'C': channel_count = atoi(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'm':
+                if (parse_mix(optarg, mix) < 0) {
+                    usage(argv[0]);
+                }
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || session_count < 2 || channel_count < 1 || channel_count > session_count ||
+        duration <= 0 || rate < 0) {
+        usage(argv[0]);
+    }
+    int mix_total = mix[OP_UNICAST] + mix[OP_BROADCAST] + mix[OP_MULTICAST] + mix[OP_WHO];
+    long long interval_ns = rate > 0 ? (long long)(1e9 / rate) : 0;
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[optind], argv[optind + 1], &hints, &result) != 0) {
+        perror("getaddrinfo()");
+        exit(EXIT_FAILURE);
+    }
+
+    sessions = calloc(session_count, sizeof(Session));
+    epfd = epoll_create1(0);
+    if (sessions == NULL || epfd == -1) {
+        perror("setup");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < session_count; i++) {
+        sessions[i].fd = -1;
+        sessions[i].channel = i % channel_count;
+    }
+    tag = (int)(getpid() % 100000);
+    unsigned int seed = (unsigned int)getpid();
+
+    printf("chatbench: %d clients, %d channels, %.0f s, mix unicast %d / broadcast %d / multicast %d / who %d, ",
+           session_count, channel_count, duration, mix[OP_UNICAST], mix[OP_BROADCAST], mix[OP_MULTICAST], mix[OP_WHO]);
+    if (rate > 0) {
+        printf("%.1f commands/s per client\n", rate);
+    } else {
+        printf("one command in flight per client\n");
+    }
+
+    double start = now_sec();
+    login_all(result);
+    int logged_in = count_stage(STAGE_LOGGED_IN);
+    printf("setup: %d logged in in %.2f s", logged_in, now_sec() - start);
+    start = now_sec();
+    join_all();
+    printf(", channels joined in %.2f s\n", now_sec() - start);
+    freeaddrinfo(result);
+
+    // Spread the first commands over one interval so the sessions do not move in lockstep
+    long long run_start = latency_now_ns();
+    for (int i = 0; i < session_count; i++) {
+        sessions[i].next_ns = run_start + (interval_ns > 0 ? rand_r(&seed) % interval_ns : 0);
+    }
+
+    long long run_end = run_start + (long long)(duration * 1e9);
+    long long now = run_start;
+    while (now < run_end) {
+        for (int i = 0; i < session_count; i++) {
+            if (sessions[i].stage == STAGE_READY && sessions[i].next_ns <= now) {
+                send_command(&sessions[i], pick_op(mix, mix_total, &seed), &seed);
+            }
+        }
+        pump(1, interval_ns);
+        now = latency_now_ns();
+    }
+    double elapsed = (now - run_start) / 1e9;
+
+    // Let the replies in flight arrive, what is still missing then is lost
+    long long drain_end = now + CB_DRAIN_MS * 1000000LL;
+    while (count_stage(STAGE_WAITING) > 0 && latency_now_ns() < drain_end) {
+        pump(10, interval_ns);
+    }
+    for (int i = 0; i < session_count; i++) {
+        if (sessions[i].stage == STAGE_WAITING) {
+            stats[sessions[i].op].lost++;
+        }
+    }
+
+    unsigned long long total = 0;
+    for (int op = 0; op < OP_KINDS; op++) {
+        total += stats[op].ok + stats[op].errors;
+    }
+    printf("throughput: %.0f commands/s over %.2f s\n\n", total / elapsed, elapsed);
+
+    printf("%-10s %9s %9s %7s %7s %9s %9s %9s %9s %9s %9s\n", "reply", "sent", "ok", "errors", "lost", "cmd/s",
+           "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+    for (int op = 0; op < OP_KINDS; op++) {
+        OpStats *st = &stats[op];
+        printf("%-10s %9llu %9llu %7llu %7llu %9.0f", op_names[op], st->sent, st->ok, st->errors, st->lost,
+               (st->ok + st->errors) / elapsed);
+        print_percentiles(st->reply_hist);
+    }
+
+    printf("\n%-10s %9s %9s %9s %9s %9s %9s %9s\n", "delivery", "received", "msg/s", "p50 ms", "p90 ms", "p99 ms",
+           "p99.9 ms", "max ms");
+    for (int op = 0; op < OP_WHO; op++) {
+        printf("%-10s %9llu %9.0f", op_names[op], stats[op].delivered, stats[op].delivered / elapsed);
+        print_percentiles(stats[op].deliver_hist);
+    }
+
+    printf("\nerrors: connect %llu, login %llu, setup %llu, disconnected %llu\n",
+           connect_errors, login_errors, setup_errors, disconnects);
+
+    for (int i = 0; i < session_count; i++) {
+        if (sessions[i].fd >= 0) {
+            close(sessions[i].fd);
+        }
+    }
+    close(epfd);
+    free(sessions);
+    return 0;
+}
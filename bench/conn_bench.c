@@ -0,0 +1,105 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <time.h>
+#include "../common.h"
+#include "../msg_struct.h"
+#include "../proto.h"
+
+// Connection-count benchmark: opens <count> sessions against a running server,
+// logs each one in with a unique nickname and keeps them all open.
+
+// Function to get a monotonic timestamp in seconds
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to open one session and perform the nickname handshake
+int open_session(struct addrinfo *addr, int index) {
+    int sfd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (sfd == -1) {
+        return -1;
+    }
+    if (connect(sfd, addr->ai_addr, addr->ai_addrlen) == -1) {
+        close(sfd);
+        return -1;
+    }
+
+    struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
+    setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct message msgstruct;
+    memset(&msgstruct, 0, sizeof(struct message));
+    msgstruct.type = NICKNAME_NEW;
+    snprintf(msgstruct.infos, INFOS_LEN, "bench%d", index);
+    strncpy(msgstruct.nick_sender, msgstruct.infos, NICK_LEN - 1);
+    msgstruct.pld_len = strlen(msgstruct.infos);
+
+    struct message reply;
+    if (send(sfd, &msgstruct, PROTO_V1_HEADER_LEN, MSG_NOSIGNAL) != PROTO_V1_HEADER_LEN ||
+        recv(sfd, &reply, PROTO_V1_HEADER_LEN, MSG_WAITALL) != PROTO_V1_HEADER_LEN ||
+        reply.type != NICKNAME_SUCCESS) {
+        close(sfd);
+        return -1;
+    }
+    return sfd;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <server_name> <server_port> <count>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int count = atoi(argv[3]);
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[1], argv[2], &hints, &result) != 0) {
+        perror("getaddrinfo()");
+        exit(EXIT_FAILURE);
+    }
+
+    int *fds = calloc(count, sizeof(int));
+    int sessions = 0;
+    int failures = 0;
+    double start = now_sec();
+
+    for (int i = 0; i < count; i++) {
+        fds[i] = open_session(result, i);
+        if (fds[i] >= 0) {
+            sessions++;
+        } else {
+            failures++;
+        }
+    }
+
+    double elapsed = now_sec() - start;
+    printf("requested=%d sessions=%d refused=%d elapsed=%.2fs rate=%.0f sessions/s\n",
+           count, sessions, failures, elapsed, sessions / (elapsed > 0 ? elapsed : 1));
+
+    for (int i = 0; i < count; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    free(fds);
+    freeaddrinfo(result);
+    return sessions == count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,208 @@
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+#include "../common.h"
+#include "../msg_struct.h"
+#include "../nick_index.h"
+#include "../proto.h"
+#include "../log.h"
+
+// Server hot-path microbenchmarks: <users> synthetic sessions spread over
+// <channels> channels are built in-process by the server's own registry code,
+// with no sockets, then the lookups and handlers whose cost grows with the
+// number of users are timed. Each size runs in a fresh child process. The
+// send queues of the sessions are marked doomed, so every frame a handler
+// queues is encoded and freed right away instead of piling up.
+
+#define HOT_FIRST_FD 16           // Synthetic sockets start above the real descriptors
+#define HOT_MIN_SEC 0.05          // Each measurement runs for at least this long
+#define HOT_LINE "see you at the demo!"
+
+extern NickIndex nick_index;
+
+// Server registry functions; the client has its own add_user, so common.h leaves them out
+void add_user(ClientInfo **list, int sockfd, struct sockaddr_in address);
+
+static int user_count;
+static int chan_count;
+static char (*nicks)[NICK_LEN];
+static char (*chans)[CHAN_LEN];
+
+// Function to get a monotonic timestamp in seconds
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to spread consecutive calls over the users
+int pick(long i) {
+    return (int)((unsigned long)i * 2654435761u % (unsigned long)user_count);
+}
+
+// Function to build the sessions and channels; user i is in channel i % channels
+int build_registry(void) {
+    struct sockaddr_in address = { .sin_family = AF_INET };
+
+    nicks = calloc(user_count, NICK_LEN);
+    chans = calloc(chan_count, CHAN_LEN);
+    if (nicks == NULL || chans == NULL || pools_init(user_count, chan_count) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < user_count; i++) {
+        add_user(&clientList, HOT_FIRST_FD + i, address);
+        ClientInfo *client = sockfd_to_client(clientList, HOT_FIRST_FD + i);
+        if (client == NULL) {
+            return -1;
+        }
+        snprintf(nicks[i], NICK_LEN, "user%d", i);
+        strcpy(client->nickname, nicks[i]);
+        client->proto = PROTO_V1;
+        client->sendq.doomed = 1;
+        if (assign_uid(client) == 0 || nick_index_insert(&nick_index, client) < 0) {
+            return -1;
+        }
+    }
+    for (int c = 0; c < chan_count; c++) {
+        snprintf(chans[c], CHAN_LEN, "chan%d", c);
+        if (addChannel(chans[c]) == NULL) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < user_count; i++) {
+        Channel *channel = channel_info(channel_list, chans[i % chan_count]);
+        if (channel_add_member(channel, sockfd_to_client(clientList, HOT_FIRST_FD + i)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void bench_nick_to_client(long i) {
+    nick_to_client(clientList, nicks[pick(i)]);
+}
+
+void bench_sockfd_to_client(long i) {
+    sockfd_to_client(clientList, HOT_FIRST_FD + pick(i));
+}
+
+// Taken and free nicknames, one after the other
+void bench_update_nickname(long i) {
+    char fresh[] = "newcomer";
+    update_nickname(i & 1 ? fresh : nicks[pick(i)]);
+}
+
+// Existing and unknown channels, one after the other
+void bench_channel_existence(long i) {
+    char unknown[] = "nowhere";
+    check_channel_existence(clientList, i & 1 ? unknown : chans[pick(i) % chan_count]);
+}
+
+// The first page of the whole list
+void bench_who(long i) {
+    char request[] = "";
+    handle_who(HOT_FIRST_FD + pick(i), request, clientList);
+}
+
+void bench_channel_list(long i) {
+    handle_channel_list(clientList, nicks[pick(i)]);
+}
+
+void bench_broadcast(long i) {
+    char line[] = HOT_LINE;
+    handle_msgall(HOT_FIRST_FD + pick(i), line, strlen(line), clientList);
+}
+
+void bench_multicast(long i) {
+    char line[] = HOT_LINE;
+    int sender = pick(i);
+    handle_multicast(clientList, nicks[sender], line, chans[sender % chan_count]);
+}
+
+typedef struct HotBench {
+    const char *name;
+    void (*run)(long i);
+} HotBench;
+
+static const HotBench benches[] = {
+    { "nick_to_client", bench_nick_to_client },
+    { "sockfd_to_client", bench_sockfd_to_client },
+    { "update_nickname", bench_update_nickname },
+    { "channel_exists", bench_channel_existence },
+    { "handle_who", bench_who },
+    { "channel_list", bench_channel_list },
+    { "broadcast", bench_broadcast },
+    { "multicast", bench_multicast },
+};
+#define HOT_BENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+// Function to time one routine, doubling the batch until it runs for HOT_MIN_SEC
+double ns_per_call(void (*run)(long i)) {
+    for (long batch = 1; ; batch *= 2) {
+        double start = now_sec();
+        for (long i = 0; i < batch; i++) {
+            run(i);
+        }
+        double elapsed = now_sec() - start;
+        if (elapsed >= HOT_MIN_SEC) {
+            return elapsed * 1e9 / batch;
+        }
+    }
+}
+
+// Function to run every routine against one registry size
+void run_size(void) {
+    if (build_registry() < 0) {
+        fprintf(stderr, "[Error] could not build %d users in %d channels.\n", user_count, chan_count);
+        exit(EXIT_FAILURE);
+    }
+    printf("%8d", user_count);
+    for (int b = 0; b < HOT_BENCHES; b++) {
+        printf(" %16.1f", ns_per_call(benches[b].run));
+        fflush(stdout);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [channels] [max_users]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    chan_count = argc > 1 ? atoi(argv[1]) : 100;
+    int max_users = argc > 2 ? atoi(argv[2]) : 100000;
+    if (chan_count < 1 || max_users < 10) {
+        fprintf(stderr, "channels must be at least 1, max_users at least 10\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Only errors reach the log, handlers log every call otherwise
+    log_min_level = LOG_ERROR;
+
+    printf("ns per call, %d channels, users in channel i %% %d\n", chan_count, chan_count);
+    printf("%8s", "users");
+    for (int b = 0; b < HOT_BENCHES; b++) {
+        printf(" %16s", benches[b].name);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    // A fresh process per size, so no size inherits the registry of the one before
+    for (user_count = 10; user_count <= max_users; user_count *= 10) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_size();
+            exit(EXIT_SUCCESS);
+        }
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "[Error] the run with %d users failed.\n", user_count);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "../common.h"
+#include "../nick_index.h"
+
+// Nickname lookup benchmark: times the linear strcasecmp scan the server used
+// to do over clientList against the hash index, for growing user counts.
+
+#define HASH_LOOKUPS 2000000
+#define SCAN_WORK 200000000.0   // Roughly the number of compares spent per scan measurement
+
+// Function to get a monotonic timestamp in seconds
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to walk the list like the old nick_to_client()/update_nickname()
+ClientInfo *scan_list(ClientInfo *list, const char *nick) {
+    for (ClientInfo *curr = list; curr != NULL; curr = curr->next) {
+        if (strcasecmp(curr->nickname, nick) == 0) {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+// Function to time one user count, returns ns per lookup for both methods
+void run(int count, double *scan_ns, double *hash_ns) {
+    ClientInfo *users = calloc(count, sizeof(ClientInfo));
+    NickIndex idx = {0};
+    if (users == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        snprintf(users[i].nickname, NICK_LEN, "user%d", i);
+        users[i].next = i + 1 < count ? &users[i + 1] : NULL;
+        if (nick_index_insert(&idx, &users[i]) < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Look up names spread over the whole list, plus some misses
+    char names[64][NICK_LEN];
+    for (int i = 0; i < 64; i++) {
+        snprintf(names[i], NICK_LEN, i % 8 == 0 ? "ghost%d" : "USER%d", (int)((i * 2654435761u) % count));
+    }
+
+    volatile long sink = 0;
+    int scans = (int)(SCAN_WORK / count) + 64;
+    double start = now_sec();
+    for (int i = 0; i < scans; i++) {
+        sink += scan_list(users, names[i & 63]) != NULL;
+    }
+    *scan_ns = (now_sec() - start) * 1e9 / scans;
+
+    start = now_sec();
+    for (int i = 0; i < HASH_LOOKUPS; i++) {
+        sink += nick_index_find(&idx, names[i & 63]) != NULL;
+    }
+    *hash_ns = (now_sec() - start) * 1e9 / HASH_LOOKUPS;
+
+    nick_index_free(&idx);
+    free(users);
+}
+
+int main(void) {
+    static const int counts[] = { 10, 100, 1000, 10000, 100000 };
+
+    printf("%10s %14s %14s\n", "users", "list scan ns", "hash index ns");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        double scan_ns, hash_ns;
+        run(counts[i], &scan_ns, &hash_ns);
+        printf("%10d %14.1f %14.1f\n", counts[i], scan_ns, hash_ns);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../common.h"
+#include "../msg_struct.h"
+#include "../proto.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Receive-path benchmark: fills a read buffer with chat lines and decodes it
+// the way the server used to (clear a stack header and a MSG_LEN buffer, then
+// copy each frame out) and the way it does now (decode in place from the
+// per-connection buffer). Prints cycles and nanoseconds per frame.
+
+#define CHAT_LINE "see you at the demo!"   // A typical 20-byte chat line
+#define ROUNDS 200000
+
+// Function to get a monotonic timestamp in seconds
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to read the CPU cycle counter, 0 where there is none
+unsigned long long cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Function to fill a read buffer with as many whole broadcast frames as fit
+size_t fill_buffer(int version, FrameDecoder *dec) {
+    struct message msg = { .type = BROADCAST_SEND, .pld_len = strlen(CHAT_LINE) };
+    uint8_t frame[PROTO_V2_MAX_FRAME(MSG_LEN) + PROTO_V1_HEADER_LEN];
+    size_t len = proto_encode(version, frame, &msg, CHAT_LINE, msg.pld_len);
+    size_t frames = 0;
+
+    memset(dec, 0, sizeof(FrameDecoder));
+    if (decoder_reserve(dec) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    while (decoder_fill(dec, frame, len) == len) {
+        frames++;
+    }
+    dec->len -= RECV_BUF_SIZE - frames * len;    // Drop the partial frame at the end
+    return frames;
+}
+
+// Function to decode one frame the old way: cleared stack buffers, payload copied out
+int decode_copy(int version, FrameDecoder *dec, struct message *msg, char *buff) {
+    memset(msg, 0, sizeof(struct message));
+    memset(buff, 0, MSG_LEN);
+    size_t used;
+    if (version == PROTO_V2) {
+        if (proto_v2_decode((uint8_t *)dec->buf + dec->start, dec->len, msg, buff, MSG_LEN, &used) != 1) {
+            return 0;
+        }
+    } else {
+        if (dec->len < PROTO_V1_HEADER_LEN) {
+            return 0;
+        }
+        memcpy(msg, dec->buf + dec->start, PROTO_V1_HEADER_LEN);
+        memcpy(buff, dec->buf + dec->start + PROTO_V1_HEADER_LEN, msg->pld_len);
+        buff[msg->pld_len] = '\0';
+        used = PROTO_V1_HEADER_LEN + msg->pld_len;
+    }
+    dec->start += used;
+    dec->len -= used;
+    return 1;
+}
+
+// Function to time decoding a full read buffer, returns cycles and ns per frame
+void run(int version, int in_place, double *cyc, double *ns) {
+    FrameDecoder dec;
+    size_t frames = fill_buffer(version, &dec);
+    size_t filled = dec.len;
+    struct message msg;
+    char buff[MSG_LEN];
+    volatile size_t sink = 0;
+
+    double start = now_sec();
+    unsigned long long start_cyc = cycles();
+    for (int r = 0; r < ROUNDS; r++) {
+        dec.start = 0;
+        dec.len = filled;
+        if (in_place) {
+            char *pld;
+            while ((version == PROTO_V2 ? decoder_next_frame_v2(&dec, &pld) : decoder_next_frame(&dec, 1, &pld)) == 1) {
+                sink += dec.header.pld_len + (unsigned char)pld[0];
+            }
+            decoder_release(&dec);
+        } else {
+            while (decode_copy(version, &dec, &msg, buff) == 1) {
+                sink += msg.pld_len + (unsigned char)buff[0];
+            }
+        }
+    }
+    *cyc = (double)(cycles() - start_cyc) / ((double)ROUNDS * frames);
+    *ns = (now_sec() - start) * 1e9 / ((double)ROUNDS * frames);
+    free(dec.buf);
+}
+
+int main(void) {
+    printf("%-8s %-10s %14s %14s\n", "version", "decode", "cycles/frame", "ns/frame");
+    for (int version = PROTO_V1; version <= PROTO_V2; version++) {
+        for (int in_place = 0; in_place <= 1; in_place++) {
+            double cyc, ns;
+            run(version, in_place, &cyc, &ns);
+            printf("v%-7d %-10s %14.1f %14.2f\n", version, in_place ? "in place" : "copy", cyc, ns);
+        }
+    }
+    return EXIT_SUCCESS;
+}
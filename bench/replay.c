@@ -0,0 +1,439 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <time.h>
+#include "../common.h"
+#include "../msg_struct.h"
+#include "../proto.h"
+#include "../capture.h"
+#include "../latency.h"
+
+// Capture replay: plays a file recorded with `server -r` back against a fresh
+// server. Every session of the capture gets its own connection, opened at its
+// first frame and speaking the protocol it spoke then. Its frames go out at
+// their recorded times divided by <speed>, where 0 replays as fast as the
+// server takes them, and the connection closes where the session closed.
+// Replies are read and counted, not checked. The report gives how far behind
+// schedule frames went out, so that two builds can be compared on one workload.
+
+#define REPLAY_OUT_LIMIT 65536     // Unsent bytes of a connection before the replay waits for it
+#define REPLAY_DRAIN_MS 1000       // Replies read after the last record
+
+typedef struct Record {
+    unsigned long long ts_us;      // Time since the capture started
+    uint32_t conn_id;
+    int kind;
+    int proto;
+    size_t off, len;               // The v2 frame, in the capture
+} Record;
+
+typedef struct Conn {
+    uint32_t id;
+    int fd;                        // -1 until the first frame, and once closed
+    int proto;
+    int opened;
+    int closing;                   // Close once everything queued is written
+    int want_out;                  // Watched for room to write
+    char *out;
+    size_t out_len, out_off, out_cap;
+} Conn;
+
+static Conn *conns;
+static int conn_count;
+static int epfd;
+static unsigned long long bytes_sent, bytes_received;
+static unsigned long long connect_errors, server_closed;
+
+// Function to get a monotonic timestamp in microseconds
+long long now_us(void) {
+    return latency_now_ns() / 1000;
+}
+
+int compare_conn_id(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to find the connection of a session (conns is sorted by id)
+Conn *find_conn(uint32_t id) {
+    return bsearch(&id, conns, conn_count, sizeof(Conn), compare_conn_id);
+}
+
+// Function to split a capture into records, returns their number or -1
+int parse_capture(const uint8_t *data, size_t size, Record **out) {
+    if (size < CAPTURE_MAGIC_LEN || memcmp(data, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0) {
+        return -1;
+    }
+    size_t cap = 1024, count = 0, off = CAPTURE_MAGIC_LEN;
+    Record *records = malloc(cap * sizeof(Record));
+
+    while (records != NULL && off < size) {
+        Record r = { .kind = data[off++] };
+        uint64_t ts, id;
+        size_t used;
+        if (capture_get_varint64(data + off, size - off, &ts, &used) != 1) {
+            break;
+        }
+        off += used;
+        if (capture_get_varint64(data + off, size - off, &id, &used) != 1) {
+            break;
+        }
+        off += used;
+        r.ts_us = ts;
+        r.conn_id = (uint32_t)id;
+
+        if (r.kind == CAPTURE_FRAME) {
+            uint32_t body_len;
+            if (off >= size) {
+                break;
+            }
+            r.proto = data[off++];
+            if (proto_get_varint(data + off, size - off, &body_len, &used) != 1 || off + used + body_len > size) {
+                break;
+            }
+            r.off = off;
+            r.len = used + body_len;
+            off += r.len;
+        } else if (r.kind != CAPTURE_CLOSE) {
+            break;
+        }
+
+        if (count == cap) {
+            cap *= 2;
+            Record *grown = realloc(records, cap * sizeof(Record));
+            if (grown == NULL) {
+                free(records);
+                return -1;
+            }
+            records = grown;
+        }
+        records[count++] = r;
+    }
+    if (records == NULL) {
+        return -1;
+    }
+    // A capture cut short by a killed server ends with a partial record
+    if (off < size) {
+        fprintf(stderr, "[Warning] ignoring %zu trailing bytes of the capture.\n", size - off);
+    }
+    *out = records;
+    return (int)count;
+}
+
+// Function to give every session of the capture a connection slot
+int build_conns(const Record *records, int count) {
+    uint32_t *ids = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (ids == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        ids[i] = records[i].conn_id;
+    }
+    qsort(ids, count, sizeof(uint32_t), compare_conn_id);
+
+    conns = calloc(count > 0 ? count : 1, sizeof(Conn));
+    if (conns == NULL) {
+        free(ids);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (conn_count == 0 || conns[conn_count - 1].id != ids[i]) {
+            conns[conn_count].id = ids[i];
+            conns[conn_count].fd = -1;
+            conn_count++;
+        }
+    }
+    free(ids);
+    return 0;
+}
+
+// Function to watch a connection for replies, and for room to write while bytes are waiting
+void watch(Conn *c, int want_out) {
+    if (c->want_out != want_out) {
+        struct epoll_event ev = { .events = EPOLLIN | (want_out ? EPOLLOUT : 0), .data.u32 = (uint32_t)(c - conns) };
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->want_out = want_out;
+    }
+}
+
+void close_conn(Conn *c) {
+    close(c->fd);
+    c->fd = -1;
+    c->out_len = c->out_off = 0;
+}
+
+// Function to write what a connection has queued; closes it once a requested close is due
+void flush_conn(Conn *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN)) {
+            watch(c, 1);
+            return;
+        }
+        if (n <= 0) {
+            server_closed++;
+            close_conn(c);
+            return;
+        }
+        c->out_off += n;
+        bytes_sent += n;
+    }
+    c->out_off = c->out_len = 0;
+    if (c->closing) {
+        close_conn(c);
+    } else {
+        watch(c, 0);
+    }
+}
+
+// Function to append bytes to what a connection has to write
+int queue_bytes(Conn *c, const void *data, size_t len) {
+    if (c->out_off > 0 && c->out_off == c->out_len) {
+        c->out_off = c->out_len = 0;
+    }
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap > 0 ? c->out_cap : 4096;
+        while (cap < c->out_len + len) {
+            cap *= 2;
+        }
+        char *grown = realloc(c->out, cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        c->out = grown;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+// Function to open the connection of a session at its first frame
+void open_conn(Conn *c, int proto, struct addrinfo *addr) {
+    c->opened = 1;
+    c->proto = proto;
+    c->fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+    if (c->fd == -1 || (connect(c->fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS)) {
+        connect_errors++;
+        if (c->fd != -1) {
+            close(c->fd);
+        }
+        c->fd = -1;
+        return;
+    }
+    if (proto == PROTO_V2) {
+        uint8_t hello[PROTO_HELLO_LEN];
+        proto_hello(hello, PROTO_V2);
+        queue_bytes(c, hello, PROTO_HELLO_LEN);
+    }
+    // Written once the connection is up
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.u32 = (uint32_t)(c - conns) };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->want_out = 1;
+}
+
+// Function to play one record
+void apply_record(const uint8_t *data, const Record *r, struct addrinfo *addr) {
+    Conn *c = find_conn(r->conn_id);
+    if (r->kind == CAPTURE_CLOSE) {
+        if (c->fd >= 0) {
+            c->closing = 1;
+            flush_conn(c);
+        }
+        return;
+    }
+
+    if (!c->opened) {
+        open_conn(c, r->proto, addr);
+    }
+    if (c->fd < 0) {
+        return;
+    }
+    struct message msg;
+    char payload[MSG_LEN];
+    uint8_t frame[PROTO_V2_MAX_FRAME(MSG_LEN)];
+    size_t used;
+    memset(&msg, 0, sizeof(struct message));
+    if (proto_v2_decode(data + r->off, r->len, &msg, payload, MSG_LEN, &used) != 1) {
+        return;
+    }
+    if (c->proto == PROTO_V2 && msg.uid == 0) {
+        queue_bytes(c, data + r->off, r->len);
+    } else {
+        // Recipient IDs were given by the captured server: address by the recorded nickname,
+        // and sessions that spoke v1 get the frame back in v1
+        msg.uid = 0;
+        queue_bytes(c, frame, proto_encode(c->proto, frame, &msg, payload, msg.pld_len));
+    }
+    flush_conn(c);
+}
+
+// Function to wait for events once: read and count replies, write what is waiting
+void pump(int timeout_ms) {
+    struct epoll_event events[256];
+    char discard[65536];
+    int n = epoll_wait(epfd, events, 256, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        Conn *c = &conns[events[i].data.u32];
+        if (c->fd < 0) {
+            continue;
+        }
+        if (events[i].events & EPOLLOUT) {
+            flush_conn(c);
+        }
+        if (c->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+            ssize_t r;
+            while ((r = recv(c->fd, discard, sizeof(discard), 0)) > 0) {
+                bytes_received += r;
+            }
+            if (r == 0 || (r == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                server_closed++;
+                close_conn(c);
+            }
+        }
+    }
+}
+
+// Function to print one percentile line of a lag histogram, in milliseconds
+void print_lag(const unsigned long long *hist, unsigned long long total) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 1.0 };
+    double values[4] = { 0 };
+    unsigned long long seen = 0;
+    int q = 0;
+    for (int b = 0; b < LATENCY_BUCKETS && total > 0; b++) {
+        seen += hist[b];
+        while (q < 4 && hist[b] > 0 && seen >= quantiles[q] * total) {
+            values[q++] = latency_bucket_high(b) / 1e6;
+        }
+    }
+    printf("schedule lag (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", values[0], values[1], values[2], values[3]);
+}
+
+int main(int argc, char *argv[]) {
+    double speed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            speed = atof(optarg);
+        } else {
+            optind = argc;
+        }
+    }
+    if (argc - optind != 3 || speed < 0) {
+        fprintf(stderr, "Usage: %s [-s speed, 0 for max] <server_name> <server_port> <capture_file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *f = fopen(argv[optind + 2], "rb");
+    if (f == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data == NULL || fread(data, 1, size, f) != (size_t)size) {
+        perror("fread");
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+
+    Record *records;
+    int count = parse_capture(data, size, &records);
+    if (count < 0 || build_conns(records, count) < 0) {
+        fprintf(stderr, "[Error] %s is not a capture.\n", argv[optind + 2]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[optind], argv[optind + 1], &hints, &result) != 0) {
+        perror("getaddrinfo()");
+        exit(EXIT_FAILURE);
+    }
+    epfd = epoll_create1(0);
+
+    int frames = 0;
+    for (int i = 0; i < count; i++) {
+        frames += records[i].kind == CAPTURE_FRAME;
+    }
+    double span = count > 0 ? records[count - 1].ts_us / 1e6 : 0;
+    printf("replay: %d frames and %d closes from %d sessions, capture of %.2f s, ", frames, count - frames, conn_count, span);
+    if (speed > 0) {
+        printf("speed %gx\n", speed);
+    } else {
+        printf("max speed\n");
+    }
+
+    static unsigned long long lag_hist[LATENCY_BUCKETS];
+    long long start = now_us();
+    int next = 0;
+    while (next < count) {
+        long long now = now_us();
+        long long wait_us = 0;
+        while (next < count) {
+            const Record *r = &records[next];
+            long long due = speed > 0 ? start + (long long)(r->ts_us / speed) : now;
+            if (due > now) {
+                wait_us = due - now;
+                break;
+            }
+            // Records stay in order: a connection that is behind holds up the ones after it
+            Conn *c = find_conn(r->conn_id);
+            if (c->fd >= 0 && c->out_len - c->out_off > REPLAY_OUT_LIMIT) {
+                wait_us = 1000;
+                break;
+            }
+            lag_hist[latency_bucket((unsigned long long)(now - due) * 1000)]++;
+            apply_record(data, r, result);
+            next++;
+        }
+        if (next < count) {
+            pump(wait_us > 0 ? (int)((wait_us + 999) / 1000) : 0);
+        }
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    // Let the last frames out and their replies in
+    long long drain_end = now_us() + REPLAY_DRAIN_MS * 1000LL;
+    while (now_us() < drain_end) {
+        pump(10);
+    }
+
+    printf("sent %.2f MB in %.2f s (%.2fx the capture), %.0f frames/s, received %.2f MB\n",
+           bytes_sent / 1e6, elapsed, elapsed > 0 ? span / elapsed : 0, elapsed > 0 ? frames / elapsed : 0,
+           bytes_received / 1e6);
+    if (speed > 0) {
+        print_lag(lag_hist, count);
+    }
+    printf("errors: connect %llu, closed by the server %llu\n", connect_errors, server_closed);
+
+    for (int i = 0; i < conn_count; i++) {
+        if (conns[i].fd >= 0) {
+            close(conns[i].fd);
+        }
+        free(conns[i].out);
+    }
+    freeaddrinfo(result);
+    free(records);
+    free(data);
+    return 0;
+}
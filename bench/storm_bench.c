@@ -0,0 +1,221 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <time.h>
+#include "../common.h"
+#include "../msg_struct.h"
+#include "../proto.h"
+
+// Reconnect-storm benchmark: <count> sessions connect and log in all at once,
+// as they would after a network blip, then all drop and do it again. Sessions
+// the server refuses reconnect after a short backoff. Each round reports how
+// long the server took to have every session logged in again, how many
+// connections it refused on the way and the spread of per-session login times.
+
+#define STORM_TIMEOUT_MS 10000    // A round gives up on sessions not logged in by then
+#define STORM_BACKOFF_MS 20       // Wait before a refused session reconnects
+
+enum storm_stage {
+    STAGE_CONNECTING,
+    STAGE_LOGGING_IN,
+    STAGE_BACKOFF,
+    STAGE_DONE,
+    STAGE_FAILED
+};
+
+typedef struct StormSession {
+    int fd;
+    enum storm_stage stage;
+    size_t received;              // Bytes of the reply header read so far
+    struct message reply;
+    double login_sec;             // Time from the start of the round to the reply
+    double retry_at;              // When a refused session reconnects
+} StormSession;
+
+// Function to get a monotonic timestamp in seconds
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to start a non-blocking connect
+void start_session(StormSession *s, struct addrinfo *addr) {
+    memset(s, 0, sizeof(StormSession));
+    s->fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+    if (s->fd == -1) {
+        s->stage = STAGE_FAILED;
+        return;
+    }
+    if (connect(s->fd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        s->stage = STAGE_FAILED;
+    }
+}
+
+// Function to send the nickname request once the connection is up
+void send_login(StormSession *s, int round, int index) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+        s->stage = STAGE_FAILED;
+        return;
+    }
+
+    struct message msgstruct;
+    memset(&msgstruct, 0, sizeof(struct message));
+    msgstruct.type = NICKNAME_NEW;
+    snprintf(msgstruct.infos, INFOS_LEN, "storm%dr%d", index, round);
+    strncpy(msgstruct.nick_sender, msgstruct.infos, NICK_LEN - 1);
+    msgstruct.pld_len = strlen(msgstruct.infos);
+
+    // A fresh socket buffer always takes the whole header
+    if (send(s->fd, &msgstruct, PROTO_V1_HEADER_LEN, MSG_NOSIGNAL) != PROTO_V1_HEADER_LEN) {
+        s->stage = STAGE_FAILED;
+        return;
+    }
+    s->stage = STAGE_LOGGING_IN;
+}
+
+// Function to drop a connection the server refused and schedule a new attempt
+void back_off(StormSession *s) {
+    close(s->fd);
+    s->fd = -1;
+    s->stage = STAGE_BACKOFF;
+    s->retry_at = now_sec() + STORM_BACKOFF_MS / 1000.0;
+}
+
+// Function to read as much of the nickname reply as has arrived
+// Returns 1 if the server closed the connection before answering
+int read_reply(StormSession *s, double start) {
+    ssize_t n = recv(s->fd, (char *)&s->reply + s->received, PROTO_V1_HEADER_LEN - s->received, 0);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    if (n <= 0) {
+        back_off(s);
+        return 1;
+    }
+    s->received += n;
+    if (s->received == PROTO_V1_HEADER_LEN) {
+        s->stage = s->reply.type == NICKNAME_SUCCESS ? STAGE_DONE : STAGE_FAILED;
+        s->login_sec = now_sec() - start;
+    }
+    return 0;
+}
+
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to run one storm, returns the number of sessions logged in
+int run_round(struct addrinfo *addr, StormSession *sessions, struct pollfd *fds, int count, int round) {
+    double start = now_sec();
+    int refused = 0;
+    for (int i = 0; i < count; i++) {
+        start_session(&sessions[i], addr);
+    }
+
+    int pending = count;
+    while (pending > 0 && now_sec() - start < STORM_TIMEOUT_MS / 1000.0) {
+        double now = now_sec();
+        for (int i = 0; i < count; i++) {
+            if (sessions[i].stage == STAGE_BACKOFF && now >= sessions[i].retry_at) {
+                start_session(&sessions[i], addr);
+            }
+            fds[i].fd = sessions[i].stage < STAGE_BACKOFF ? sessions[i].fd : -1;
+            fds[i].events = sessions[i].stage == STAGE_CONNECTING ? POLLOUT : POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, count, STORM_BACKOFF_MS) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            if (sessions[i].stage == STAGE_CONNECTING) {
+                send_login(&sessions[i], round, i);
+            } else {
+                refused += read_reply(&sessions[i], start);
+            }
+        }
+        pending = 0;
+        for (int i = 0; i < count; i++) {
+            pending += sessions[i].stage < STAGE_DONE;
+        }
+    }
+    double elapsed = now_sec() - start;
+
+    double *latencies = calloc(count, sizeof(double));
+    int ok = 0;
+    for (int i = 0; i < count; i++) {
+        if (sessions[i].stage == STAGE_DONE) {
+            latencies[ok++] = sessions[i].login_sec;
+        }
+    }
+    qsort(latencies, ok, sizeof(double), compare_double);
+    printf("round=%d ok=%d failed=%d refused=%d recovery=%.1fms p50=%.1fms p99=%.1fms\n",
+           round, ok, count - ok, refused, elapsed * 1e3,
+           ok > 0 ? latencies[ok / 2] * 1e3 : 0.0,
+           ok > 0 ? latencies[(ok - 1) * 99 / 100] * 1e3 : 0.0);
+    free(latencies);
+
+    // Everyone drops at once, ready for the next storm
+    for (int i = 0; i < count; i++) {
+        if (sessions[i].fd >= 0) {
+            close(sessions[i].fd);
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4 && argc != 5) {
+        fprintf(stderr, "Usage: %s <server_name> <server_port> <count> [rounds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int count = atoi(argv[3]);
+    int rounds = argc == 5 ? atoi(argv[4]) : 5;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(argv[1], argv[2], &hints, &result) != 0) {
+        perror("getaddrinfo()");
+        exit(EXIT_FAILURE);
+    }
+
+    StormSession *sessions = calloc(count, sizeof(StormSession));
+    struct pollfd *fds = calloc(count, sizeof(struct pollfd));
+    int all_ok = 1;
+    for (int round = 0; round < rounds; round++) {
+        if (run_round(result, sessions, fds, count, round) != count) {
+            all_ok = 0;
+        }
+        usleep(200000);    // Let the server notice the disconnects
+    }
+
+    free(fds);
+    free(sessions);
+    freeaddrinfo(result);
+    return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
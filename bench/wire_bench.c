@@ -0,0 +1,128 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../common.h"
+#include "../msg_struct.h"
+#include "../proto.h"
+
+// Bytes-on-wire benchmark: encodes a representative frame of every msg_type
+// in v1 and v2, prints the size of each, then times encode + decode.
+
+#define CHAT_LINE "see you at the demo!"   // A typical 20-byte chat line
+#define ROUNDS 2000000
+
+typedef struct Sample {
+    enum msg_type type;
+    const char *name;
+    const char *infos;
+    const char *payload;
+} Sample;
+
+#define SAMPLE(type, infos, payload) { type, #type, infos, payload }
+
+// Frames as the client or the server actually sends them
+static const Sample samples[] = {
+    SAMPLE(UNKNOWN_COMMAND,          "",        "Unknown command received"),
+    SAMPLE(NICKNAME_NEW,             "alice",   ""),
+    SAMPLE(NICKNAME_SUCCESS,         "",        ""),
+    SAMPLE(NICKNAME_ERROR,           "",        ""),
+    SAMPLE(NICKNAME_LIST,            "",        "Online users (3): alice, bob, carol"),
+    SAMPLE(NICKNAME_INFOS,           "bob",     ""),
+    SAMPLE(NICKNAME_INFOS_ERROR,     "",        "User not found"),
+    SAMPLE(WHOAMI,                   "",        ""),
+    SAMPLE(ECHO_SEND,                "",        CHAT_LINE),
+    SAMPLE(UNICAST_SEND,             "bob",     CHAT_LINE),
+    SAMPLE(UNICAST_SUCCESS,          "",        "Unicast message sent successfully"),
+    SAMPLE(UNICAST_ERROR,            "",        "Recipient not found"),
+    SAMPLE(BROADCAST_SEND,           "",        CHAT_LINE),
+    SAMPLE(BROADCAST_SUCCESS,        "",        "Broadcast successful."),
+    SAMPLE(BROADCAST_ERROR,          "",        "Broadcast failed."),
+    SAMPLE(MULTICAST_CREATE,         "general", ""),
+    SAMPLE(MULTICAST_CREATE_SUCCESS, "general", ""),
+    SAMPLE(MULTICAST_CREATE_ERROR,   "",        ""),
+    SAMPLE(MULTICAST_LIST,           "",        "Channels: general, random"),
+    SAMPLE(MULTICAST_JOIN,           "general", ""),
+    SAMPLE(MULTICAST_JOIN_SUCCESS,   "general", "You joined channel general."),
+    SAMPLE(MULTICAST_JOIN_ERROR,     "",        ""),
+    SAMPLE(MULTICAST_SEND,           "general", CHAT_LINE),
+    SAMPLE(MULTICAST_SEND_SUCCESS,   "",        ""),
+    SAMPLE(MULTICAST_SEND_ERROR,     "",        ""),
+    SAMPLE(MULTICAST_QUIT,           "general", ""),
+    SAMPLE(MULTICAST_QUIT_SUCCESS,   "general", ""),
+    SAMPLE(MULTICAST_QUIT_ERROR,     "",        ""),
+    SAMPLE(FILE_REQUEST,             "bob",     "report.pdf"),
+    SAMPLE(FILE_ACCEPT,              "alice",   "report.pdf"),
+    SAMPLE(FILE_REJECT,              "alice",   "File reception rejected."),
+    SAMPLE(FILE_SEND,                "",        ""),
+    SAMPLE(FILE_ACK,                 "report.pdf", "File received successfully"),
+    SAMPLE(FILE_EXISTENCE_ERROR,     "",        ""),
+    SAMPLE(RECEIVER_EXISTENCE_ERROR, "",        ""),
+    SAMPLE(TRY_AGAIN_Y_N,            "",        ""),
+    SAMPLE(QUIT_REQUEST,             "alice",   ""),
+    SAMPLE(SERVER_QUIT,              "",        ""),
+    SAMPLE(USER_MAP,                 "",        "\x81\x01\x05" "alice" "\x82\x01\x03" "bob"),
+};
+
+// Function to get a monotonic timestamp in seconds
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to build the header of a sample frame
+void fill_message(struct message *msg, const Sample *sample) {
+    memset(msg, 0, sizeof(struct message));
+    msg->type = sample->type;
+    msg->pld_len = strlen(sample->payload);
+    strncpy(msg->nick_sender, "alice", NICK_LEN - 1);
+    strncpy(msg->infos, sample->infos, INFOS_LEN - 1);
+}
+
+// Function to time encoding and decoding a chat line in one protocol version
+double time_codec(int version) {
+    static uint8_t frame[PROTO_V2_MAX_FRAME(MSG_LEN) + sizeof(struct message)];
+    struct message msg, decoded;
+    char payload[MSG_LEN];
+    size_t used;
+    volatile size_t sink = 0;
+
+    fill_message(&msg, &samples[BROADCAST_SEND]);
+    double start = now_sec();
+    for (int i = 0; i < ROUNDS; i++) {
+        size_t len = proto_encode(version, frame, &msg, CHAT_LINE, msg.pld_len);
+        if (version == PROTO_V2) {
+            proto_v2_decode(frame, len, &decoded, payload, MSG_LEN, &used);
+        } else {
+            memcpy(&decoded, frame, PROTO_V1_HEADER_LEN);
+            memcpy(payload, frame + PROTO_V1_HEADER_LEN, decoded.pld_len);
+            payload[decoded.pld_len] = '\0';
+        }
+        sink += len + decoded.pld_len;
+    }
+    return (now_sec() - start) * 1e9 / ROUNDS;
+}
+
+int main(void) {
+    size_t total_v1 = 0;
+    size_t total_v2 = 0;
+    int count = sizeof(samples) / sizeof(samples[0]);
+
+    printf("%-26s %8s %8s %8s %8s\n", "msg_type", "payload", "v1", "v2", "saved");
+    for (int i = 0; i < count; i++) {
+        struct message msg;
+        fill_message(&msg, &samples[i]);
+        size_t v1 = proto_frame_len(PROTO_V1, &msg, msg.pld_len);
+        size_t v2 = proto_frame_len(PROTO_V2, &msg, msg.pld_len);
+        total_v1 += v1;
+        total_v2 += v2;
+        printf("%-26s %8d %8zu %8zu %7.1f%%\n", samples[i].name, msg.pld_len, v1, v2, 100.0 * (v1 - v2) / v1);
+    }
+    printf("%-26s %8s %8zu %8zu %7.1f%%\n", "all types", "", total_v1, total_v2, 100.0 * (total_v1 - total_v2) / total_v1);
+
+    printf("\nencode + decode of a %zu-byte chat line: v1 %.1f ns, v2 %.1f ns\n",
+           strlen(CHAT_LINE), time_codec(PROTO_V1), time_codec(PROTO_V2));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "capture.h"
+#include "common.h"
+#include "log.h"
+#include "proto.h"
+
+// Largest record: kind, two varints, proto and a v2 frame with a full payload
+#define CAPTURE_MAX_RECORD (2 + 2 * CAPTURE_VARINT64_MAX + PROTO_V2_MAX_FRAME(MSG_LEN))
+
+int capture_enabled = 0;
+
+static FILE *capture_file = NULL;
+static uint8_t *capture_buf = NULL;      // Filled by the event loops
+static uint8_t *capture_spare = NULL;    // Written out by the writer thread
+static size_t capture_len = 0;
+static unsigned long capture_dropped = 0;
+static long long capture_origin_ns = 0;
+static int capture_stopping = 0;
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t capture_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t capture_thread;
+
+// Function to read the monotonic clock in nanoseconds
+static long long capture_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Function to write a 64-bit little-endian base 128 varint, returns its length
+size_t capture_put_varint64(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+// Function to read a 64-bit varint
+// Returns 1 when decoded, 0 if more bytes are needed, -1 if it is too long
+int capture_get_varint64(const uint8_t *in, size_t avail, uint64_t *value, size_t *used) {
+    uint64_t result = 0;
+    for (size_t i = 0; i < CAPTURE_VARINT64_MAX; i++) {
+        if (i >= avail) {
+            return 0;
+        }
+        result |= (uint64_t)(in[i] & 0x7f) << (7 * i);
+        if ((in[i] & 0x80) == 0) {
+            *value = result;
+            *used = i + 1;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+// Function to start a record (callers hold capture_lock), returns NULL if the buffer is full
+static uint8_t *capture_begin(enum capture_kind kind, unsigned long conn_id) {
+    if (capture_len + CAPTURE_MAX_RECORD > CAPTURE_BUF_LEN) {
+        capture_dropped++;
+        return NULL;
+    }
+    uint8_t *out = capture_buf + capture_len;
+    size_t n = 0;
+    out[n++] = (uint8_t)kind;
+    n += capture_put_varint64(out + n, (uint64_t)(capture_now_ns() - capture_origin_ns) / 1000);
+    n += capture_put_varint64(out + n, (uint32_t)conn_id);
+    return out + n;
+}
+
+// Function to end a record at end and wake the writer once half the buffer is used
+static void capture_end(uint8_t *end) {
+    capture_len = end - capture_buf;
+    if (capture_len > CAPTURE_BUF_LEN / 2) {
+        pthread_cond_signal(&capture_wake);
+    }
+}
+
+// Function to record one decoded frame of a session
+void capture_frame(unsigned long conn_id, int proto, const struct message *msg, const char *payload, size_t len) {
+    pthread_mutex_lock(&capture_lock);
+    uint8_t *out = capture_begin(CAPTURE_FRAME, conn_id);
+    if (out != NULL) {
+        *out++ = (uint8_t)proto;
+        out += proto_encode(PROTO_V2, out, msg, payload, len);
+        capture_end(out);
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+// Function to record that a session is gone
+void capture_close(unsigned long conn_id) {
+    pthread_mutex_lock(&capture_lock);
+    uint8_t *out = capture_begin(CAPTURE_CLOSE, conn_id);
+    if (out != NULL) {
+        capture_end(out);
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+// Function run by the writer thread: every CAPTURE_FLUSH_MS, or as soon as half
+// the buffer is used, swaps the buffers and writes the full one out
+static void *capture_writer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&capture_lock);
+    while (1) {
+        if (!capture_stopping && capture_len <= CAPTURE_BUF_LEN / 2) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += CAPTURE_FLUSH_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&capture_wake, &capture_lock, &deadline);
+        }
+
+        int stopping = capture_stopping;
+        uint8_t *full = capture_buf;
+        size_t len = capture_len;
+        unsigned long dropped = capture_dropped;
+        capture_buf = capture_spare;
+        capture_spare = full;
+        capture_len = 0;
+        capture_dropped = 0;
+        pthread_mutex_unlock(&capture_lock);
+
+        if (len > 0 && (fwrite(full, 1, len, capture_file) != len || fflush(capture_file) != 0)) {
+            log_perror("capture write");
+        }
+        if (dropped > 0) {
+            log_warn("%lu capture records dropped, the capture buffer was full.", dropped);
+        }
+        if (stopping) {
+            return NULL;
+        }
+        pthread_mutex_lock(&capture_lock);
+    }
+}
+
+// Function to open the capture file and start the writer thread
+int capture_start(const char *path) {
+    capture_file = fopen(path, "wb");
+    capture_buf = malloc(CAPTURE_BUF_LEN);
+    capture_spare = malloc(CAPTURE_BUF_LEN);
+    if (capture_file == NULL || capture_buf == NULL || capture_spare == NULL) {
+        log_perror("capture");
+        if (capture_file != NULL) {
+            fclose(capture_file);
+        }
+        free(capture_buf);
+        free(capture_spare);
+        return -1;
+    }
+    if (fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, capture_file) != CAPTURE_MAGIC_LEN) {
+        log_perror("capture write");
+        fclose(capture_file);
+        return -1;
+    }
+
+    capture_origin_ns = capture_now_ns();
+    if (pthread_create(&capture_thread, NULL, capture_writer, NULL) != 0) {
+        log_perror("pthread_create");
+        fclose(capture_file);
+        return -1;
+    }
+    capture_enabled = 1;
+    atexit(capture_stop);
+    log_info("Capturing inbound frames to %s.", path);
+    return 0;
+}
+
+// Function to write out what is buffered and close the capture file
+void capture_stop(void) {
+    if (!capture_enabled) {
+        return;
+    }
+    capture_enabled = 0;
+    pthread_mutex_lock(&capture_lock);
+    capture_stopping = 1;
+    pthread_cond_signal(&capture_wake);
+    pthread_mutex_unlock(&capture_lock);
+    pthread_join(capture_thread, NULL);
+    fclose(capture_file);
+}
@@ -0,0 +1,50 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "msg_struct.h"
+
+// Traffic capture
+// With -r, every frame the server decodes is appended to a binary file, along
+// with the connection it came from and when, and so is every connection
+// closing. bench/replay plays a capture back against a fresh server. Event
+// loops copy records into a buffer under a short lock; a writer thread swaps
+// the buffer out and writes it every CAPTURE_FLUSH_MS. When the buffer is
+// full, records are dropped and counted rather than stalling a loop.
+//
+// The file starts with CAPTURE_MAGIC, then holds records of
+//
+//     u8      kind        CAPTURE_FRAME or CAPTURE_CLOSE
+//     varint  ts_us       microseconds since the capture started (up to 64 bits)
+//     varint  conn_id     session the record belongs to (low 32 bits)
+//     u8      proto       frames only: wire protocol of the session
+//     frame               frames only: the decoded frame, re-encoded as v2
+//
+// The v2 encoding keeps the type, infos, uid and payload the server acted on,
+// whatever the session spoke; v1 nickname requests carry no payload. User IDs
+// only mean something on the server that gave them, so a frame addressed by ID
+// also carries the recipient's nickname in infos, and bench/replay sends it by
+// nickname.
+
+#define CAPTURE_MAGIC "CHTCAP1\n"
+#define CAPTURE_MAGIC_LEN 8
+#define CAPTURE_BUF_LEN (4 << 20)        // Bytes buffered between two writes
+#define CAPTURE_FLUSH_MS 100             // Writer period; at most this much is lost if the server is killed
+#define CAPTURE_VARINT64_MAX 10
+
+enum capture_kind {
+    CAPTURE_FRAME = 1,
+    CAPTURE_CLOSE = 2
+};
+
+extern int capture_enabled;
+
+size_t capture_put_varint64(uint8_t *out, uint64_t value);
+int capture_get_varint64(const uint8_t *in, size_t avail, uint64_t *value, size_t *used);
+int capture_start(const char *path);
+void capture_stop(void);
+void capture_frame(unsigned long conn_id, int proto, const struct message *msg, const char *payload, size_t len);
+void capture_close(unsigned long conn_id);
+
+#endif
@@ -10,11 +10,34 @@
 #include <ctype.h>
 #include "common.h"       // Custom common functions (possibly defined elsewhere)
 #include "msg_struct.h"
+#include "proto.h"
 #include <sys/ioctl.h> 
 
 // Initialization of variables
 ClientInfo *clientList = NULL;
 Channel *channel_list = NULL;
+int proto_version = PROTO_V1;
+
+// Nicknames of the users a v2 server told us about, indexed by the slot bits of their ID
+typedef struct UserName {
+    unsigned int uid;
+    char nick[NICK_LEN];
+} UserName;
+
+UserName *user_map = NULL;
+int user_map_size = 0;
+
+// /who reply being assembled from its NICKNAME_LIST chunks
+char who_self[NICK_LEN] = "";        // Our nickname when /who was sent, marked "(me)"
+char who_prefix[INFOS_LEN - 24] = "";   // Leaves room for the cursor in the request
+char *who_list = NULL;
+size_t who_len = 0;
+size_t who_cap = 0;
+int who_count = 0;
+
+// Channels we are in, marked in /channel_list replies (the server's reply is the same for everyone)
+char joined_channels[MAX_CLIENT_CHANNELS][CHAN_LEN];
+int joined_len = 0;
 
 // Function to check nickname
 int check_nickname(char *nickname) {
@@ -66,9 +89,11 @@ int check_channel_name(char *channel) {
 
     // Confirm the channel name is not already in use
     for (ClientInfo *client = clientList; client != NULL; client = client->next) {
-        if (strcmp(channel, client->channel) == 0) {
-            printf( "[Server]:"  " Channel name already taken. Please select a different name.\n" );
-            return 0;
+        for (int i = 0; i < client->channels_len; i++) {
+            if (strcmp(channel, client->channels[i]->channel->channel_name) == 0) {
+                printf( "[Server]:"  " Channel name already taken. Please select a different name.\n" );
+                return 0;
+            }
         }
     }
 
@@ -79,16 +104,18 @@ int check_channel_name(char *channel) {
 void send_greetings(struct currentClientInfo *client) {
 printf( "\n[Server] :"" Welcome to the chat" " %s"" !\n\n",client->nickname);
 printf("You can use the following commands:\n\n"  "'/nick'"  " : to change your nickname\n"
-                    "'/who'"  " : to display a list of all the connected users.\n"
+                    "'/who + [prefix]'"  " : to display a list of all the connected users (whose nickname starts with prefix).\n"
                     "'/whois + <username>'"  " : to display information about a user named username.\n"
                     "'/whoami'"  " : to display information about you.\n"
                     "'/msg + <username> + message'"  " : to send a private message to a user called username.\n"
                     "'/msgall + message'"  " : to send a broadcast message.\n"
                     "'/create + <channel_name>'"  " : to create a channel named channel_name.\n"
                     "'/channel_list'"  " : to display all the available channels.\n"
-                    "'/join + <channel_name>'"  " : to join a channel called channel_name.\n"
+                    "'/join + <channel_name>'"  " : to join a channel called channel_name (or switch back to it).\n"
+                    "'/channel_send + <channel_name> + message'"  " : to send a message to one of your channels.\n"
+                    "'/history + [n]'"  " : to display the last n messages of the current channel.\n"
                     "'/send + <receiver_name> + <file_name>'"  " : to send a file to the user receiver_name.\n"
-                    "'/quit'"  " : to quit. ( quits a channel if the user is in a channel or the server if not ).\n\n"
+                    "'/quit'"  " : to quit. ( quits the current channel if there is one or the server if not ).\n\n"
                    "If no command is used, an echo message or channel message will be sent.\n\n> ");}
 
 // Function to add a user
@@ -127,6 +154,237 @@ ClientInfo* nick_to_client(ClientInfo *list, char *nick) {
 }
 
 
+////////////////////////// Protocol Functions //////////////////////////
+// Function to receive exactly len bytes from the server
+int recv_exact(int sockfd, void *buf, size_t len) {
+    size_t received = 0;
+    while (received < len) {
+        ssize_t n = recv(sockfd, (char *)buf + received, len - received, 0);
+        if (n <= 0) {
+            return n;
+        }
+        received += n;
+    }
+    return 1;
+}
+
+// Function to apply a USER_MAP payload to the local ID-to-nickname map
+void user_map_apply(const char *payload, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        uint32_t uid;
+        char nick[NICK_LEN];
+        size_t used;
+        if (proto_get_user((const uint8_t *)payload + off, len - off, &uid, nick, &used) < 0) {
+            printf("[Error] Malformed user map.\n");
+            return;
+        }
+        off += used;
+
+        int slot = uid & UID_SLOT_MASK;
+        if (slot >= user_map_size) {
+            if (nick[0] == '\0') {
+                continue;
+            }
+            int new_size = user_map_size > 0 ? user_map_size : UID_TABLE_INIT;
+            while (new_size <= slot) {
+                new_size *= 2;
+            }
+            UserName *new_map = realloc(user_map, new_size * sizeof(UserName));
+            if (new_map == NULL) {
+                perror("realloc");
+                return;
+            }
+            memset(new_map + user_map_size, 0, (new_size - user_map_size) * sizeof(UserName));
+            user_map = new_map;
+            user_map_size = new_size;
+        }
+        user_map[slot].uid = nick[0] != '\0' ? uid : 0;
+        strcpy(user_map[slot].nick, nick);
+    }
+}
+
+// Function to find the nickname behind a user ID, NULL if unknown
+const char *uid_to_nick(unsigned int uid) {
+    int slot = uid & UID_SLOT_MASK;
+    if (uid == 0 || slot >= user_map_size || user_map[slot].uid != uid) {
+        return NULL;
+    }
+    return user_map[slot].nick;
+}
+
+// Function to find the user ID of a nickname, 0 if unknown
+unsigned int nick_to_uid(const char *nick) {
+    for (int i = 0; i < user_map_size; i++) {
+        if (user_map[i].uid != 0 && strcmp(user_map[i].nick, nick) == 0) {
+            return user_map[i].uid;
+        }
+    }
+    return 0;
+}
+
+// Function to address a frame to a user by ID when the server speaks v2
+// The nickname stays in infos if the user is not in the map yet
+void address_recipient(struct message *msg) {
+    if (proto_version != PROTO_V2) {
+        return;
+    }
+    msg->uid = nick_to_uid(msg->infos);
+    if (msg->uid != 0) {
+        msg->infos[0] = '\0';
+    }
+}
+
+// Function to send a message to the server in the negotiated protocol
+// Without a payload only the header is sent, even if pld_len is set
+int send_msg(int sockfd, struct message *msg, const char *payload) {
+    size_t len = payload != NULL ? msg->pld_len : 0;
+    uint8_t frame[PROTO_V2_MAX_FRAME(MSG_LEN) + PROTO_V1_HEADER_LEN];
+
+    size_t frame_len = proto_encode(proto_version, frame, msg, payload, len);
+    if (send(sockfd, frame, frame_len, 0) != (ssize_t)frame_len) {
+        return -1;
+    }
+    return 1;
+}
+
+// Function to receive a message from the server in the negotiated protocol
+int recv_msg(int sockfd, struct message *msg, char *payload) {
+    if (proto_version != PROTO_V2) {
+        if (recv_exact(sockfd, msg, PROTO_V1_HEADER_LEN) <= 0) {
+            return -1;
+        }
+        msg->uid = 0;
+        if (msg->pld_len < 0 || msg->pld_len >= MSG_LEN) {
+            return -1;
+        }
+        if (msg->pld_len > 0 && recv_exact(sockfd, payload, msg->pld_len) <= 0) {
+            return -1;
+        }
+        payload[msg->pld_len] = '\0';
+        return 1;
+    }
+
+    // v2: read the varint length byte by byte, then the body
+    uint8_t frame[PROTO_V2_MAX_FRAME(MSG_LEN)];
+    size_t have = 0;
+    uint32_t body;
+    size_t used;
+    int ret;
+    while ((ret = proto_get_varint(frame, have, &body, &used)) == 0) {
+        if (recv_exact(sockfd, frame + have, 1) <= 0) {
+            return -1;
+        }
+        have++;
+    }
+    if (ret < 0 || body > sizeof(frame) - used || recv_exact(sockfd, frame + used, body) <= 0) {
+        return -1;
+    }
+    if (proto_v2_decode(frame, used + body, msg, payload, MSG_LEN, &used) != 1) {
+        return -1;
+    }
+
+    // Frames carrying an ID leave the sender's nickname out
+    const char *nick = uid_to_nick(msg->uid);
+    if (msg->nick_sender[0] == '\0' && nick != NULL) {
+        strcpy(msg->nick_sender, nick);
+    }
+    return 1;
+}
+
+// Function to add one NICKNAME_LIST chunk to the /who reply being assembled
+// Asks the server for the next page when told to; returns 1 once the list is complete
+int who_assemble(int sockfd, struct message *msg, const char *payload) {
+    size_t len = msg->pld_len;
+    if (who_len + len + 1 > who_cap) {
+        size_t new_cap = who_cap > 0 ? who_cap : MSG_LEN;
+        while (new_cap < who_len + len + 1) {
+            new_cap *= 2;
+        }
+        char *new_list = realloc(who_list, new_cap);
+        if (new_list == NULL) {
+            perror("realloc");
+            return 1;
+        }
+        who_list = new_list;
+        who_cap = new_cap;
+    }
+    memcpy(who_list + who_len, payload, len);
+    who_len += len;
+    who_list[who_len] = '\0';
+    for (size_t i = 0; i < len; i++) {
+        who_count += payload[i] == '\n';
+    }
+
+    if (strncmp(msg->infos, "more", 4) == 0) {
+        return 0;
+    }
+    if (strncmp(msg->infos, "next ", 5) == 0) {
+        struct message request = { .type = NICKNAME_LIST };
+        snprintf(request.infos, INFOS_LEN, "%lu %s", strtoul(msg->infos + 5, NULL, 10), who_prefix);
+        if (send_msg(sockfd, &request, NULL) > 0) {
+            return 0;
+        }
+        perror("send");
+    }
+    return 1;
+}
+
+// Function to keep joined_channels in step with the channel replies of the server
+void track_membership(struct message *msg) {
+    int i = 0;
+    while (i < joined_len && strcmp(joined_channels[i], msg->infos) != 0) {
+        i++;
+    }
+    if ((msg->type == MULTICAST_CREATE_SUCCESS || msg->type == MULTICAST_JOIN_SUCCESS) && i == joined_len && joined_len < MAX_CLIENT_CHANNELS) {
+        snprintf(joined_channels[joined_len++], CHAN_LEN, "%s", msg->infos);
+    } else if (msg->type == MULTICAST_QUIT_SUCCESS && i < joined_len) {
+        strcpy(joined_channels[i], joined_channels[--joined_len]);
+    }
+}
+
+// Function to print a /channel_list reply, adding ", me" to the channels we are in
+void print_channel_list(char *list) {
+    printf( "[Server]:" );
+    for (char *line = strtok(list, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        char *name_end = strstr(line, " (");
+        size_t line_len = strlen(line);
+        int mine = 0;
+        for (int i = 0; name_end != NULL && strncmp(line, "  - ", 4) == 0 && i < joined_len; i++) {
+            mine |= (size_t)(name_end - line - 4) == strlen(joined_channels[i]) &&
+                    strncmp(line + 4, joined_channels[i], name_end - line - 4) == 0;
+        }
+        if (mine && line[line_len - 1] == ')') {
+            printf("%.*s, me)\n", (int)(line_len - 1), line);
+        } else {
+            printf("%s\n", line);
+        }
+    }
+}
+
+// Function to offer the v2 protocol right after connecting
+// Returns 1 if the server accepted it, 0 if the connection has to be reopened in v1
+int client_handshake(int sockfd) {
+    uint8_t hello[PROTO_HELLO_LEN];
+    proto_hello(hello, PROTO_V2);
+    if (send(sockfd, hello, PROTO_HELLO_LEN, 0) != PROTO_HELLO_LEN) {
+        return 0;
+    }
+
+    // Servers that only speak v1 never answer
+    uint8_t reply[PROTO_HELLO_LEN];
+    struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+    if (poll(&pfd, 1, HANDSHAKE_TIMEOUT_MS) <= 0 || recv_exact(sockfd, reply, PROTO_HELLO_LEN) <= 0) {
+        return 0;
+    }
+    if (proto_parse_hello(reply, PROTO_HELLO_LEN) != PROTO_V2) {
+        return 0;
+    }
+    proto_version = PROTO_V2;
+    return 1;
+}
+
+
 ////////////////////////// File Functions  //////////////////////////
 void handle_file_reception(struct currentClientInfo *currentClient, char *sender_nick, char *file_name) {
     char buffer_pld[MSG_LEN];
@@ -136,6 +394,7 @@ void handle_file_reception(struct currentClientInfo *currentClient, char *sender
     getchar(); 
 
     struct message msg;
+    memset(&msg, 0, sizeof(struct message));
 
     if (response == 'Y' || response == 'y') {
         int sockfd = 0;
@@ -169,6 +428,7 @@ void handle_file_reception(struct currentClientInfo *currentClient, char *sender
         msg.type = FILE_ACCEPT;
         strncpy(msg.infos, sender_nick, INFOS_LEN - 1);
         msg.infos[INFOS_LEN - 1] = '\0';
+        address_recipient(&msg);
 
         strncpy(buffer_pld, file_name, MSG_LEN - 1);
         buffer_pld[MSG_LEN - 1] = '\0';
@@ -176,19 +436,13 @@ void handle_file_reception(struct currentClientInfo *currentClient, char *sender
         msg.pld_len = strlen(buffer_pld);
 
 
-        if (send(currentClient->sockfd, &msg, sizeof(struct message), 0) <= 0) {
+        if (send_msg(currentClient->sockfd, &msg, buffer_pld) <= 0) {
                 perror("send");
             printf("[Server]:" " Error sending FILE_ACCEPT struct to the sender.\n");
             close(sockfd);
             return;
         }
 
-        if (send(currentClient->sockfd, buffer_pld, msg.pld_len, 0) <= 0) {
-            perror("send");
-                close(sockfd);
-            return;
-        }
-
         struct sockaddr_in new_addr;
         socklen_t addr_size = sizeof(new_addr);
         new_sock = accept(sockfd, (struct sockaddr *)&new_addr, &addr_size);
@@ -229,16 +483,12 @@ void handle_file_reception(struct currentClientInfo *currentClient, char *sender
         msg.type = FILE_REJECT;
         strncpy(msg.infos, sender_nick, INFOS_LEN - 1);
         msg.infos[INFOS_LEN - 1] = '\0';
+        address_recipient(&msg);
 
         strncpy(buffer_pld, "File reception rejected.", MSG_LEN);
         msg.pld_len = strlen(buffer_pld);
 
-        if (send(currentClient->sockfd, &msg, sizeof(struct message), 0) <= 0) {
-            perror("send");
-            return;
-        }
-
-        if (send(currentClient->sockfd, buffer_pld, msg.pld_len, 0) <= 0) {
+        if (send_msg(currentClient->sockfd, &msg, buffer_pld) <= 0) {
             perror("send");
             return;
         }
@@ -476,7 +726,9 @@ void write_in_new_file(int sockfd, char *file_name, struct currentClientInfo *cu
 void handle_message(char *input, struct message *msgstruct, char *nick_sender, char *buffer_pld, size_t buffer_size, struct currentClientInfo *currentClient) {
     char *command;
     char args[MSG_LEN];
-    strncpy(args, input, MSG_LEN);
+    size_t input_len = strnlen(input, MSG_LEN - 1);
+    memcpy(args, input, input_len);
+    args[input_len] = '\0';
     memset(msgstruct, 0, sizeof(struct message));
     msgstruct->type = UNKNOWN_COMMAND;
     strncpy(msgstruct->nick_sender, nick_sender, NICK_LEN - 1);
@@ -507,6 +759,7 @@ void handle_message(char *input, struct message *msgstruct, char *nick_sender, c
         strcmp(command, "/quit") != 0 &&
         strcmp(command, "/quit (to quit a channel") != 0 &&
         strcmp(command, "/channel_send") != 0 &&
+        strcmp(command, "/history") != 0 &&
         strcmp(command, "/send") != 0 ){
         return;
     }
@@ -535,6 +788,10 @@ void handle_message(char *input, struct message *msgstruct, char *nick_sender, c
     // handle /who command
     else if (strcmp(command, "/who") == 0) {
         msgstruct->type = NICKNAME_LIST;
+        char *prefix = strtok(NULL, " \n");
+        snprintf(who_prefix, sizeof(who_prefix), "%s", prefix != NULL ? prefix : "");
+        snprintf(who_self, NICK_LEN, "%s", nick_sender);
+        snprintf(msgstruct->infos, INFOS_LEN, "0 %s", who_prefix);
     }
 
     // handle /whoami command
@@ -572,7 +829,7 @@ void handle_message(char *input, struct message *msgstruct, char *nick_sender, c
             return;
         }
 
-        strncpy(buffer_pld, payload_strt, buffer_size);
+        memcpy(buffer_pld, payload_strt, msgstruct->pld_len + 1);
 
 
 
@@ -599,7 +856,8 @@ void handle_message(char *input, struct message *msgstruct, char *nick_sender, c
         }
         strncpy(msgstruct->infos, args, INFOS_LEN - 1);
         msgstruct->infos[INFOS_LEN - 1] = '\0';
-        strncpy(buffer_pld, payload_strt, buffer_size);
+        address_recipient(msgstruct);
+        memcpy(buffer_pld, payload_strt, msgstruct->pld_len + 1);
     } 
     
     // handle /create command
@@ -643,6 +901,42 @@ void handle_message(char *input, struct message *msgstruct, char *nick_sender, c
 
     } 
     
+    // handle /channel_send command (any joined channel, not only the current one)
+    else if (strcmp(command, "/channel_send") == 0) {
+        msgstruct->type = MULTICAST_SEND;
+        char *c_name = strtok(NULL, " ");
+        char *payload_strt = c_name != NULL ? strtok(NULL, "\n") : NULL;
+        if (!payload_strt) {
+            printf( "[Server]:"" format incorrect. Use '/channel_send <channel_name> <message>'\n" );
+            return;
+        }
+        msgstruct->pld_len = strlen(payload_strt);
+        if (msgstruct->pld_len >= buffer_size) {
+            printf( "[Server]:"" Message is too long.\n" );
+            return;
+        }
+        strncpy(msgstruct->infos, c_name, INFOS_LEN - 1);
+        msgstruct->infos[INFOS_LEN - 1] = '\0';
+        memcpy(buffer_pld, payload_strt, msgstruct->pld_len + 1);
+    }
+
+    // handle /history command (of the current channel)
+    else if (strcmp(command, "/history") == 0) {
+        msgstruct->type = MULTICAST_HISTORY;
+        // Outside a channel infos stays empty and the server says so
+        char *count = strtok(NULL, " \n");
+        strncpy(msgstruct->infos, currentClient->channel, INFOS_LEN - 1);
+        msgstruct->infos[INFOS_LEN - 1] = '\0';
+        if (count != NULL) {
+            msgstruct->pld_len = strlen(count);
+            if (msgstruct->pld_len >= buffer_size) {
+                printf( "[Server]:"" Message is too long.\n" );
+                return;
+            }
+            memcpy(buffer_pld, count, msgstruct->pld_len + 1);
+        }
+    }
+
     // handle echo / multicast send
     else if (command[0] != '/') {
         msgstruct->pld_len = strlen(input);
@@ -656,7 +950,7 @@ void handle_message(char *input, struct message *msgstruct, char *nick_sender, c
             printf( "[Server]:"" Message too long.\n" );
             return;
         }
-        strncpy(buffer_pld, input, buffer_size);
+        memcpy(buffer_pld, input, msgstruct->pld_len + 1);
         msgstruct->type = (strlen(currentClient->channel) == 0) ? ECHO_SEND : MULTICAST_SEND;
     } 
     
@@ -684,6 +978,7 @@ void handle_message(char *input, struct message *msgstruct, char *nick_sender, c
 
         strncpy(msgstruct->infos, receiver, INFOS_LEN - 1);
         msgstruct->infos[INFOS_LEN - 1] = '\0';
+        address_recipient(msgstruct);
         strncpy(buffer_pld, f_name, f_name_length);
         buffer_pld[f_name_length] = '\0';
         msgstruct->pld_len = f_name_length;
@@ -724,16 +1019,18 @@ void echo_client(struct message msgstruct, char *nickname, char *buffer_pld) {
         case UNKNOWN_COMMAND:
             printf( "[Server]: "  "Unknown command.\n" );
             printf("You can use the following commands:\n\n"  "'/nick'"  " : to change your nickname\n"
-                    "'/who'"  " : to display a list of all the connected users.\n"
+                    "'/who + [prefix]'"  " : to display a list of all the connected users (whose nickname starts with prefix).\n"
                     "'/whois + <username>'"  " : to display information about a user named username.\n"
                     "'/whoami'"  " : to display information about you.\n"
                     "'/msg + <username> + message'"  " : to send a private message to a user called username.\n"
                     "'/msgall + message'"  " : to send a broadcast message.\n"
                     "'/create + <channel_name>'"  " : to create a channel named channel_name.\n"
                     "'/channel_list'"  " : to display all the available channels.\n"
-                    "'/join + <channel_name>'"  " : to join a channel called channel_name.\n"
+                    "'/join + <channel_name>'"  " : to join a channel called channel_name (or switch back to it).\n"
+                    "'/channel_send + <channel_name> + message'"  " : to send a message to one of your channels.\n"
+                    "'/history + [n]'"  " : to display the last n messages of the current channel.\n"
                     "'/send + <receiver_name> + <file_name>'"  " : to send a file to the user receiver_name.\n"
-                    "'/quit'"  " : to quit. ( quits a channel if the user is in a channel or the server if not ).\n\n"
+                    "'/quit'"  " : to quit. ( quits the current channel if there is one or the server if not ).\n\n"
                    "If no command is used, an echo message or channel message will be sent.\n\n");
             printf("> ");
             break;
@@ -754,7 +1051,17 @@ void echo_client(struct message msgstruct, char *nickname, char *buffer_pld) {
             break;
         
         case NICKNAME_LIST:
-            printf( "[Server]:"  " %s\n", buffer_pld);
+            if (who_count == 0) {
+                printf( "[Server]:"  " Online users (0 users): \n - There are no connected users%s%s.\n", who_prefix[0] ? " matching " : "", who_prefix);
+            } else {
+                printf( "[Server]:"  " Online users (%d):", who_count);
+                for (char *line = strtok(who_list, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+                    printf("\n%s%s", line, strcmp(line + 4, who_self) == 0 ? " (me)" : "");
+                }
+                printf("\n");
+            }
+            who_len = 0;
+            who_count = 0;
             printf("> ");
             break;
         
@@ -798,7 +1105,17 @@ void echo_client(struct message msgstruct, char *nickname, char *buffer_pld) {
             break;
         
         case UNICAST_SEND:
-            printf( "[%s]: "  "%s\n", msgstruct.nick_sender, buffer_pld);
+            // Messages kept while we were offline say when they were sent
+            if (strncmp(msgstruct.infos, "queued ", strlen("queued ")) == 0) {
+                printf( "[%s] (%s): "  "%s\n", msgstruct.nick_sender, msgstruct.infos, buffer_pld);
+            } else {
+                printf( "[%s]: "  "%s\n", msgstruct.nick_sender, buffer_pld);
+            }
+            printf("> ");
+            break;
+        
+        case UNICAST_QUEUED:
+            printf( "[Server]:"  " %s is offline, the message will be delivered when they log in.\n" , msgstruct.infos);
             printf("> ");
             break;
         
@@ -823,15 +1140,27 @@ void echo_client(struct message msgstruct, char *nickname, char *buffer_pld) {
             break;
         
         case MULTICAST_LIST:
-            printf( "[Server]:"  "%s", buffer_pld);
+            print_channel_list(buffer_pld);
             printf( "> ");
             break;
         
         case MULTICAST_SEND:
+            // Name the channel, the user may be in several
+            if (msgstruct.infos[0] != '\0') {
+                printf("#%s ", msgstruct.infos);
+            }
             printf("%s", buffer_pld);
             printf( "> " );
             break;
         
+        case MULTICAST_HISTORY:
+            // Chunks of one reply; the prompt comes back with the last one
+            printf("%s", buffer_pld);
+            if (strcmp(msgstruct.infos, "end") == 0) {
+                printf( "> " );
+            }
+            break;
+        
         case MULTICAST_SEND_SUCCESS:
             printf( "[Server]:"  " Multicast message sent.\n" );
             printf( "> " );
@@ -868,6 +1197,10 @@ void echo_client(struct message msgstruct, char *nickname, char *buffer_pld) {
             printf("> ");
             break;
 
+        case USER_MAP:
+            // Bookkeeping only, nothing to display
+            break;
+
         case TRY_AGAIN_Y_N:
             printf("[Server]:"" Invalid response.\n Use the letters 'y' or 'n' to accept/refuse the file transfer\n");
             printf("> ");
@@ -931,12 +1264,12 @@ void handle_client(int sockfd, struct currentClientInfo* currentClient) {
                         strncpy(msgstruct.nick_sender, nick_sender, NICK_LEN);
                         strncpy(msgstruct.infos, nick_sender, NICK_LEN);
 
-                        if (send(sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
+                        if (send_msg(sockfd, &msgstruct, NULL) <= 0) {
                             perror("send");
                             break;
                         }
                         struct message server_message;
-                        if (recv(sockfd, &server_message, sizeof(struct message), 0) <= 0) {
+                        if (recv_msg(sockfd, &server_message, buffer_pld) <= 0) {
                             perror("recv");
                             break;
                         }
@@ -966,21 +1299,13 @@ void handle_client(int sockfd, struct currentClientInfo* currentClient) {
                 printf("[Server]:"" Please enter your nickname:\n\n");
             }
         }
-        memset(&msgstruct, 0, sizeof(struct message));
-
+        // recv_msg() and handle_message() fill in everything they use, nothing is cleared here
         if (fds[0].revents & (POLLIN | POLLRDNORM)) {
-            memset(&msgstruct, 0, sizeof(struct message));
-            memset(buffer_pld, 0, MSG_LEN);
-            if (recv(sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
+            if (recv_msg(sockfd, &msgstruct, buffer_pld) <= 0) {
                 perror("recv");
                 break;
             }
             if (msgstruct.pld_len > 0) {
-                if (recv(sockfd, buffer_pld, msgstruct.pld_len, 0) <= 0) {
-                    perror("recv");
-                    break;
-                }
-                buffer_pld[msgstruct.pld_len] = '\0';
                 if (msgstruct.type == NICKNAME_SUCCESS) {
                     strncpy(nick_sender, msgstruct.infos, NICK_LEN - 1);
                     nick_sender[NICK_LEN - 1] = '\0';
@@ -996,19 +1321,22 @@ void handle_client(int sockfd, struct currentClientInfo* currentClient) {
                 }
                 else if (msgstruct.type == FILE_ACK) {    
                 }
+                else if (msgstruct.type == USER_MAP) {
+                    user_map_apply(buffer_pld, msgstruct.pld_len);
+                }
+
+            }
+            track_membership(&msgstruct);
 
+            // A /who reply is only shown once all of its chunks are in
+            if (msgstruct.type != NICKNAME_LIST || who_assemble(sockfd, &msgstruct, buffer_pld)) {
+                echo_client(msgstruct,msgstruct.nick_sender, buffer_pld);
             }
-            echo_client(msgstruct,msgstruct.nick_sender, buffer_pld);
         }
 
         fflush(stdout);
-        memset(&msgstruct, 0, sizeof(struct message));
-        memset(buffer_pld, 0, MSG_LEN);
 
         if (fds[1].revents & POLLIN) {
-            memset(&msgstruct, 0, sizeof(struct message));
-            memset(buff, 0, MSG_LEN);
-            memset(buffer_pld, 0, MSG_LEN);
             if (fgets(buff, MSG_LEN, stdin) == NULL) {
                 break;
             }
@@ -1016,22 +1344,11 @@ void handle_client(int sockfd, struct currentClientInfo* currentClient) {
             if (msgstruct.type == SERVER_QUIT) {
                 break;
             }
-            if (send(sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
+            if (send_msg(sockfd, &msgstruct, msgstruct.pld_len > 0 ? buffer_pld : NULL) <= 0) {
                 perror("send");
-                memset(&msgstruct, 0, sizeof(struct message));
                 break;
             }
-
-            if (msgstruct.pld_len > 0) {
-                if (send(sockfd, buffer_pld, msgstruct.pld_len, 0) <= 0) {
-                    perror("send");
-                    memset(buffer_pld, 0, MSG_LEN);
-                    break;
-                }
-            }
         }
-        memset(&msgstruct, 0, sizeof(struct message));
-        memset(buffer_pld, 0, MSG_LEN);
     }
     printf( "\n-------------------------------------------\nDisconnected from the server");
         fflush(stdout);
@@ -1046,8 +1363,8 @@ void handle_client(int sockfd, struct currentClientInfo* currentClient) {
         printf( "-------------------------------------------\n");
 }
 
-// Function to establish a connection to the server
-int handle_connect(const char *server_name, const char *server_port) {
+// Function to open a TCP connection to the server, returns -1 on failure
+int open_connection(const char *server_name, const char *server_port) {
     struct addrinfo hints, *result, *rp;  // addrinfo struct to store possible server addresses
     int sfd;  // Socket file descriptor
 
@@ -1074,8 +1391,16 @@ int handle_connect(const char *server_name, const char *server_port) {
         close(sfd);  // Close the socket if connection fails
     }
 
+    freeaddrinfo(result);  // Free the address info linked list
+    return rp != NULL ? sfd : -1;
+}
+
+// Function to establish a connection to the server
+int handle_connect(const char *server_name, const char *server_port) {
+    int sfd = open_connection(server_name, server_port);
+
     // If no connection was successful, exit with an error
-    if (rp == NULL) {
+    if (sfd == -1) {
         fprintf(stderr, "Could not connect.\n" );
         exit(EXIT_FAILURE);
     }
@@ -1096,7 +1421,6 @@ int handle_connect(const char *server_name, const char *server_port) {
         printf( "----------------------------------");
         printf("\n\n""[server] :"" login with /nick <your username> \n");
 	}
-    freeaddrinfo(result);  // Free the address info linked list
     return sfd;  // Return the socket file descriptor for the established connection
 }
  
@@ -1111,6 +1435,16 @@ int main(int argc, char *argv[]) {
     const char *server_name = argv[1];
     const char *server_port = argv[2];
     int sfd = handle_connect(server_name, server_port);
+
+    // Servers that do not answer the v2 hello get a fresh v1 connection
+    if (!client_handshake(sfd)) {
+        close(sfd);
+        sfd = open_connection(server_name, server_port);
+        if (sfd == -1) {
+            fprintf(stderr, "Could not connect.\n" );
+            exit(EXIT_FAILURE);
+        }
+    }
     struct sockaddr_in server_address;
     socklen_t addrlen = sizeof(struct sockaddr_in);
    
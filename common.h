@@ -2,13 +2,52 @@
 #define COMMON_H
 
 #include <time.h>            // Include time library for tracking connection time
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include "msg_struct.h"      // Include msgstruct header file
+#include "mpsc.h"            // Lock-free queues between server workers
+#include "pool.h"            // Slab pools for sessions and channels
 #define MSG_LEN 1024         // Maximum size of a message to be exchanged between client and server
 #define NICK_LEN 128         // Maximum length allowed for a client's nickname
-#define MAX_CLIENTS 15       // Maximum number of clients that can connect simultaneously
+#define WHO_PAGE_USERS 512   // Users listed per /who request, the client asks again for the rest
+#define WHO_SNAPSHOT_PAGES 64 // /who pages kept ready to send for the current membership generation
+#define MAX_CLIENTS 15       // Maximum number of clients that can connect simultaneously (poll backend only)
 #define MAX_EVENTS 2         // Maximum number of events to monitor (socket and stdin)
 #define MSG_QUIT "/quit"     // Quit msg
 
+// Server event loop
+#define EPOLL_BATCH 256      // Maximum number of events handled per epoll_wait() call
+#define CONN_TABLE_INIT 1024 // Initial size of the fd-indexed connection table
+#define SEND_TIMEOUT_MS 5000 // Maximum time to wait for a non-blocking socket to become ready
+#define RECV_BUF_SIZE 8192   // Per-connection read buffer (holds at least one whole frame)
+#define SENDQ_HIGH_WATER 262144 // Queued bytes above which a client's input is paused
+#define SENDQ_LOW_WATER 65536 // Queued bytes below which its input resumes
+#define SENDQ_MAX_BYTES 4194304 // Default slow-consumer limit on queued bytes
+#define SENDQ_MAX_LAG_MS 30000 // Default slow-consumer limit on the oldest queued frame
+#define SENDQ_IOV_MAX 64     // Frames handed to one writev() call
+#define HANDSHAKE_TIMEOUT_MS 1000 // Time a client waits for the v2 hello to be answered
+#define MAX_WORKERS 64       // Maximum number of server worker threads
+#define UID_SLOT_BITS 20     // Low bits of a user ID index the user table, the rest is a generation
+#define UID_SLOT_MASK ((1u << UID_SLOT_BITS) - 1)
+#define UID_TABLE_INIT 1024  // Initial size of the ID-indexed user table
+#define CHANNEL_TABLE_INIT 256 // Initial number of buckets of the channel registry
+#define CLIENT_CHANNELS_INIT 4 // Initial capacity of a client's membership set
+#define MAX_CLIENT_CHANNELS 64 // Maximum number of channels a client may belong to at once
+#define CLIENT_POOL_SLAB 64  // Sessions added to the pool when it runs dry
+#define CHANNEL_POOL_SLAB 64 // Channels added to the pool when it runs dry
+#define MEMBERSHIP_POOL_SLAB 256 // Memberships added to the pool when it runs dry
+#define PREALLOC_FD_SLACK 64 // Descriptors above the session count (listeners, epoll, eventfds)
+#define ACCEPT_BUDGET 64     // Connections accepted per listener per event-loop tick
+#define MAX_PENDING_LOGINS 1024 // Default limit on sessions that have not chosen a nickname yet
+#define LOGIN_TIMEOUT_MS 10000 // Default time a session has to choose a nickname
+#define LOG_RATE_PER_SEC 10  // Lines per second from one rate-limited log call site
+#define URING_ENTRIES 4096   // Submission queue size of the io_uring backend
+#define URING_BUF_COUNT 1024 // Number of provided receive buffers (power of two)
+#define URING_BUF_SIZE 4096  // Size of each provided receive buffer
+#define URING_BGID 1         // Provided buffer group id
+
 // Colors definition
 #define COLOR_RED     "\x1b[31m"
 #define COLOR_GREEN   "\x1b[32m"
@@ -35,6 +74,114 @@ struct info {
     long l;
 };
 
+// States of the per-connection frame decoder
+enum decode_state {
+    DECODE_HEADER,            // Waiting for a whole struct message
+    DECODE_PAYLOAD            // Header decoded, waiting for pld_len bytes
+};
+
+// Per-connection read buffer and frame decoder
+typedef struct FrameDecoder {
+    enum decode_state state;
+    struct message header;    // Header of the frame being decoded
+    char *buf;                // RECV_BUF_SIZE bytes (plus one), allocated on first read
+    size_t start;             // Offset of the first undecoded byte
+    size_t len;               // Number of undecoded bytes
+    char *term;               // Terminator written after the last payload, NULL if none
+    char term_saved;          // Byte the terminator covers
+} FrameDecoder;
+
+// Encoded frame shared by reference between the send queues of a fan-out
+typedef struct SharedFrame {
+    atomic_int refs;          // One per queued OutFrame, plus the fan-out's own until it ends
+    size_t len;
+    char data[];
+} SharedFrame;
+
+// Outbound frame (header and payload) waiting in a send queue
+typedef struct OutFrame {
+    struct OutFrame *next;
+    long long queued_ms;      // Tick clock when the frame was queued
+    size_t len;
+    const char *data;         // inline_data, or the bytes of 'shared'
+    SharedFrame *shared;      // Released with the frame, NULL for inline bytes
+    char inline_data[];
+} OutFrame;
+
+// One message sent to many recipients, encoded at most once per protocol version
+typedef struct Fanout {
+    struct message *msg;
+    const void *payload;
+    size_t len;
+    SharedFrame *encoded[2];  // v1 and v2 encodings, built on first use
+} Fanout;
+
+// Reply to a list request (a /who page, /channel_list) serialized once and shared by
+// every requester until the membership generation moves on
+typedef struct ListSnapshot {
+    unsigned long generation; // membership_generation the frames were built at
+    int cursor;               // Request they answer (first user table slot of a /who page)
+    SharedFrame *encoded[2];  // v1 and v2 encodings, built on first request
+} ListSnapshot;
+
+// Per-connection outbound queue, flushed with writev() when the socket is writable
+typedef struct SendQueue {
+    OutFrame *head;
+    OutFrame *tail;
+    size_t head_off;          // Bytes of the head frame already written
+    size_t bytes;             // Queue depth in bytes
+    size_t frames;            // Queue depth in frames
+    size_t peak_bytes;        // Deepest the queue has been
+    int dirty;                // Listed for the end-of-tick flush
+    int paused;               // Input paused until the queue drains
+    int doomed;               // Disconnected by the slow-consumer policy
+    unsigned long dropped;    // Frames dropped by the slow-consumer policy
+} SendQueue;
+
+// What to do with a client whose send queue overflows
+enum slow_policy {
+    SLOW_DROP_OLDEST,         // Drop queued frames, oldest first
+    SLOW_DROP_NEWEST,         // Drop the frame being queued
+    SLOW_DISCONNECT           // Disconnect past max_bytes or max_lag_ms
+};
+
+typedef struct SlowConsumerConfig {
+    enum slow_policy policy;
+    size_t max_bytes;         // Queued bytes allowed per connection
+    long max_lag_ms;          // Age allowed for the oldest queued frame (disconnect only, 0 = no limit)
+} SlowConsumerConfig;
+
+// Limits on sessions that are connected but not logged in yet
+typedef struct AdmissionConfig {
+    int max_pending;          // Sessions without a nickname allowed at once
+    long login_timeout_ms;    // Time allowed to choose a nickname (0 = no limit)
+    int headless;             // No console animations (poll backend)
+} AdmissionConfig;
+
+// Deadline of a session that has not logged in yet, queued in accept order
+typedef struct LoginDeadline {
+    int sockfd;
+    unsigned long conn_id;
+    long long deadline_ms;    // tick_ms after which the session is closed
+} LoginDeadline;
+
+// Frames dropped and clients disconnected by each policy, across all workers
+typedef struct SlowConsumerStats {
+    atomic_ulong dropped_oldest;
+    atomic_ulong dropped_newest;
+    atomic_ulong disconnects;
+} SlowConsumerStats;
+
+extern SlowConsumerConfig slow_config;
+extern AdmissionConfig admission;
+extern SlowConsumerStats slow_stats;
+
+// Connection listed for the end-of-tick flush
+typedef struct FlushEntry {
+    int sockfd;
+    unsigned long conn_id;
+} FlushEntry;
+
 typedef struct ClientInfo {
     int sockfd;               
     struct sockaddr_in address;  
@@ -43,7 +190,16 @@ typedef struct ClientInfo {
     char ip_address[INET_ADDRSTRLEN]; 
     u_short port_number;       
     struct ClientInfo *next; 
-    char channel[CHAN_LEN];  
+    struct ClientInfo *prev;
+    struct Membership **channels; // Channels joined (unordered, swap-removed)
+    int channels_len;
+    int channels_cap;
+    int worker_id;            // Worker thread owning the socket
+    unsigned long conn_id;    // Unique per session, unlike the reusable sockfd
+    int proto;                // Wire protocol version, 0 until the first bytes arrive
+    unsigned int uid;         // User ID, 0 until the nickname is set
+    FrameDecoder decoder;
+    SendQueue sendq;
 } ClientInfo;
 
 typedef struct currentClientInfo {
@@ -56,13 +212,78 @@ typedef struct currentClientInfo {
     char channel[CHAN_LEN];
 } currentClientInfo;
 
+// Frame queued for the worker that owns the recipient's socket
+typedef struct Delivery {
+    MpscNode node;
+    int sockfd;
+    unsigned long conn_id;
+    OutFrame *frame;
+} Delivery;
+
+// Entry of the server's user table, indexed by the slot bits of a user ID
+typedef struct UidSlot {
+    ClientInfo *client;
+    unsigned int gen;         // Bumped on release so a stale ID never reaches the next owner
+    int next_free;            // Free list link, -1 at the end
+} UidSlot;
+
+// Server worker thread: one epoll loop on its own SO_REUSEPORT listener
+typedef struct Worker {
+    int id;
+    int sfd;
+    int epfd;
+    int wake_fd;              // eventfd signalled when the inbox gets deliveries
+    atomic_int wake_pending;
+    MpscQueue inbox;
+    int accept_backlog;       // The last accept pass used its whole budget
+    pthread_t thread;
+} Worker;
+
+// Per-connection state of the io_uring backend
+typedef struct UringConn {
+    int active;
+    int closing;
+    int recv_armed;           // Multishot receive still running
+    int send_inflight;        // The kernel owns 'inflight' while set
+    int dirty;                // Listed for the end-of-tick send flush
+    int doomed;               // Disconnected by the slow-consumer policy, output is discarded
+    char *pending;            // Outgoing bytes queued during this tick
+    size_t pending_len;
+    size_t pending_cap;
+    size_t pending_frames;
+    long long pending_ms;     // Tick at which the oldest pending frame was queued
+    char *inflight;           // Outgoing bytes submitted to the kernel
+    size_t inflight_len;
+    size_t inflight_off;
+    size_t inflight_cap;
+    long long inflight_ms;    // Tick at which the oldest submitted frame was queued
+    unsigned long dropped;    // Frames dropped by the slow-consumer policy
+} UringConn;
+
+// Link between a client and one of its channels, listed on both sides
+typedef struct Membership {
+    ClientInfo *client;
+    struct Channel *channel;
+    struct Membership *chan_next; // Links in the member list of the channel
+    struct Membership *chan_prev;
+} Membership;
+
 typedef struct Channel {
     char channel_name[CHAN_LEN];
-    int activ_client;
+    int activ_client;             // Length of the member list
+    Membership *members;          // Member list through Membership.chan_next
+    struct HistoryLog *history;   // Recent messages, kept by name after the channel is gone
+    uint32_t hash;
+    struct Channel *hash_next;    // Chain of the registry bucket
     struct Channel *channel_next;
+    struct Channel *channel_prev;
 } Channel;
 
 extern Channel *channel_list;
+extern Pool client_pool;
+extern Pool channel_pool;
+extern Pool membership_pool;
+extern unsigned long membership_generation;
 
 
 
@@ -70,6 +291,7 @@ extern Channel *channel_list;
 
 ////////////////////////// Nickname Functions Prototypes //////////////////////////
 int check_nickname(char *nickname);
+int update_nickname(char *nickname);
 void change_nickname(int sockfd, char *new_nickname, ClientInfo *clients_list);
 
 
@@ -77,10 +299,11 @@ void change_nickname(int sockfd, char *new_nickname, ClientInfo *clients_list);
 
 
 ////////////////////////// Messaging Functions Prototypes //////////////////////////
-void handle_who(int sockfd, ClientInfo *clients_list);
+void handle_who(int sockfd, char *request, ClientInfo *clients_list);
 void handle_whois(int sockfd, char *rqstnick, ClientInfo *clients_list);
 void handle_echo(int sockfd, char *buff, int buff_len, char *nick_sender);
-void handle_msg(int sockfd, char *buff, int buff_len, char *recipient_nickname, ClientInfo *clients_list, char *sender_nickname);
+void handle_msg(int sockfd, char *buff, int buff_len, unsigned int recipient_uid, char *recipient_nickname, ClientInfo *clients_list, char *sender_nickname);
+void deliver_mailbox(ClientInfo *client);
 void handle_msgall(int sender_sockfd, char *buff, int buff_len, ClientInfo *clients_list);
 void handle_whoami(int sockfd, char *rqstnick, ClientInfo *clients_list);
 
@@ -90,15 +313,23 @@ void handle_whoami(int sockfd, char *rqstnick, ClientInfo *clients_list);
 
 ////////////////////////// Channel Functions prototypes //////////////////////////
 int check_channel_name(char *channel); 
+int check_channel_existence(ClientInfo *list, char *channel);
 Channel* channel_info(Channel *c_list, char *c_name);
-void addChannel(char *channel_name);
+uint32_t channel_hash(const char *c_name);
+int channel_table_grow(void);
+Channel *addChannel(char *channel_name);
 void destroy_channel(char *c_name);
+Membership *channel_membership(ClientInfo *client, Channel *channel);
+int channel_add_member(Channel *channel, ClientInfo *client);
+void channel_remove_member(ClientInfo *client, Channel *channel);
+void channel_leave_all(ClientInfo *client);
 void send_notification(char *channel_name, char *message, ClientInfo *client_list, char *sender_nickname);
 void send_notification2(ClientInfo *client_list, char *channel_name, char *message, char *sender_nickname);
 void handle_create(ClientInfo *client_list, char *nick_sender, char *channel_name);
 void handle_join(ClientInfo *client_list, char *nick_sender, char *channel_name);
 void handle_channel_list(ClientInfo *client_list, char *nickname_sender);
 void handle_quit(ClientInfo *client_list, char *nickname_sender, char *channel_to_quit);
+void handle_history(ClientInfo *client_list, char *nickname_sender, char *channel_name, char *count);
 void handle_multicast(ClientInfo *client_list, char *nickname_sender, char *message, char *channel_name);
 
 
@@ -109,8 +340,8 @@ void handle_multicast(ClientInfo *client_list, char *nickname_sender, char *mess
 void write_in_new_file(int sockfd, char *file_name, struct currentClientInfo *currentClient, char *buff, struct message msg);
 void send_file(char *server_name, char *server_port, char *file_path, int socket_file);
 void handle_file_reception(struct currentClientInfo *currentClient, char *sender_nick, char *file_name);
-void send_file_request(ClientInfo *client_list, char *sender_nick, char *receiver_nick, char *file_name);
-void respond_to_sender(ClientInfo *client_list, char *nick_sender, char *buffer_pld, struct message msg_response);
+void send_file_request(int sockfd, ClientInfo *client_list, unsigned int receiver_uid, char *receiver_nick, char *file_name);
+void respond_to_sender(int sockfd, ClientInfo *client_list, char *nick_sender, char *buffer_pld, struct message msg_response);
 
 
 
@@ -118,14 +349,88 @@ void respond_to_sender(ClientInfo *client_list, char *nick_sender, char *buffer_
 
 ////////////////////////////////////// Command handling Functions Prototypes //////////////////////////////////////
 void handle_message(char *input, struct message *msgstruct, char *nick_sender, char *buffer_pld, size_t buffer_size, struct currentClientInfo *currentClient);
-void handle_command(int sockfd, struct message msgstruct, char *nick_sender, ClientInfo *clients_list, char *buff);
+void handle_command(int sockfd, struct message *msgstruct, char *nick_sender, ClientInfo *clients_list, char *buff);
 void unknown_command(ClientInfo *client_list, char *nickname_sender);
 
 
 
 
 
+////////////////////////// Server I/O Functions prototypes //////////////////////////
+int pools_init(size_t sessions, size_t channels);
+void print_pool_stats(void);
+void write_server_metrics(FILE *out);
+OutFrame *outframe_alloc(size_t len);
+OutFrame *outframe_new(int version, struct message *msg, const void *payload, size_t len);
+OutFrame *outframe_share(SharedFrame *shared);
+void outframe_free(OutFrame *frame);
+SharedFrame *shared_frame_new(int version, struct message *msg, const void *payload, size_t len);
+int shared_frame_append(SharedFrame **shared, size_t *cap, int version, struct message *msg, const void *payload, size_t len);
+void shared_frame_release(SharedFrame *shared);
+void fanout_init(Fanout *fanout, struct message *msg, const void *payload, size_t len);
+int fanout_send(Fanout *fanout, int sockfd);
+void fanout_done(Fanout *fanout);
+int send_shared(ClientInfo *recipient, SharedFrame *shared, enum msg_type type);
+SharedFrame *snapshot_get(ListSnapshot *snapshots, int count, int cursor, int v2);
+void snapshot_put(ListSnapshot *snapshots, int count, int cursor, int v2, SharedFrame *shared);
+int send_bytes(ClientInfo *client, const void *data, size_t len);
+int send_outframe(ClientInfo *recipient, OutFrame *frame);
+void sendq_schedule(ClientInfo *client);
+void update_tick_clock(void);
+int parse_slow_policy(const char *name, enum slow_policy *policy);
+int sendq_lagging(SendQueue *q);
+void sendq_disconnect(ClientInfo *client);
+int sendq_enforce_policy(ClientInfo *client, OutFrame *frame);
+void sendq_push(ClientInfo *client, OutFrame *frame);
+void sendq_clear(SendQueue *q);
+int sendq_flush(ClientInfo *client);
+void flush_pending_sends(int resume_input);
+void drain_client_input(int sockfd);
+int decoder_reserve(FrameDecoder *dec);
+int decoder_next_frame_v2(FrameDecoder *dec, char **pld);
+int negotiate_protocol(ClientInfo *client);
+size_t decoder_fill(FrameDecoder *dec, const void *data, size_t len);
+int decoder_next_frame(FrameDecoder *dec, int has_payload, char **pld);
+void decoder_release(FrameDecoder *dec);
+void decoder_compact(FrameDecoder *dec);
+int set_nonblocking(int sockfd);
+void raise_fd_limit(void);
+void capture_inbound(ClientInfo *current, const struct message *msgstruct, const char *pld, size_t len);
+int process_frames(ClientInfo *current);
+int handle_client_input(int sockfd);
+void close_client(int sockfd);
+ClientInfo *admit_client(int sockfd, struct sockaddr_in address);
+void login_queue_push(ClientInfo *client);
+int next_expired_login(void);
+int login_wait_ms(void);
+void waiting_animation(const char *what);
+void handle_multiple_clients(int sfd);
+void handle_multiple_clients_epoll(int sfd, const char *port, int nworkers);
+int handle_bind(const char *port, int reuseport);
+int send_frame(int sockfd, struct message *msg, const void *payload, size_t len);
+void worker_post(Worker *worker, Delivery *delivery);
+int dispatch_frame(ClientInfo *current, struct message *msgstruct, char *buff);
+ssize_t uring_queue_send(int sockfd, const void *buf, size_t len);
+int handle_multiple_clients_uring(int sfd);
+
+
+
+
+
+////////////////////////// User ID Functions prototypes //////////////////////////
+unsigned int assign_uid(ClientInfo *client);
+void release_uid(ClientInfo *client);
+ClientInfo *uid_to_client(unsigned int uid);
+ClientInfo *resolve_recipient(ClientInfo *list, unsigned int uid, char *nick);
+void send_user_map(ClientInfo *client);
+void send_user_update(ClientInfo *list, ClientInfo *skip, unsigned int uid, const char *nick);
+
+
+
+
+
 ////////////////////////// Other Functions prototypes //////////////////////////
+extern ClientInfo *clientList;
 ClientInfo* sockfd_to_client(ClientInfo* list, int sockfd);
 char* sockfd_to_nick(ClientInfo *list, int sockfd);
 ClientInfo* nick_to_client(ClientInfo *list, char *nick);
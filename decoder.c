@@ -0,0 +1,107 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "log.h"
+#include "proto.h"
+
+// Function to allocate a connection's read buffer on first use
+// The spare byte past RECV_BUF_SIZE lets a payload that ends the buffer be terminated in place
+int decoder_reserve(FrameDecoder *dec) {
+    if (dec->buf == NULL) {
+        dec->buf = malloc(RECV_BUF_SIZE + 1);
+        if (dec->buf == NULL) {
+            log_perror("malloc");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Function to copy received bytes into a connection's read buffer, as many as fit
+size_t decoder_fill(FrameDecoder *dec, const void *data, size_t len) {
+    size_t room = RECV_BUF_SIZE - dec->start - dec->len;
+    if (len > room) {
+        len = room;
+    }
+    memcpy(dec->buf + dec->start + dec->len, data, len);
+    dec->len += len;
+    return len;
+}
+
+// Function to NUL-terminate a payload in place, saving the byte the terminator covers
+static void decoder_terminate(FrameDecoder *dec, char *end) {
+    dec->term = end;
+    dec->term_saved = *end;
+    *end = '\0';
+}
+
+// Function to put back the byte covered by the last payload's terminator
+void decoder_release(FrameDecoder *dec) {
+    if (dec->term != NULL) {
+        *dec->term = dec->term_saved;
+        dec->term = NULL;
+    }
+}
+
+// Function to take the next complete frame out of a read buffer
+// The header lands in dec->header and *pld points at the payload, terminated in place
+// and valid until the next decoder call. Returns 1 when a frame is ready, 0 when more
+// bytes are needed and -1 for an oversized frame
+int decoder_next_frame(FrameDecoder *dec, int has_payload, char **pld) {
+    decoder_release(dec);
+    if (dec->state == DECODE_HEADER) {
+        if (dec->len < PROTO_V1_HEADER_LEN) {
+            return 0;
+        }
+        memcpy(&dec->header, dec->buf + dec->start, PROTO_V1_HEADER_LEN);
+        dec->header.uid = 0;    // v1 frames address users by nickname
+        dec->start += PROTO_V1_HEADER_LEN;
+        dec->len -= PROTO_V1_HEADER_LEN;
+
+        // Reject the frame before waiting for its payload
+        if (has_payload && (dec->header.pld_len < 0 || dec->header.pld_len >= MSG_LEN)) {
+            return -1;
+        }
+        dec->state = DECODE_PAYLOAD;
+    }
+
+    size_t pld_len = has_payload ? dec->header.pld_len : 0;
+    if (dec->len < pld_len) {
+        return 0;
+    }
+    *pld = dec->buf + dec->start;
+    decoder_terminate(dec, *pld + pld_len);
+    dec->start += pld_len;
+    dec->len -= pld_len;
+    dec->state = DECODE_HEADER;
+    return 1;
+}
+
+// Function to take the next complete v2 frame out of a read buffer, like decoder_next_frame()
+// Returns 1 when a frame is ready, 0 when more bytes are needed and -1 for a malformed frame
+int decoder_next_frame_v2(FrameDecoder *dec, char **pld) {
+    decoder_release(dec);
+    size_t pld_off;
+    size_t used;
+    int ret = proto_v2_decode_header((uint8_t *)dec->buf + dec->start, dec->len, &dec->header, MSG_LEN, &pld_off, &used);
+    if (ret == 1) {
+        *pld = dec->buf + dec->start + pld_off;
+        decoder_terminate(dec, *pld + dec->header.pld_len);
+        dec->start += used;
+        dec->len -= used;
+    }
+    return ret;
+}
+
+// Function to move the undecoded tail of a read buffer back to its start
+void decoder_compact(FrameDecoder *dec) {
+    decoder_release(dec);
+    if (dec->len == 0) {
+        dec->start = 0;
+    } else if (dec->start > 0) {
+        memmove(dec->buf, dec->buf + dec->start, dec->len);
+        dec->start = 0;
+    }
+}
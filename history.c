@@ -0,0 +1,679 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "history.h"
+#include "log.h"
+
+int history_persistent = 0;
+
+static char history_dir[PATH_MAX - 2 * CHAN_LEN]; // <data_dir>/history, leaves room for the file names
+static HistoryLog *history_table[HISTORY_BUCKETS];
+static pthread_mutex_t history_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Channels with messages the writer has not written yet
+static HistoryLog *dirty_head = NULL;
+static int history_stopping = 0;
+static pthread_mutex_t history_dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t history_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t history_thread;
+
+// Writer only
+static uint8_t *write_buf = NULL;
+static size_t write_cap = 0;
+static unsigned long history_dropped = 0;
+
+// A segment file mapped for reading
+typedef struct SegmentMap {
+    const uint8_t *data;
+    size_t size;
+} SegmentMap;
+
+// Function to hash a channel name (FNV-1a)
+static uint32_t history_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash;
+}
+
+// Function to build the path of the segment starting at seq
+static void segment_path(char *path, size_t size, const HistoryLog *log, uint64_t seq) {
+    snprintf(path, size, "%s/%s/%020llu.seg", history_dir, log->name, (unsigned long long)seq);
+}
+
+// Function to list one more segment (callers hold the log's lock or own it alone)
+static int segments_push(HistoryLog *log, uint64_t seq) {
+    if (log->segments_len == log->segments_cap) {
+        int new_cap = log->segments_cap > 0 ? log->segments_cap * 2 : 8;
+        uint64_t *grown = realloc(log->segments, new_cap * sizeof(uint64_t));
+        if (grown == NULL) {
+            log_perror("realloc");
+            return -1;
+        }
+        log->segments = grown;
+        log->segments_cap = new_cap;
+    }
+    log->segments[log->segments_len++] = seq;
+    return 0;
+}
+
+// Function to map a segment file, returns 0 if it is empty or cannot be read
+static int segment_map(const HistoryLog *log, uint64_t seq, SegmentMap *map) {
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), log, seq);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    map->data = data;
+    map->size = st.st_size;
+    return 1;
+}
+
+// Function to read the record at *off of a mapped segment
+// Returns 1 and moves *off past it, 0 at the end (or at a record cut short by a crash)
+static int segment_next(const SegmentMap *map, size_t *off, uint64_t *seq, uint64_t *time_ms, const char **text, uint64_t *len) {
+    size_t at = *off;
+    size_t used;
+    if (capture_get_varint64(map->data + at, map->size - at, seq, &used) != 1) {
+        return 0;
+    }
+    at += used;
+    if (capture_get_varint64(map->data + at, map->size - at, time_ms, &used) != 1) {
+        return 0;
+    }
+    at += used;
+    if (capture_get_varint64(map->data + at, map->size - at, len, &used) != 1 || *len > map->size - at - used) {
+        return 0;
+    }
+    at += used;
+    *text = (const char *)map->data + at;
+    *off = at + *len;
+    return 1;
+}
+
+static int segment_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Function to find the segments a channel left on disk and where its numbering stopped
+// Run by the writer before it first writes the channel; readers leave the list alone until loaded is set
+// Returns -1 if the channel's directory cannot be read, its messages then stay in memory
+static int history_load(HistoryLog *log) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", history_dir, log->name);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        log_perror("mkdir");
+        return -1;
+    }
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        log_perror("opendir");
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char *end;
+        unsigned long long seq = strtoull(entry->d_name, &end, 10);
+        if (seq > 0 && strcmp(end, ".seg") == 0) {
+            segments_push(log, seq);
+        }
+    }
+    closedir(dir);
+
+    // The last record of the newest segment tells where the messages in memory go on from
+    uint64_t last = 0;
+    if (log->segments_len > 0) {
+        qsort(log->segments, log->segments_len, sizeof(uint64_t), segment_cmp);
+        last = log->segments[log->segments_len - 1] - 1;
+        SegmentMap map;
+        if (segment_map(log, log->segments[log->segments_len - 1], &map)) {
+            size_t off = 0;
+            uint64_t seq, time_ms, len;
+            const char *text;
+            while (segment_next(&map, &off, &seq, &time_ms, &text, &len)) {
+                last = seq;
+            }
+            munmap((void *)map.data, map.size);
+        }
+    }
+    pthread_mutex_lock(&log->lock);
+    log->disk_base = last;
+    log->loaded = 1;
+    pthread_mutex_unlock(&log->lock);
+    return 0;
+}
+
+// Function to list a channel for the writer's next pass, when nothing else will
+static void history_relist(HistoryLog *log) {
+    pthread_mutex_lock(&log->lock);
+    int listed = !log->dirty;
+    log->dirty = 1;
+    pthread_mutex_unlock(&log->lock);
+    if (listed) {
+        pthread_mutex_lock(&history_dirty_lock);
+        log->dirty_next = dirty_head;
+        dirty_head = log;
+        pthread_mutex_unlock(&history_dirty_lock);
+    }
+}
+
+// Function to check that a channel name is safe as a directory name: 1 to CHAN_LEN - 1 letters and digits
+static int history_name_valid(const char *name) {
+    size_t len = strnlen(name, CHAN_LEN);
+    if (len < 1 || len >= CHAN_LEN) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)name[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to find the history of a channel name, creating it on first use
+// With -d, a new log is listed for the writer, which reads its segment list off the event loop
+// Returns NULL for a name that is not a valid channel name, so it never reaches a path
+HistoryLog *history_open(const char *channel_name) {
+    if (!history_name_valid(channel_name)) {
+        log_error("Refusing history for invalid channel name.");
+        return NULL;
+    }
+    uint32_t bucket = history_hash(channel_name) & (HISTORY_BUCKETS - 1);
+    pthread_mutex_lock(&history_table_lock);
+    HistoryLog *log = history_table[bucket];
+    while (log != NULL && strcmp(log->name, channel_name) != 0) {
+        log = log->hash_next;
+    }
+    if (log == NULL) {
+        log = calloc(1, sizeof(HistoryLog));
+        if (log == NULL) {
+            log_perror("calloc");
+        } else {
+            snprintf(log->name, CHAN_LEN, "%s", channel_name);
+            pthread_mutex_init(&log->lock, NULL);
+            log->next_seq = 1;
+            log->hash_next = history_table[bucket];
+            history_table[bucket] = log;
+            if (history_persistent) {
+                history_relist(log);
+            }
+        }
+    }
+    if (log != NULL) {
+        log->users++;
+    }
+    pthread_mutex_unlock(&history_table_lock);
+    return log;
+}
+
+// Function to take a log out of the name table (callers hold history_table_lock)
+static void history_unlink(HistoryLog *log) {
+    HistoryLog **link = &history_table[history_hash(log->name) & (HISTORY_BUCKETS - 1)];
+    while (*link != log) {
+        link = &(*link)->hash_next;
+    }
+    *link = log->hash_next;
+}
+
+// Function to free a log nobody can reach any more
+static void history_free(HistoryLog *log) {
+    if (log->active != NULL) {
+        fclose(log->active);
+    }
+    for (int i = 0; i < HISTORY_RING; i++) {
+        free(log->ring[i].text);
+    }
+    free(log->segments);
+    pthread_mutex_destroy(&log->lock);
+    free(log);
+}
+
+// Function to give back a log from history_open
+// The last user frees it, or with -d lists it so the writer frees it once its messages are on disk
+void history_close(HistoryLog *log) {
+    pthread_mutex_lock(&history_table_lock);
+    int unused = --log->users == 0;
+    if (unused && history_persistent) {
+        history_relist(log);
+        unused = 0;
+    } else if (unused) {
+        history_unlink(log);
+    }
+    pthread_mutex_unlock(&history_table_lock);
+    if (unused) {
+        history_free(log);
+    }
+}
+
+// Function run by the writer after writing a log: frees it if no channel uses it and nothing is left to write
+static void history_evict(HistoryLog *log) {
+    pthread_mutex_lock(&history_table_lock);
+    pthread_mutex_lock(&log->lock);
+    int unused = log->users == 0 && !log->dirty;
+    pthread_mutex_unlock(&log->lock);
+    if (unused) {
+        history_unlink(log);
+    }
+    pthread_mutex_unlock(&history_table_lock);
+    if (unused) {
+        history_free(log);
+    }
+}
+
+// Function to keep one channel message; only copies it into the channel's ring
+void history_append(HistoryLog *log, const char *text, size_t len) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    pthread_mutex_lock(&log->lock);
+    uint64_t seq = log->next_seq;
+    HistoryEntry *entry = &log->ring[seq % HISTORY_RING];
+    if (entry->cap < len) {
+        char *grown = realloc(entry->text, len);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&log->lock);
+            log_perror("realloc");
+            return;
+        }
+        entry->text = grown;
+        entry->cap = len;
+    }
+    memcpy(entry->text, text, len);
+    entry->len = len;
+    entry->seq = seq;
+    entry->time_ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+    log->next_seq++;
+
+    // The writer is told about the channel once per pass, and woken early if the ring is half unwritten
+    int listed = history_persistent && !log->dirty;
+    int behind = history_persistent && seq - log->written_seq >= HISTORY_RING / 2;
+    log->dirty |= listed;
+    pthread_mutex_unlock(&log->lock);
+
+    if (listed || behind) {
+        pthread_mutex_lock(&history_dirty_lock);
+        if (listed) {
+            log->dirty_next = dirty_head;
+            dirty_head = log;
+        }
+        if (behind) {
+            pthread_cond_signal(&history_wake);
+        }
+        pthread_mutex_unlock(&history_dirty_lock);
+    }
+}
+
+// Function to hand back the last count messages of a channel, oldest first
+// Messages still in the ring are copied out under the lock; older ones come from
+// the segments, which are mapped under the lock and read after it is released
+int history_read(HistoryLog *log, int count, history_emit emit, void *ctx) {
+    if (count < 1) {
+        return 0;
+    }
+
+    // Everything below is numbered as on disk; the ring holds [ring_from, last] shifted by base
+    pthread_mutex_lock(&log->lock);
+    uint64_t base = log->loaded ? log->disk_base : 0;
+    uint64_t last = base + log->next_seq - 1;
+    uint64_t from = last >= (uint64_t)count ? last - count + 1 : 1;
+    uint64_t ring_from = base + (log->next_seq > HISTORY_RING ? log->next_seq - HISTORY_RING : 1);
+    if (ring_from < from) {
+        ring_from = from;
+    }
+
+    // Copy the ring part
+    int ring_count = (int)(last + 1 - ring_from);
+    size_t text_bytes = 0;
+    for (uint64_t seq = ring_from; seq <= last; seq++) {
+        text_bytes += log->ring[(seq - base) % HISTORY_RING].len;
+    }
+    HistoryEntry *copies = malloc(ring_count * sizeof(HistoryEntry) + text_bytes + 1);
+    if (copies == NULL) {
+        pthread_mutex_unlock(&log->lock);
+        log_perror("malloc");
+        return -1;
+    }
+    char *texts = (char *)(copies + ring_count);
+    for (int i = 0; i < ring_count; i++) {
+        const HistoryEntry *entry = &log->ring[(ring_from - base + i) % HISTORY_RING];
+        copies[i] = *entry;
+        copies[i].text = texts;
+        memcpy(texts, entry->text, entry->len);
+        texts += entry->len;
+    }
+
+    // Map the segments holding [from, disk_to)
+    uint64_t disk_to = ring_from < base + log->written_seq + 1 ? ring_from : base + log->written_seq + 1;
+    SegmentMap *maps = NULL;
+    int maps_len = 0;
+    if (log->loaded && from < disk_to && log->segments_len > 0) {
+        maps = malloc(log->segments_len * sizeof(SegmentMap));
+        for (int i = 0; maps != NULL && i < log->segments_len; i++) {
+            uint64_t seg_from = log->segments[i];
+            uint64_t seg_to = i + 1 < log->segments_len ? log->segments[i + 1] : UINT64_MAX;
+            if (seg_from < disk_to && seg_to > from && segment_map(log, seg_from, &maps[maps_len])) {
+                maps_len++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    int emitted = 0;
+    for (int i = 0; i < maps_len; i++) {
+        size_t off = 0;
+        uint64_t seq, time_ms, len;
+        const char *text;
+        while (segment_next(&maps[i], &off, &seq, &time_ms, &text, &len)) {
+            if (seq >= from && seq < disk_to) {
+                emit(ctx, (long long)time_ms, text, len);
+                emitted++;
+            }
+        }
+        munmap((void *)maps[i].data, maps[i].size);
+    }
+    free(maps);
+    for (int i = 0; i < ring_count; i++) {
+        emit(ctx, copies[i].time_ms, copies[i].text, copies[i].len);
+        emitted++;
+    }
+    free(copies);
+    return emitted;
+}
+
+// Function to make room for len more bytes in the writer's buffer
+static int write_reserve(size_t used, size_t len) {
+    if (used + len <= write_cap) {
+        return 0;
+    }
+    size_t new_cap = write_cap > 0 ? write_cap : 65536;
+    while (new_cap < used + len) {
+        new_cap *= 2;
+    }
+    uint8_t *grown = realloc(write_buf, new_cap);
+    if (grown == NULL) {
+        log_perror("realloc");
+        return -1;
+    }
+    write_buf = grown;
+    write_cap = new_cap;
+    return 0;
+}
+
+// Function to merge the sealed segments of a channel into one holding its last HISTORY_KEEP messages
+// Only the writer changes the segment list, so it reads it without the lock
+static void history_compact(HistoryLog *log) {
+    int sealed = log->segments_len - 1;
+    uint64_t written = log->disk_base + log->written_seq;
+    uint64_t cutoff = written > HISTORY_KEEP ? written - HISTORY_KEEP + 1 : 1;
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s/compact.tmp", history_dir, log->name);
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        log_perror("compact");
+        return;
+    }
+
+    uint64_t first_kept = 0;
+    int failed = 0;
+    for (int i = 0; i < sealed && !failed; i++) {
+        SegmentMap map;
+        if (!segment_map(log, log->segments[i], &map)) {
+            continue;
+        }
+        size_t off = 0;
+        size_t start = 0;
+        uint64_t seq, time_ms, len;
+        const char *text;
+        while (segment_next(&map, &off, &seq, &time_ms, &text, &len)) {
+            if (seq >= cutoff) {
+                // The rest of the segment is kept as it is
+                if (first_kept == 0) {
+                    first_kept = seq;
+                }
+                failed = fwrite(map.data + start, 1, map.size - start, out) != map.size - start;
+                break;
+            }
+            start = off;
+        }
+        munmap((void *)map.data, map.size);
+    }
+    if (fclose(out) != 0 || failed) {
+        log_perror("compact");
+        unlink(tmp_path);
+        return;
+    }
+
+    // Swap the files and the list together, so readers see either the old or the new ones
+    uint64_t *old = malloc(sealed * sizeof(uint64_t));
+    if (old == NULL) {
+        log_perror("malloc");
+        unlink(tmp_path);
+        return;
+    }
+    memcpy(old, log->segments, sealed * sizeof(uint64_t));
+    char path[PATH_MAX];
+    pthread_mutex_lock(&log->lock);
+    int kept = 0;
+    if (first_kept != 0) {
+        segment_path(path, sizeof(path), log, first_kept);
+        if (rename(tmp_path, path) < 0) {
+            pthread_mutex_unlock(&log->lock);
+            log_perror("rename");
+            unlink(tmp_path);
+            free(old);
+            return;
+        }
+        log->segments[kept++] = first_kept;
+    }
+    log->segments[kept++] = log->segments[sealed];
+    log->segments_len = kept;
+    pthread_mutex_unlock(&log->lock);
+
+    for (int i = 0; i < sealed; i++) {
+        if (old[i] != first_kept) {
+            segment_path(path, sizeof(path), log, old[i]);
+            unlink(path);
+        }
+    }
+    unlink(tmp_path);
+    free(old);
+    log_info("Compacted %d history segments of channel %s, kept messages from %llu on.", sealed, log->name, (unsigned long long)cutoff);
+}
+
+// Function to open the segment the next messages of a channel go to, starting at seq
+static int history_rotate(HistoryLog *log, uint64_t seq) {
+    char path[PATH_MAX];
+    if (log->active != NULL) {
+        fclose(log->active);
+        log->active = NULL;
+    } else if (log->segments_len > 0) {
+        // First write since the server started: go on with the newest segment if it has room
+        struct stat st;
+        segment_path(path, sizeof(path), log, log->segments[log->segments_len - 1]);
+        if (stat(path, &st) == 0 && st.st_size < HISTORY_SEGMENT_BYTES) {
+            log->active = fopen(path, "ab");
+            log->active_size = st.st_size;
+            return log->active != NULL ? 0 : -1;
+        }
+    }
+
+    segment_path(path, sizeof(path), log, seq);
+    log->active = fopen(path, "ab");
+    if (log->active == NULL) {
+        return -1;
+    }
+    log->active_size = 0;
+    pthread_mutex_lock(&log->lock);
+    int ret = segments_push(log, seq);
+    pthread_mutex_unlock(&log->lock);
+    return ret;
+}
+
+// Function to write out the messages of a channel that are not on disk yet
+// written_seq only moves once they are, so a failed write is retried on the next pass
+static void history_flush_log(HistoryLog *log) {
+    // loaded and disk_base only change here, so the writer reads them without the lock
+    if (!log->loaded && history_load(log) < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    log->dirty = 0;
+    uint64_t from = log->written_seq + 1;
+    uint64_t to = log->next_seq;
+    uint64_t oldest = to > HISTORY_RING ? to - HISTORY_RING : 1;
+    if (from < oldest) {
+        history_dropped += oldest - from;
+        from = oldest;
+    }
+    size_t used = 0;
+    for (uint64_t seq = from; seq < to; seq++) {
+        const HistoryEntry *entry = &log->ring[seq % HISTORY_RING];
+        if (write_reserve(used, 3 * CAPTURE_VARINT64_MAX + entry->len) < 0) {
+            to = seq;
+            break;
+        }
+        used += capture_put_varint64(write_buf + used, log->disk_base + seq);
+        used += capture_put_varint64(write_buf + used, (uint64_t)entry->time_ms);
+        used += capture_put_varint64(write_buf + used, entry->len);
+        memcpy(write_buf + used, entry->text, entry->len);
+        used += entry->len;
+    }
+    pthread_mutex_unlock(&log->lock);
+    if (from >= to) {
+        return;
+    }
+
+    if ((log->active == NULL || log->active_size >= HISTORY_SEGMENT_BYTES) && history_rotate(log, log->disk_base + from) < 0) {
+        log_perror("history segment");
+        history_relist(log);
+        return;
+    }
+    if (fwrite(write_buf, 1, used, log->active) != used || fflush(log->active) != 0) {
+        // Cut the segment back to its last whole record and try again on the next pass
+        log_perror("history write");
+        char path[PATH_MAX];
+        segment_path(path, sizeof(path), log, log->segments[log->segments_len - 1]);
+        fclose(log->active);
+        log->active = NULL;
+        if (truncate(path, log->active_size) < 0) {
+            log_perror("history truncate");
+        }
+        history_relist(log);
+        return;
+    }
+    log->active_size += used;
+
+    pthread_mutex_lock(&log->lock);
+    log->written_seq = to - 1;
+    pthread_mutex_unlock(&log->lock);
+
+    if (log->segments_len - 1 > HISTORY_COMPACT_SEGMENTS) {
+        history_compact(log);
+    }
+}
+
+// Function run by the writer thread: every HISTORY_FLUSH_MS, or as soon as a ring
+// is half unwritten, writes out the channels that got messages
+static void *history_writer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&history_dirty_lock);
+    while (1) {
+        if (!history_stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += HISTORY_FLUSH_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&history_wake, &history_dirty_lock, &deadline);
+        }
+        int stopping = history_stopping;
+        HistoryLog *log = dirty_head;
+        dirty_head = NULL;
+        pthread_mutex_unlock(&history_dirty_lock);
+
+        // A log can be listed again as soon as its dirty flag is cleared, so its link is read first
+        while (log != NULL) {
+            HistoryLog *next = log->dirty_next;
+            history_flush_log(log);
+            history_evict(log);
+            log = next;
+        }
+        if (history_dropped > 0) {
+            log_warn("%lu channel messages never reached the history files, their channels outran the ring.", history_dropped);
+            history_dropped = 0;
+        }
+        if (stopping) {
+            return NULL;
+        }
+        pthread_mutex_lock(&history_dirty_lock);
+    }
+}
+
+// Function to keep channel history under <data_dir>/history and start the writer thread
+int history_start(const char *data_dir) {
+    if (snprintf(history_dir, sizeof(history_dir), "%s/history", data_dir) >= (int)sizeof(history_dir)) {
+        log_error("The data directory path is too long.");
+        return -1;
+    }
+    if ((mkdir(data_dir, 0755) < 0 && errno != EEXIST) || (mkdir(history_dir, 0755) < 0 && errno != EEXIST)) {
+        log_perror("mkdir");
+        return -1;
+    }
+    history_persistent = 1;
+    if (pthread_create(&history_thread, NULL, history_writer, NULL) != 0) {
+        log_perror("pthread_create");
+        history_persistent = 0;
+        return -1;
+    }
+    atexit(history_stop);
+    log_info("Keeping channel history in %s.", history_dir);
+    return 0;
+}
+
+// Function to write out what is left and close the segments
+void history_stop(void) {
+    if (!history_persistent) {
+        return;
+    }
+    pthread_mutex_lock(&history_dirty_lock);
+    history_stopping = 1;
+    pthread_cond_signal(&history_wake);
+    pthread_mutex_unlock(&history_dirty_lock);
+    pthread_join(history_thread, NULL);
+    history_persistent = 0;
+
+    for (int b = 0; b < HISTORY_BUCKETS; b++) {
+        for (HistoryLog *log = history_table[b]; log != NULL; log = log->hash_next) {
+            if (log->active != NULL) {
+                fclose(log->active);
+                log->active = NULL;
+            }
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "msg_struct.h"
+
+// Channel history
+// Every channel message is kept in a ring of the last HISTORY_RING messages of
+// its channel, so /history is answered from memory in the common case. With -d,
+// a writer thread also appends the messages to per-channel segment files under
+// <data_dir>/history/<channel>/, named after the sequence number of their first
+// message. A segment is sealed once it holds HISTORY_SEGMENT_BYTES; requests
+// that reach past the ring map the segments they need. When a channel has more
+// than HISTORY_COMPACT_SEGMENTS sealed segments, the writer merges them into one
+// holding only the last HISTORY_KEEP messages. Appending only copies the message
+// into the ring under the channel's own lock; the disk is never touched by an
+// event loop. If a channel outruns its ring before the writer gets to it, the
+// overwritten messages never reach the disk and are counted.
+//
+// Messages are numbered from 1 in memory each time a channel's history is first
+// used since the server started. The writer reads the channel's segment list on
+// its next pass and numbers the messages on disk after the ones already there.
+// Until then, /history only sees the messages kept in memory.
+//
+// Each segment file holds records of
+//
+//     varint  seq         sequence number of the message in its channel (from 1)
+//     varint  time_ms     wall clock when the server relayed it
+//     varint  len
+//     text                the payload members received ("[nick]: message")
+
+#define HISTORY_RING 128                 // Messages kept in memory per channel
+#define HISTORY_SEGMENT_BYTES (1 << 20)  // Size at which a segment file is sealed
+#define HISTORY_COMPACT_SEGMENTS 8       // Sealed segments a channel may have before they are merged
+#define HISTORY_KEEP 100000              // Messages per channel kept by compaction
+#define HISTORY_FLUSH_MS 100             // Writer period; at most this much is lost if the server is killed
+#define HISTORY_DEFAULT 20               // Messages sent back by a bare /history
+#define HISTORY_MAX_REQUEST 1000         // Messages one /history request may ask for
+#define HISTORY_BUCKETS 1024             // Buckets of the channel name table
+
+typedef struct HistoryEntry {
+    uint64_t seq;             // 0 while the slot is unused
+    long long time_ms;
+    size_t len;
+    size_t cap;
+    char *text;
+} HistoryEntry;
+
+// History of one channel name, freed once no channel uses it and the writer is done with it
+// With -d, a channel created again under the same name gets its past back from the segments
+typedef struct HistoryLog {
+    char name[CHAN_LEN];
+    int users;                // history_open calls not yet closed (under history_table_lock)
+    pthread_mutex_t lock;     // Guards everything below but the writer-only fields
+    uint64_t next_seq;        // Sequence number of the next message, counted in memory from 1
+    HistoryEntry ring[HISTORY_RING]; // Message seq sits at ring[seq % HISTORY_RING]
+    uint64_t written_seq;     // Messages up to this one are in the segment files
+    int loaded;               // The writer has read the segment list; until then the fields below are its own
+    uint64_t disk_base;       // Message seq is numbered disk_base + seq in the segment files
+    uint64_t *segments;       // First sequence number on disk of each segment, oldest first
+    int segments_len;
+    int segments_cap;
+    int dirty;                // Listed for the writer
+    struct HistoryLog *dirty_next;
+    struct HistoryLog *hash_next;
+    FILE *active;             // Writer only: the segment being appended to
+    size_t active_size;       // Writer only
+} HistoryLog;
+
+// Called for every message a history read hands back, oldest first
+typedef void (*history_emit)(void *ctx, long long time_ms, const char *text, size_t len);
+
+extern int history_persistent;
+
+int history_start(const char *data_dir);
+void history_stop(void);
+HistoryLog *history_open(const char *channel_name);
+void history_close(HistoryLog *log);
+void history_append(HistoryLog *log, const char *text, size_t len);
+int history_read(HistoryLog *log, int count, history_emit emit, void *ctx);
+
+#endif
@@ -0,0 +1,238 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "latency.h"
+#include "log.h"
+
+#define LATENCY_WINDOWS 3
+
+// Windows reported, in completed slices on top of the one in progress
+static const int window_slices[LATENCY_WINDOWS] = { 1, 6, LATENCY_SLICES };
+static const char *window_names[LATENCY_WINDOWS] = { "10s", "1m", "5m" };
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const char *quantile_names[] = { "0.5", "0.9", "0.99", "0.999" };
+
+static LatencyBlock unregistered_latency;
+static LatencyBlock *latency_blocks[METRICS_MAX_THREADS];
+static int latency_block_count = 0;
+
+// Guards the block list and the slices below
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long (*slice_start)[LATENCY_BUCKETS] = NULL;            // Totals when the current slice began
+static uint32_t (*slices)[METRICS_MSG_TYPES][LATENCY_BUCKETS] = NULL;        // Counts of each completed slice
+static int slice_head = 0;             // Most recent completed slice
+static int slice_count = 0;
+static pthread_t latency_thread;
+
+__thread LatencyBlock *thread_latency = &unregistered_latency;
+
+// Function to get the histogram bucket of a value: exact below LATENCY_SUB_BUCKETS,
+// then LATENCY_SUB_BUCKETS linear steps per power of two
+int latency_bucket(unsigned long long ns) {
+    if (ns >= 1ULL << LATENCY_MAX_BITS) {
+        ns = (1ULL << LATENCY_MAX_BITS) - 1;
+    }
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS + (int)((ns >> shift) - LATENCY_SUB_BUCKETS);
+}
+
+// Function to get the highest value a bucket holds
+unsigned long long latency_bucket_high(int bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    unsigned long long mantissa = bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+// Function to give the calling thread its own histograms
+void latency_register_thread(void) {
+    LatencyBlock *block = aligned_alloc(64, sizeof(LatencyBlock));
+    if (block == NULL) {
+        log_perror("aligned_alloc");
+        metrics_shared_writer = 1;
+        return;
+    }
+    memset(block, 0, sizeof(LatencyBlock));
+
+    pthread_mutex_lock(&latency_lock);
+    if (latency_block_count < METRICS_MAX_THREADS) {
+        latency_blocks[latency_block_count++] = block;
+        thread_latency = block;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&latency_lock);
+    if (block != NULL) {
+        // Left on the shared histograms, which other threads write too
+        metrics_shared_writer = 1;
+    }
+    free(block);
+}
+
+// Function to record the time since since_ns against a frame type
+void latency_record(int type, long long since_ns) {
+    long long ns = latency_now_ns() - since_ns;
+    metrics_add(&thread_latency->counts[metrics_type(type)][latency_bucket(ns > 0 ? ns : 0)], 1);
+}
+
+// Function to add up one frame type over every thread (callers hold latency_lock)
+static void latency_totals(int type, unsigned long long *totals) {
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        totals[b] = atomic_load_explicit(&unregistered_latency.counts[type][b], memory_order_relaxed);
+    }
+    for (int i = 0; i < latency_block_count; i++) {
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            totals[b] += atomic_load_explicit(&latency_blocks[i]->counts[type][b], memory_order_relaxed);
+        }
+    }
+}
+
+// Function to close the current slice and start a new one
+static void latency_rotate(void) {
+    unsigned long long totals[LATENCY_BUCKETS];
+
+    pthread_mutex_lock(&latency_lock);
+    slice_head = (slice_head + 1) % LATENCY_SLICES;
+    if (slice_count < LATENCY_SLICES) {
+        slice_count++;
+    }
+    for (int type = 0; type < METRICS_MSG_TYPES; type++) {
+        latency_totals(type, totals);
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            slices[slice_head][type][b] = (uint32_t)(totals[b] - slice_start[type][b]);
+            slice_start[type][b] = totals[b];
+        }
+    }
+    pthread_mutex_unlock(&latency_lock);
+}
+
+// Function to get the percentiles of one frame type over a window (callers hold latency_lock)
+static void latency_summarize(const unsigned long long *totals, int type, int window, LatencySummary *summary) {
+    unsigned long long counts[LATENCY_BUCKETS];
+    int nslices = window_slices[window] < slice_count ? window_slices[window] : slice_count;
+
+    memset(summary, 0, sizeof(LatencySummary));
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        counts[b] = totals[b] - slice_start[type][b];
+        for (int k = 0; k < nslices; k++) {
+            counts[b] += slices[(slice_head - k + LATENCY_SLICES) % LATENCY_SLICES][type][b];
+        }
+        summary->count += counts[b];
+    }
+    if (summary->count == 0) {
+        return;
+    }
+
+    unsigned long long *fields[] = { &summary->p50, &summary->p90, &summary->p99, &summary->p999 };
+    unsigned long long seen = 0;
+    int q = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        if (counts[b] == 0) {
+            continue;
+        }
+        seen += counts[b];
+        while (q < 4 && seen >= quantiles[q] * summary->count) {
+            *fields[q++] = latency_bucket_high(b);
+        }
+        summary->max = latency_bucket_high(b);
+    }
+}
+
+// Function to log every frame type's percentiles over every window
+void latency_dump(void) {
+    unsigned long long totals[LATENCY_BUCKETS];
+
+    log_write(LOG_INFO, "Command latency, decode to last queued frame (us): type window count p50 p90 p99 p999 max");
+    pthread_mutex_lock(&latency_lock);
+    for (int type = 0; type < METRICS_MSG_TYPES; type++) {
+        latency_totals(type, totals);
+        for (int w = 0; w < LATENCY_WINDOWS; w++) {
+            LatencySummary s;
+            latency_summarize(totals, type, w, &s);
+            if (s.count > 0) {
+                log_write(LOG_INFO, "  %-24s %-3s %8llu %9.1f %9.1f %9.1f %9.1f %9.1f", msg_type_str[type], window_names[w],
+                          s.count, s.p50 / 1e3, s.p90 / 1e3, s.p99 / 1e3, s.p999 / 1e3, s.max / 1e3);
+            }
+        }
+    }
+    pthread_mutex_unlock(&latency_lock);
+}
+
+// Function to write every frame type's percentiles into a metrics scrape
+void latency_write_metrics(FILE *out) {
+    unsigned long long totals[LATENCY_BUCKETS];
+
+    fprintf(out, "# HELP chat_command_latency_seconds Time from decoding a frame to queueing the last frame it produced.\n"
+                 "# TYPE chat_command_latency_seconds gauge\n");
+    pthread_mutex_lock(&latency_lock);
+    for (int type = 0; type < METRICS_MSG_TYPES; type++) {
+        latency_totals(type, totals);
+        for (int w = 0; w < LATENCY_WINDOWS; w++) {
+            LatencySummary s;
+            latency_summarize(totals, type, w, &s);
+            if (s.count == 0) {
+                continue;
+            }
+            unsigned long long values[] = { s.p50, s.p90, s.p99, s.p999 };
+            for (int q = 0; q < 4; q++) {
+                fprintf(out, "chat_command_latency_seconds{type=\"%s\",window=\"%s\",quantile=\"%s\"} %.9f\n",
+                        msg_type_str[type], window_names[w], quantile_names[q], values[q] / 1e9);
+            }
+            fprintf(out, "chat_command_latency_count{type=\"%s\",window=\"%s\"} %llu\n", msg_type_str[type], window_names[w], s.count);
+        }
+    }
+    pthread_mutex_unlock(&latency_lock);
+}
+
+// Function run by the sampler thread: closes a slice every LATENCY_SLICE_SEC and answers dump signals
+static void *latency_sampler(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, LATENCY_DUMP_SIGNAL);
+    long long next_slice = latency_now_ns() + LATENCY_SLICE_SEC * 1000000000LL;
+
+    while (1) {
+        long long wait = next_slice - latency_now_ns();
+        if (wait > 0) {
+            struct timespec ts = { .tv_sec = wait / 1000000000LL, .tv_nsec = wait % 1000000000LL };
+            if (sigtimedwait(&set, NULL, &ts) == LATENCY_DUMP_SIGNAL) {
+                latency_dump();
+            }
+            continue;
+        }
+        latency_rotate();
+        next_slice += LATENCY_SLICE_SEC * 1000000000LL;
+    }
+    return NULL;
+}
+
+// Function to start the sampler thread
+// Blocks LATENCY_DUMP_SIGNAL in the calling thread, so call it before any other thread starts
+int latency_start(void) {
+    slice_start = calloc(METRICS_MSG_TYPES, sizeof(*slice_start));
+    slices = calloc(LATENCY_SLICES, sizeof(*slices));
+    if (slice_start == NULL || slices == NULL) {
+        log_perror("calloc");
+        return -1;
+    }
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, LATENCY_DUMP_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if (pthread_create(&latency_thread, NULL, latency_sampler, NULL) != 0) {
+        log_perror("pthread_create");
+        return -1;
+    }
+    pthread_detach(latency_thread);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+#include "metrics.h"
+
+// Command latency histograms
+// Every frame type gets a log-linear histogram (HDR style) of the time from
+// the frame being decoded to the last frame it produced being queued. Each
+// power of two is split into LATENCY_SUB_BUCKETS linear steps, so a recorded
+// value is never off by more than 1/LATENCY_SUB_BUCKETS. Event loops count
+// into per-thread blocks; a sampler thread folds them into LATENCY_SLICE_SEC
+// slices, and percentiles are read over the last LATENCY_WINDOWS.
+
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 36              // Values are capped at 2^36 ns (about 68 s)
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+#define LATENCY_SLICE_SEC 10             // Resolution of the sliding windows
+#define LATENCY_SLICES 30                // Slices kept: the longest window
+#define LATENCY_DUMP_SIGNAL SIGUSR1      // Logs every percentile when received
+
+// Counts of one thread, only that thread writes them
+typedef struct LatencyBlock {
+    atomic_ullong counts[METRICS_MSG_TYPES][LATENCY_BUCKETS];
+} LatencyBlock;
+
+// Percentiles of one frame type over one window, in nanoseconds
+typedef struct LatencySummary {
+    unsigned long long count;
+    unsigned long long p50, p90, p99, p999, max;
+} LatencySummary;
+
+extern __thread LatencyBlock *thread_latency;
+
+// Function to read the monotonic clock in nanoseconds
+static inline long long latency_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int latency_bucket(unsigned long long ns);
+unsigned long long latency_bucket_high(int bucket);
+void latency_register_thread(void);
+void latency_record(int type, long long since_ns);
+int latency_start(void);
+void latency_dump(void);
+void latency_write_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+
+// One line waiting in the ring
+// seq == position: free for the producer of that position
+// seq == position + 1: written, waiting for the writer thread
+typedef struct LogRecord {
+    atomic_size_t seq;
+    long long ts_ns;             // Wall-clock time the line was logged
+    int level;
+    int thread;
+    char text[LOG_TEXT_LEN];
+} LogRecord;
+
+static const char *level_names[] = { "trace", "debug", "info", "warn", "error" };
+
+enum log_level log_min_level = LOG_INFO;
+static enum log_format log_format = LOG_TEXT;
+
+static LogRecord *log_ring = NULL;
+static atomic_size_t log_tail;   // Next position handed to a producer
+static size_t log_head = 0;      // Next position read by the writer thread
+static atomic_ulong log_dropped;
+static atomic_int log_stop;
+static int log_running = 0;
+static pthread_t log_thread;
+
+static __thread int log_thread_id = 0;
+
+// Function to get the wall-clock time in nanoseconds
+static long long log_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Function to write a string as the body of a JSON string
+static void log_json_escape(FILE *out, const char *text) {
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', out);
+            fputc(*p, out);
+        } else if (*p == '\n') {
+            fputs("\\n", out);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+}
+
+// Function to write one line in the configured format
+static void log_emit(long long ts_ns, int level, int thread, const char *text) {
+    if (log_format == LOG_JSON) {
+        fprintf(stdout, "{\"ts\":%lld.%06lld,\"level\":\"%s\",\"thread\":%d,\"msg\":\"",
+                ts_ns / 1000000000LL, (ts_ns % 1000000000LL) / 1000, level_names[level], thread);
+        log_json_escape(stdout, text);
+        fputs("\"}\n", stdout);
+        return;
+    }
+
+    if (level >= LOG_WARN) {
+        fprintf(stderr, "[%s] %s\n", level == LOG_ERROR ? "Error" : "Warning", text);
+    } else {
+        fprintf(stdout, "%s\n", text);
+    }
+}
+
+// Function to write out every line in the ring, returns how many there were
+static size_t log_drain(void) {
+    size_t lines = 0;
+    while (1) {
+        LogRecord *rec = &log_ring[log_head & (LOG_RING_SIZE - 1)];
+        if (atomic_load_explicit(&rec->seq, memory_order_acquire) != log_head + 1) {
+            break;
+        }
+        log_emit(rec->ts_ns, rec->level, rec->thread, rec->text);
+        atomic_store_explicit(&rec->seq, log_head + LOG_RING_SIZE, memory_order_release);
+        log_head++;
+        lines++;
+    }
+
+    unsigned long dropped = atomic_exchange_explicit(&log_dropped, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        char text[64];
+        snprintf(text, sizeof(text), "%lu log lines dropped, the log ring was full", dropped);
+        log_emit(log_now_ns(), LOG_WARN, -1, text);
+    }
+    if (lines > 0 || dropped > 0) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return lines;
+}
+
+// Function run by the writer thread
+static void *log_writer(void *arg) {
+    (void)arg;
+    while (!atomic_load_explicit(&log_stop, memory_order_acquire)) {
+        if (log_drain() == 0) {
+            usleep(LOG_IDLE_US);
+        }
+    }
+    log_drain();
+    return NULL;
+}
+
+// Function to start the writer thread; lines logged before this are written directly
+int log_init(enum log_level level, enum log_format format) {
+    log_min_level = level;
+    log_format = format;
+
+    log_ring = calloc(LOG_RING_SIZE, sizeof(LogRecord));
+    if (log_ring == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&log_ring[i].seq, i);
+    }
+    atomic_init(&log_tail, 0);
+    atomic_init(&log_dropped, 0);
+    atomic_init(&log_stop, 0);
+
+    if (pthread_create(&log_thread, NULL, log_writer, NULL) != 0) {
+        perror("pthread_create");
+        free(log_ring);
+        log_ring = NULL;
+        return -1;
+    }
+    log_running = 1;
+    atexit(log_shutdown);
+    return 0;
+}
+
+// Function to write out the remaining lines and stop the writer thread
+void log_shutdown(void) {
+    if (!log_running) {
+        return;
+    }
+    log_running = 0;
+    atomic_store_explicit(&log_stop, 1, memory_order_release);
+    pthread_join(log_thread, NULL);
+}
+
+// Function to name the calling thread in log lines (worker number)
+void log_set_thread(int id) {
+    log_thread_id = id;
+}
+
+// Function to read a level name
+int log_parse_level(const char *name, enum log_level *level) {
+    for (int i = LOG_TRACE; i <= LOG_ERROR; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            *level = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Function to read an output format name
+int log_parse_format(const char *name, enum log_format *format) {
+    if (strcasecmp(name, "text") == 0) {
+        *format = LOG_TEXT;
+    } else if (strcasecmp(name, "json") == 0) {
+        *format = LOG_JSON;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to queue one formatted line
+static void log_vwrite(enum log_level level, const char *fmt, va_list ap) {
+    if (!log_running) {
+        char text[LOG_TEXT_LEN];
+        vsnprintf(text, sizeof(text), fmt, ap);
+        log_emit(log_now_ns(), level, log_thread_id, text);
+        return;
+    }
+
+    // Claim a free slot, or drop the line if the writer is a whole ring behind
+    size_t pos = atomic_load_explicit(&log_tail, memory_order_relaxed);
+    LogRecord *rec;
+    while (1) {
+        rec = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&log_tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if ((long)(seq - pos) < 0) {
+            atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&log_tail, memory_order_relaxed);
+        }
+    }
+
+    rec->ts_ns = log_now_ns();
+    rec->level = level;
+    rec->thread = log_thread_id;
+    vsnprintf(rec->text, LOG_TEXT_LEN, fmt, ap);
+    atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+}
+
+// Function to log one line (use the log_* macros, they skip disabled levels)
+void log_write(enum log_level level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, fmt, ap);
+    va_end(ap);
+}
+
+// Function to log one line unless its call site already logged per_sec lines this second
+// The next line that gets through reports how many were held back
+void log_rated(LogRate *rate, int per_sec, enum log_level level, const char *fmt, ...) {
+    long long now = time(NULL);
+    long long window = atomic_load_explicit(&rate->window, memory_order_relaxed);
+    if (window != now &&
+        atomic_compare_exchange_strong_explicit(&rate->window, &window, now,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        atomic_store_explicit(&rate->count, 0, memory_order_relaxed);
+    }
+    if (atomic_fetch_add_explicit(&rate->count, 1, memory_order_relaxed) >= per_sec) {
+        atomic_fetch_add_explicit(&rate->suppressed, 1, memory_order_relaxed);
+        return;
+    }
+
+    char text[LOG_TEXT_LEN];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    int suppressed = atomic_exchange_explicit(&rate->suppressed, 0, memory_order_relaxed);
+    if (suppressed > 0) {
+        log_write(level, "%s (%d similar lines suppressed)", text, suppressed);
+    } else {
+        log_write(level, "%s", text);
+    }
+}
+
+// Function to log the current errno like perror() does
+void log_perror(const char *what) {
+    int err = errno;
+    log_error("%s: %s", what, strerror(err));
+}
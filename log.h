@@ -0,0 +1,67 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+
+// Asynchronous server log
+// Callers format a line into a slot of a lock-free ring and return; a background
+// thread writes the lines out, so a slow terminal or pipe never stalls an event
+// loop. When the ring is full, lines are dropped and counted instead of waiting.
+// Levels below the configured one cost a single compare at the call site.
+
+#define LOG_RING_SIZE 4096       // Lines the ring can hold (power of two)
+#define LOG_TEXT_LEN 232         // Longest line kept, longer ones are cut
+#define LOG_IDLE_US 5000         // Writer sleep when the ring is empty
+
+enum log_level {
+    LOG_TRACE,                   // Per-recipient events of a fan-out
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+};
+
+enum log_format {
+    LOG_TEXT,                    // Plain lines, warnings and errors on stderr
+    LOG_JSON                     // One JSON object per line on stdout
+};
+
+// Per call site state of a rate-limited log line
+typedef struct LogRate {
+    atomic_llong window;         // Second the count applies to
+    atomic_int count;            // Lines logged in that second
+    atomic_int suppressed;       // Lines dropped since the last one logged
+} LogRate;
+
+extern enum log_level log_min_level;
+
+int log_init(enum log_level level, enum log_format format);
+void log_shutdown(void);
+void log_set_thread(int id);
+int log_parse_level(const char *name, enum log_level *level);
+int log_parse_format(const char *name, enum log_format *format);
+void log_write(enum log_level level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_rated(LogRate *rate, int per_sec, enum log_level level, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+void log_perror(const char *what);
+
+#define log_at(level, ...) do { \
+        if ((level) >= log_min_level) { \
+            log_write((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define log_trace(...) log_at(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+
+// At most per_sec lines per second from this call site, the rest are counted
+#define log_every(per_sec, level, ...) do { \
+        static LogRate log_rate_; \
+        if ((level) >= log_min_level) { \
+            log_rated(&log_rate_, (per_sec), (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,485 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "log.h"
+#include "mailbox.h"
+
+// Largest mailbox file: the text plus the time, sender and length of every message
+#define MAILBOX_MAX_FILE (MAILBOX_MAX_BYTES + MAILBOX_MAX_MESSAGES * (3 * CAPTURE_VARINT64_MAX + NICK_LEN))
+
+int mailbox_persistent = 0;
+
+// Mail waiting for one nickname; freed once it is empty and its file is gone
+typedef struct Mailbox {
+    char name[NICK_LEN];      // Lower case, also the file name
+    MailEntry *head;          // Oldest first
+    MailEntry *tail;
+    int count;
+    size_t bytes;
+    int rewrite;              // The file holds messages that are gone and must be rewritten
+    int dirty;                // Listed for the writer
+    struct Mailbox *dirty_next;
+    struct Mailbox *hash_next;
+} Mailbox;
+
+static char mailbox_dir[PATH_MAX - NICK_LEN - 16]; // <data_dir>/mailbox, leaves room for the file names
+static Mailbox *mailbox_table[MAILBOX_BUCKETS];
+static int mailbox_boxes = 0;                      // Mailboxes holding messages
+static Mailbox *dirty_head = NULL;
+static int mailbox_stopping = 0;
+static pthread_mutex_t mailbox_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mailbox_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t mailbox_thread;
+
+// Writer only: one whole mailbox file
+static uint8_t *write_buf = NULL;
+
+// Function to read the wall clock in milliseconds
+static long long mailbox_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// Function to hash a lower case nickname (FNV-1a)
+static uint32_t mailbox_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash;
+}
+
+// Function to lower a nickname into key, returns -1 if it is not a valid nickname
+// Only valid nicknames get a mailbox, so they are safe as file names
+static int mailbox_key(char *key, const char *nickname) {
+    size_t len = strnlen(nickname, NICK_LEN);
+    if (len < 1 || len >= NICK_LEN || strcasecmp(nickname, "Server") == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)nickname[i])) {
+            return -1;
+        }
+        key[i] = tolower((unsigned char)nickname[i]);
+    }
+    key[len] = '\0';
+    return 0;
+}
+
+// Function to find the mailbox of a key (callers hold mailbox_lock), creating it if asked
+static Mailbox *mailbox_find(const char *key, int create) {
+    uint32_t bucket = mailbox_hash(key) & (MAILBOX_BUCKETS - 1);
+    Mailbox *box = mailbox_table[bucket];
+    while (box != NULL && strcmp(box->name, key) != 0) {
+        box = box->hash_next;
+    }
+    if (box == NULL && create) {
+        box = calloc(1, sizeof(Mailbox));
+        if (box == NULL) {
+            log_perror("calloc");
+            return NULL;
+        }
+        strcpy(box->name, key);
+        box->hash_next = mailbox_table[bucket];
+        mailbox_table[bucket] = box;
+    }
+    return box;
+}
+
+// Function to free a mailbox once it is empty and the writer has nothing left to do with it (callers hold mailbox_lock)
+// With -d only the writer calls it, as it uses a mailbox it is flushing without the lock
+static void mailbox_release(Mailbox *box) {
+    if (box->head != NULL || box->dirty) {
+        return;
+    }
+    Mailbox **link = &mailbox_table[mailbox_hash(box->name) & (MAILBOX_BUCKETS - 1)];
+    while (*link != box) {
+        link = &(*link)->hash_next;
+    }
+    *link = box->hash_next;
+    free(box);
+}
+
+// Function to list a mailbox for the writer (callers hold mailbox_lock)
+static void mailbox_touch(Mailbox *box) {
+    if (mailbox_persistent && !box->dirty) {
+        box->dirty = 1;
+        box->dirty_next = dirty_head;
+        dirty_head = box;
+    }
+}
+
+// Function to let go of a mailbox left empty (callers hold mailbox_lock)
+// It is freed at once, or with -d by the writer once it has removed the file
+static void mailbox_forget(Mailbox *box) {
+    if (box->head != NULL) {
+        return;
+    }
+    if (mailbox_persistent) {
+        box->rewrite = 1;
+        mailbox_touch(box);
+    } else {
+        mailbox_release(box);
+    }
+}
+
+// Function to append a message to a mailbox (callers hold mailbox_lock)
+static int mailbox_push(Mailbox *box, long long time_ms, const char *sender, const char *text, size_t len, int written) {
+    MailEntry *entry = malloc(sizeof(MailEntry) + len);
+    if (entry == NULL) {
+        log_perror("malloc");
+        return -1;
+    }
+    entry->time_ms = time_ms;
+    snprintf(entry->sender, NICK_LEN, "%s", sender);
+    entry->len = len;
+    entry->written = written;
+    entry->next = NULL;
+    memcpy(entry->text, text, len);
+
+    if (box->head == NULL) {
+        box->head = entry;
+        mailbox_boxes++;
+    } else {
+        box->tail->next = entry;
+    }
+    box->tail = entry;
+    box->count++;
+    box->bytes += len;
+    return 0;
+}
+
+// Function to drop the messages of a mailbox older than MAILBOX_TTL_S (callers hold mailbox_lock)
+static void mailbox_expire(Mailbox *box, long long now_ms) {
+    int expired = 0;
+    while (box->head != NULL && now_ms - box->head->time_ms > MAILBOX_TTL_S * 1000LL) {
+        MailEntry *entry = box->head;
+        box->head = entry->next;
+        box->count--;
+        box->bytes -= entry->len;
+        expired |= entry->written;
+        free(entry);
+    }
+    if (box->head == NULL) {
+        if (box->tail != NULL) {
+            mailbox_boxes--;
+        }
+        box->tail = NULL;
+    }
+    if (expired) {
+        box->rewrite = 1;
+        mailbox_touch(box);
+    }
+}
+
+// Function to keep a private message for a nickname nobody is using
+// Returns 0 once queued, -1 if the nickname is invalid or the mailbox is full
+// The limits are checked before a mailbox is created, so refused messages allocate nothing
+int mailbox_put(const char *nickname, const char *sender, const char *text, size_t len) {
+    char key[NICK_LEN];
+    if (mailbox_key(key, nickname) < 0 || len > MAILBOX_MAX_BYTES) {
+        return -1;
+    }
+    long long now_ms = mailbox_now_ms();
+
+    pthread_mutex_lock(&mailbox_lock);
+    int ret = -1;
+    Mailbox *box = mailbox_find(key, 0);
+    if (box != NULL) {
+        mailbox_expire(box, now_ms);
+    }
+    int fits = box != NULL && box->head != NULL
+        ? box->count < MAILBOX_MAX_MESSAGES && box->bytes + len <= MAILBOX_MAX_BYTES
+        : mailbox_boxes < MAILBOX_MAX_BOXES;
+    if (fits && box == NULL) {
+        box = mailbox_find(key, 1);
+    }
+    if (fits && box != NULL) {
+        ret = mailbox_push(box, now_ms, sender, text, len, 0);
+        if (ret == 0) {
+            mailbox_touch(box);
+        }
+    }
+    if (box != NULL) {
+        mailbox_forget(box);
+    }
+    pthread_mutex_unlock(&mailbox_lock);
+    return ret;
+}
+
+// Function to hand over and empty the mailbox of a nickname
+// The messages are detached under the lock and emitted after it; returns how many there were
+int mailbox_take(const char *nickname, mailbox_emit emit, void *ctx) {
+    char key[NICK_LEN];
+    if (mailbox_key(key, nickname) < 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&mailbox_lock);
+    MailEntry *entries = NULL;
+    Mailbox *box = mailbox_find(key, 0);
+    if (box != NULL) {
+        mailbox_expire(box, mailbox_now_ms());
+        entries = box->head;
+        if (entries != NULL) {
+            mailbox_boxes--;
+            box->rewrite = 1;
+            mailbox_touch(box);
+        }
+        box->head = NULL;
+        box->tail = NULL;
+        box->count = 0;
+        box->bytes = 0;
+        mailbox_forget(box);
+    }
+    pthread_mutex_unlock(&mailbox_lock);
+
+    int count = 0;
+    while (entries != NULL) {
+        MailEntry *next = entries->next;
+        emit(ctx, entries->time_ms, entries->sender, entries->text, entries->len);
+        free(entries);
+        entries = next;
+        count++;
+    }
+    return count;
+}
+
+// Function to encode the messages of a mailbox into write_buf (callers hold mailbox_lock)
+// Encodes all of them when rewriting, else only those not written yet
+static size_t mailbox_encode(Mailbox *box, int all) {
+    size_t used = 0;
+    for (MailEntry *entry = box->head; entry != NULL; entry = entry->next) {
+        if (entry->written && !all) {
+            continue;
+        }
+        size_t sender_len = strlen(entry->sender);
+        used += capture_put_varint64(write_buf + used, (uint64_t)entry->time_ms);
+        used += capture_put_varint64(write_buf + used, sender_len);
+        memcpy(write_buf + used, entry->sender, sender_len);
+        used += sender_len;
+        used += capture_put_varint64(write_buf + used, entry->len);
+        memcpy(write_buf + used, entry->text, entry->len);
+        used += entry->len;
+        entry->written = 1;
+    }
+    return used;
+}
+
+// Function to bring the file of one mailbox up to date
+// Appends new messages, or rewrites the file through a temporary one (removes it once empty)
+static void mailbox_flush(Mailbox *box) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.box", mailbox_dir, box->name);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", mailbox_dir, box->name);
+
+    pthread_mutex_lock(&mailbox_lock);
+    box->dirty = 0;
+    int rewrite = box->rewrite;
+    box->rewrite = 0;
+    int empty = box->head == NULL;
+    size_t used = mailbox_encode(box, rewrite);
+    pthread_mutex_unlock(&mailbox_lock);
+
+    if (rewrite && empty) {
+        // Once the file is gone, a mailbox still empty and not listed again is freed
+        int failed = unlink(path) < 0 && errno != ENOENT;
+        if (failed) {
+            log_perror("mailbox unlink");
+        }
+        pthread_mutex_lock(&mailbox_lock);
+        if (failed) {
+            box->rewrite = 1;
+            mailbox_touch(box);
+        }
+        mailbox_release(box);
+        pthread_mutex_unlock(&mailbox_lock);
+        return;
+    }
+    if (used == 0 && !rewrite) {
+        return;
+    }
+    FILE *file = fopen(rewrite ? tmp_path : path, rewrite ? "wb" : "ab");
+    int failed = file == NULL;
+    if (!failed) {
+        failed = fwrite(write_buf, 1, used, file) != used;
+        failed |= fclose(file) != 0;
+    }
+    if (!failed && rewrite) {
+        failed = rename(tmp_path, path) < 0;
+    }
+    if (failed) {
+        // Try again with the whole mailbox on the next pass
+        log_perror("mailbox write");
+        pthread_mutex_lock(&mailbox_lock);
+        box->rewrite = 1;
+        mailbox_touch(box);
+        pthread_mutex_unlock(&mailbox_lock);
+    }
+}
+
+// Function run by the writer thread: every MAILBOX_FLUSH_MS, writes out the mailboxes that changed
+static void *mailbox_writer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&mailbox_lock);
+    while (1) {
+        if (!mailbox_stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += MAILBOX_FLUSH_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&mailbox_wake, &mailbox_lock, &deadline);
+        }
+        int stopping = mailbox_stopping;
+        Mailbox *box = dirty_head;
+        dirty_head = NULL;
+        pthread_mutex_unlock(&mailbox_lock);
+
+        // A mailbox can be listed again as soon as its dirty flag is cleared, so its link is read first
+        while (box != NULL) {
+            Mailbox *next = box->dirty_next;
+            mailbox_flush(box);
+            box = next;
+        }
+        if (stopping) {
+            return NULL;
+        }
+        pthread_mutex_lock(&mailbox_lock);
+    }
+}
+
+// Function to read back the mailbox file of one nickname, dropping expired messages
+// A record cut short by a crash ends the file
+static void mailbox_load(const char *key, long long now_ms) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.box", mailbox_dir, key);
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        log_perror("mailbox read");
+        return;
+    }
+    size_t size = fread(write_buf, 1, MAILBOX_MAX_FILE, file);
+    fclose(file);
+
+    Mailbox *box = mailbox_find(key, 1);
+    if (box == NULL) {
+        return;
+    }
+    size_t at = 0;
+    int kept = 0;
+    int skipped = 0;
+    while (at < size) {
+        uint64_t time_ms, sender_len, len;
+        size_t used;
+        char sender[NICK_LEN];
+        if (capture_get_varint64(write_buf + at, size - at, &time_ms, &used) != 1) {
+            break;
+        }
+        at += used;
+        if (capture_get_varint64(write_buf + at, size - at, &sender_len, &used) != 1 ||
+            sender_len >= NICK_LEN || sender_len > size - at - used) {
+            break;
+        }
+        at += used;
+        memcpy(sender, write_buf + at, sender_len);
+        sender[sender_len] = '\0';
+        at += sender_len;
+        if (capture_get_varint64(write_buf + at, size - at, &len, &used) != 1 ||
+            len > MAILBOX_MAX_BYTES || len > size - at - used) {
+            break;
+        }
+        at += used;
+        if (now_ms - (long long)time_ms > MAILBOX_TTL_S * 1000LL || box->count >= MAILBOX_MAX_MESSAGES ||
+            box->bytes + len > MAILBOX_MAX_BYTES || mailbox_push(box, time_ms, sender, (const char *)write_buf + at, len, 1) < 0) {
+            skipped++;
+        } else {
+            kept++;
+        }
+        at += len;
+    }
+    if (skipped > 0 || at < size) {
+        box->rewrite = 1;
+        mailbox_touch(box);
+    }
+    mailbox_forget(box);
+    if (kept > 0) {
+        log_debug("%d queued messages for %s read back.", kept, key);
+    }
+}
+
+// Function to keep mailboxes under <data_dir>/mailbox, read back what is there and start the writer thread
+int mailbox_start(const char *data_dir) {
+    if (snprintf(mailbox_dir, sizeof(mailbox_dir), "%s/mailbox", data_dir) >= (int)sizeof(mailbox_dir)) {
+        log_error("The data directory path is too long.");
+        return -1;
+    }
+    if ((mkdir(data_dir, 0755) < 0 && errno != EEXIST) || (mkdir(mailbox_dir, 0755) < 0 && errno != EEXIST)) {
+        log_perror("mkdir");
+        return -1;
+    }
+    write_buf = malloc(MAILBOX_MAX_FILE);
+    DIR *dir = opendir(mailbox_dir);
+    if (write_buf == NULL || dir == NULL) {
+        log_perror("mailbox");
+        if (dir != NULL) {
+            closedir(dir);
+        }
+        return -1;
+    }
+
+    mailbox_persistent = 1;
+    long long now_ms = mailbox_now_ms();
+    struct dirent *entry;
+    pthread_mutex_lock(&mailbox_lock);
+    while ((entry = readdir(dir)) != NULL) {
+        char name[NICK_LEN];
+        char key[NICK_LEN];
+        char *dot = strrchr(entry->d_name, '.');
+        if (dot == NULL || strcmp(dot, ".box") != 0 || dot - entry->d_name >= NICK_LEN) {
+            continue;
+        }
+        memcpy(name, entry->d_name, dot - entry->d_name);
+        name[dot - entry->d_name] = '\0';
+        if (mailbox_key(key, name) == 0 && strcmp(key, name) == 0) {
+            mailbox_load(key, now_ms);
+        }
+    }
+    int boxes = mailbox_boxes;
+    pthread_mutex_unlock(&mailbox_lock);
+    closedir(dir);
+
+    if (pthread_create(&mailbox_thread, NULL, mailbox_writer, NULL) != 0) {
+        log_perror("pthread_create");
+        mailbox_persistent = 0;
+        return -1;
+    }
+    atexit(mailbox_stop);
+    log_info("Keeping offline mailboxes in %s, %d with messages waiting.", mailbox_dir, boxes);
+    return 0;
+}
+
+// Function to write out what is left
+void mailbox_stop(void) {
+    if (!mailbox_persistent) {
+        return;
+    }
+    pthread_mutex_lock(&mailbox_lock);
+    mailbox_stopping = 1;
+    pthread_cond_signal(&mailbox_wake);
+    pthread_mutex_unlock(&mailbox_lock);
+    pthread_join(mailbox_thread, NULL);
+    mailbox_persistent = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h>
+#include "msg_struct.h"
+
+// Offline mailboxes
+// A private message to a nickname nobody is using is kept in that nickname's
+// mailbox, and the sender gets UNICAST_QUEUED instead of UNICAST_ERROR. The
+// mailbox is handed over in one burst as soon as someone logs in, or renames
+// themselves, with that nickname. Nicknames are matched ignoring case, as logins
+// are. A mailbox holds at most MAILBOX_MAX_MESSAGES messages and
+// MAILBOX_MAX_BYTES of text, and at most MAILBOX_MAX_BOXES nicknames have
+// mail waiting; past that, messages are refused. Messages older than
+// MAILBOX_TTL_S are dropped.
+//
+// Mailboxes live in memory. With -d, a writer thread also appends new messages
+// to <data_dir>/mailbox/<nickname>.box every MAILBOX_FLUSH_MS, and rewrites or
+// removes the file once messages were handed over or expired; a restarted server
+// reads the files back. Event loops never touch the disk. Each file holds records of
+//
+//     varint  time_ms     wall clock when the message was queued
+//     varint  sender_len
+//     sender              nickname of the sender at that time
+//     varint  len
+//     text
+
+#define MAILBOX_MAX_MESSAGES 256           // Messages waiting per nickname
+#define MAILBOX_MAX_BYTES (64 << 10)       // Text waiting per nickname
+#define MAILBOX_MAX_BOXES 4096             // Nicknames with messages waiting
+#define MAILBOX_TTL_S (7 * 24 * 3600)      // Age at which a waiting message is dropped
+#define MAILBOX_FLUSH_MS 100               // Writer period; at most this much is lost if the server is killed
+#define MAILBOX_BUCKETS 1024               // Buckets of the nickname table
+
+typedef struct MailEntry {
+    long long time_ms;
+    char sender[NICK_LEN];
+    size_t len;
+    int written;              // Already in the mailbox file
+    struct MailEntry *next;
+    char text[];
+} MailEntry;
+
+// Called for every message a mailbox hands over, oldest first
+typedef void (*mailbox_emit)(void *ctx, long long time_ms, const char *sender, const char *text, size_t len);
+
+extern int mailbox_persistent;
+
+int mailbox_start(const char *data_dir);
+void mailbox_stop(void);
+int mailbox_put(const char *nickname, const char *sender, const char *text, size_t len);
+int mailbox_take(const char *nickname, mailbox_emit emit, void *ctx);
+
+#endif
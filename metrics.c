@@ -0,0 +1,249 @@
+#include <netdb.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "log.h"
+#include "metrics.h"
+
+static const char *fanout_names[FANOUT_KINDS] = { "broadcast", "multicast" };
+
+static ThreadMetrics unregistered_metrics;
+static ThreadMetrics *metric_blocks[METRICS_MAX_THREADS];
+static int metric_block_count = 0;
+static pthread_mutex_t metric_blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int metrics_sfd = -1;
+static void (*metrics_collect)(FILE *out) = NULL;
+static pthread_t metrics_thread;
+
+__thread ThreadMetrics *thread_metrics = &unregistered_metrics;
+__thread int metrics_shared_writer = 1;
+
+// Function to give the calling thread its own counter block
+void metrics_register_thread(void) {
+    ThreadMetrics *block = aligned_alloc(64, sizeof(ThreadMetrics));
+    if (block == NULL) {
+        log_perror("aligned_alloc");
+        return;
+    }
+    memset(block, 0, sizeof(ThreadMetrics));
+
+    pthread_mutex_lock(&metric_blocks_lock);
+    if (metric_block_count < METRICS_MAX_THREADS) {
+        metric_blocks[metric_block_count++] = block;
+        thread_metrics = block;
+        metrics_shared_writer = 0;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&metric_blocks_lock);
+    free(block);
+}
+
+// Function to count one received frame, header included
+void metrics_frame_in(int type, size_t len) {
+    int slot = metrics_type(type);
+    metrics_add(&thread_metrics->frames_in[slot], 1);
+    metrics_add(&thread_metrics->bytes_in[slot], len);
+}
+
+// Function to count one frame queued for a client, header included
+void metrics_frame_out(int type, size_t len) {
+    int slot = metrics_type(type);
+    metrics_add(&thread_metrics->frames_out[slot], 1);
+    metrics_add(&thread_metrics->bytes_out[slot], len);
+}
+
+// Function to record the number of recipients of one broadcast or channel message
+void metrics_fanout(enum metrics_fanout kind, int recipients) {
+    int bucket = 0;
+    for (int limit = 1; bucket < METRICS_FANOUT_BUCKETS - 1 && recipients > limit; limit *= 4) {
+        bucket++;
+    }
+    metrics_add(&thread_metrics->fanout_count[kind], 1);
+    metrics_add(&thread_metrics->fanout_recipients[kind], recipients);
+    metrics_add(&thread_metrics->fanout_buckets[kind][bucket], 1);
+}
+
+// Function to read one counter summed over every thread (callers hold metric_blocks_lock)
+static unsigned long long metrics_sum(size_t offset) {
+    unsigned long long total = 0;
+    for (int i = -1; i < metric_block_count; i++) {
+        ThreadMetrics *block = i < 0 ? &unregistered_metrics : metric_blocks[i];
+        total += atomic_load_explicit((atomic_ullong *)((char *)block + offset), memory_order_relaxed);
+    }
+    return total;
+}
+
+#define METRICS_SUM(field) metrics_sum(offsetof(ThreadMetrics, field))
+
+// Function to read what is still waiting as the difference of two counters (callers hold metric_blocks_lock)
+// The sums are not one snapshot: with the removals read first, a removal that lands in between
+// can only make it larger, and anything below 0 left by blocks read at different times is clamped
+static double metrics_backlog(size_t added, size_t removed) {
+    unsigned long long out = metrics_sum(removed);
+    long long diff = (long long)(metrics_sum(added) - out);
+    return diff > 0 ? (double)diff : 0;
+}
+
+#define METRICS_BACKLOG(added, removed) metrics_backlog(offsetof(ThreadMetrics, added), offsetof(ThreadMetrics, removed))
+
+// Function to write one counter with its help line
+void metrics_counter(FILE *out, const char *name, const char *help, unsigned long long value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+}
+
+// Function to write one gauge with its help line
+void metrics_gauge(FILE *out, const char *name, const char *help, double value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n", name, help, name, name, value);
+}
+
+// Function to write a counter with one series per message type
+static void metrics_write_by_type(FILE *out, const char *name, const char *help, size_t offset) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (int type = 0; type < METRICS_MSG_TYPES; type++) {
+        fprintf(out, "%s{type=\"%s\"} %llu\n", name, msg_type_str[type],
+                metrics_sum(offset + type * sizeof(atomic_ullong)));
+    }
+}
+
+// Function to write everything the threads counted
+static void metrics_write_counters(FILE *out) {
+    pthread_mutex_lock(&metric_blocks_lock);
+    metrics_write_by_type(out, "chat_frames_in_total", "Frames received, by message type.", offsetof(ThreadMetrics, frames_in));
+    metrics_write_by_type(out, "chat_frame_bytes_in_total", "Bytes of received frames, by message type.", offsetof(ThreadMetrics, bytes_in));
+    metrics_write_by_type(out, "chat_frames_out_total", "Frames queued for clients, by message type.", offsetof(ThreadMetrics, frames_out));
+    metrics_write_by_type(out, "chat_frame_bytes_out_total", "Bytes of frames queued for clients, by message type.", offsetof(ThreadMetrics, bytes_out));
+
+    metrics_counter(out, "chat_socket_bytes_in_total", "Bytes read from client sockets.", METRICS_SUM(socket_bytes_in));
+    metrics_counter(out, "chat_socket_bytes_out_total", "Bytes written to client sockets.", METRICS_SUM(socket_bytes_out));
+    metrics_counter(out, "chat_connections_accepted_total", "Connections admitted.", METRICS_SUM(accepted));
+    metrics_counter(out, "chat_connections_refused_total", "Connections closed because too many sessions were logging in.", METRICS_SUM(refused));
+    metrics_counter(out, "chat_login_timeouts_total", "Sessions closed for not choosing a nickname in time.", METRICS_SUM(login_timeouts));
+    metrics_counter(out, "chat_send_errors_total", "Frames that could not be queued for a recipient.", METRICS_SUM(send_errors));
+    metrics_counter(out, "chat_write_errors_total", "Client sockets that failed while being written.", METRICS_SUM(write_errors));
+    metrics_gauge(out, "chat_sendq_bytes", "Bytes waiting in send queues.",
+                  METRICS_BACKLOG(queued_bytes, released_bytes));
+    metrics_gauge(out, "chat_sendq_frames", "Frames waiting in send queues (epoll and poll backends).",
+                  METRICS_BACKLOG(queued_frames, released_frames));
+
+    const char *name = "chat_fanout_recipients";
+    fprintf(out, "# HELP %s Recipients of each broadcast and channel message.\n# TYPE %s histogram\n", name, name);
+    for (int kind = 0; kind < FANOUT_KINDS; kind++) {
+        unsigned long long cumulative = 0;
+        int limit = 1;
+        for (int bucket = 0; bucket < METRICS_FANOUT_BUCKETS; bucket++, limit *= 4) {
+            cumulative += METRICS_SUM(fanout_buckets[kind][bucket]);
+            if (bucket < METRICS_FANOUT_BUCKETS - 1) {
+                fprintf(out, "%s_bucket{kind=\"%s\",le=\"%d\"} %llu\n", name, fanout_names[kind], limit, cumulative);
+            } else {
+                fprintf(out, "%s_bucket{kind=\"%s\",le=\"+Inf\"} %llu\n", name, fanout_names[kind], cumulative);
+            }
+        }
+        fprintf(out, "%s_sum{kind=\"%s\"} %llu\n", name, fanout_names[kind], METRICS_SUM(fanout_recipients[kind]));
+        fprintf(out, "%s_count{kind=\"%s\"} %llu\n", name, fanout_names[kind], METRICS_SUM(fanout_count[kind]));
+    }
+    pthread_mutex_unlock(&metric_blocks_lock);
+}
+
+// Function to answer one scrape of /metrics (or /), other paths get a 404
+static void metrics_serve(int cfd) {
+    char request[METRICS_REQUEST_LEN];
+    ssize_t n = recv(cfd, request, sizeof(request) - 1, 0);
+    if (n <= 0) {
+        return;
+    }
+    request[n] = '\0';
+
+    if (strncmp(request, "GET /metrics ", strlen("GET /metrics ")) != 0 && strncmp(request, "GET / ", strlen("GET / ")) != 0) {
+        const char *not_found = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send(cfd, not_found, strlen(not_found), MSG_NOSIGNAL);
+        return;
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (out == NULL) {
+        log_perror("open_memstream");
+        return;
+    }
+    metrics_write_counters(out);
+    if (metrics_collect != NULL) {
+        metrics_collect(out);
+    }
+    fclose(out);
+
+    char header[160];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+    send(cfd, header, header_len, MSG_NOSIGNAL);
+    for (size_t sent = 0; sent < body_len; ) {
+        ssize_t w = send(cfd, body + sent, body_len - sent, MSG_NOSIGNAL);
+        if (w <= 0) {
+            break;
+        }
+        sent += w;
+    }
+    free(body);
+}
+
+// Function run by the admin thread: one scrape at a time, away from the event loops
+static void *metrics_loop(void *arg) {
+    (void)arg;
+    while (1) {
+        int cfd = accept(metrics_sfd, NULL, NULL);
+        if (cfd < 0) {
+            continue;
+        }
+        struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+        setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        metrics_serve(cfd);
+        close(cfd);
+    }
+    return NULL;
+}
+
+// Function to start the admin listener on 127.0.0.1:port
+// collect() is called on every scrape to write the server's own gauges
+int metrics_start(const char *port, void (*collect)(FILE *out)) {
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", port, &hints, &result) != 0) {
+        log_error("Invalid metrics port %s.", port);
+        return -1;
+    }
+
+    int sfd = socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC, result->ai_protocol);
+    int opt = 1;
+    if (sfd == -1 || setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) != 0 ||
+        bind(sfd, result->ai_addr, result->ai_addrlen) != 0 || listen(sfd, SOMAXCONN) != 0) {
+        log_perror("metrics listener");
+        if (sfd != -1) {
+            close(sfd);
+        }
+        freeaddrinfo(result);
+        return -1;
+    }
+    freeaddrinfo(result);
+
+    metrics_sfd = sfd;
+    metrics_collect = collect;
+    if (pthread_create(&metrics_thread, NULL, metrics_loop, NULL) != 0) {
+        log_perror("pthread_create");
+        close(sfd);
+        metrics_sfd = -1;
+        return -1;
+    }
+    pthread_detach(metrics_thread);
+    log_info("Metrics served on http://127.0.0.1:%s/metrics", port);
+    return 0;
+}
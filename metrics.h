@@ -0,0 +1,74 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include "msg_struct.h"
+
+// Server metrics in the Prometheus text format
+// Every event-loop thread counts into its own block, so the hot path is a
+// plain load and store with no shared cache line and no lock. A scrape adds
+// the blocks up. Gauges that describe shared state (sessions, channels) are
+// read by a callback of the server when the scrape happens.
+
+#define METRICS_MSG_TYPES (UNICAST_QUEUED + 1)   // Counters per enum msg_type
+#define METRICS_MAX_THREADS 72             // Worker threads plus the main thread
+#define METRICS_FANOUT_BUCKETS 8           // Recipients <= 1, 4, 16 ... 4096, more
+#define METRICS_REQUEST_LEN 1024           // Bytes of the HTTP request read before answering
+
+enum metrics_fanout {
+    FANOUT_BROADCAST,            // handle_msgall()
+    FANOUT_MULTICAST,            // handle_multicast()
+    FANOUT_KINDS
+};
+
+// Counters of one thread, only that thread writes them
+typedef struct ThreadMetrics {
+    atomic_ullong frames_in[METRICS_MSG_TYPES];
+    atomic_ullong bytes_in[METRICS_MSG_TYPES];
+    atomic_ullong frames_out[METRICS_MSG_TYPES];
+    atomic_ullong bytes_out[METRICS_MSG_TYPES];
+    atomic_ullong socket_bytes_in;         // Bytes read from client sockets
+    atomic_ullong socket_bytes_out;        // Bytes written to client sockets
+    atomic_ullong accepted;                // Connections admitted
+    atomic_ullong refused;                 // Connections closed by admission control
+    atomic_ullong login_timeouts;          // Sessions closed for not logging in
+    atomic_ullong send_errors;             // Frames that could not be queued
+    atomic_ullong write_errors;            // Sockets that failed while being written
+    atomic_ullong queued_bytes;            // Bytes added to send queues...
+    atomic_ullong released_bytes;          // ...and written or dropped from them
+    atomic_ullong queued_frames;
+    atomic_ullong released_frames;
+    atomic_ullong fanout_count[FANOUT_KINDS];
+    atomic_ullong fanout_recipients[FANOUT_KINDS];
+    atomic_ullong fanout_buckets[FANOUT_KINDS][METRICS_FANOUT_BUCKETS];
+} __attribute__((aligned(64))) ThreadMetrics;
+
+// Counters of the calling thread; threads that never registered share one block
+extern __thread ThreadMetrics *thread_metrics;
+extern __thread int metrics_shared_writer;   // The thread writes a shared block (metrics or latency)
+
+// Function to add to a counter of the calling thread
+// Its own block has a single writer, so a load and a store do; the shared blocks need an atomic add
+static inline void metrics_add(atomic_ullong *counter, unsigned long long n) {
+    if (metrics_shared_writer) {
+        atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+        return;
+    }
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// Function to get the counter slot of a message type, unknown types share slot 0
+static inline int metrics_type(int type) {
+    return type >= 0 && type < METRICS_MSG_TYPES ? type : UNKNOWN_COMMAND;
+}
+
+void metrics_register_thread(void);
+void metrics_frame_in(int type, size_t len);
+void metrics_frame_out(int type, size_t len);
+void metrics_fanout(enum metrics_fanout kind, int recipients);
+void metrics_counter(FILE *out, const char *name, const char *help, unsigned long long value);
+void metrics_gauge(FILE *out, const char *name, const char *help, double value);
+int metrics_start(const char *port, void (*collect)(FILE *out));
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stdatomic.h>
+
+// Intrusive lock-free multi-producer / single-consumer queue (Vyukov)
+// Any thread may push; only the owning thread may pop.
+
+typedef struct MpscNode {
+    _Atomic(struct MpscNode *) next;
+} MpscNode;
+
+typedef struct MpscQueue {
+    _Atomic(MpscNode *) head;  // Producers swap themselves in here
+    MpscNode *tail;            // Consumer side
+    MpscNode stub;
+} MpscQueue;
+
+void mpsc_init(MpscQueue *q);
+void mpsc_push(MpscQueue *q, MpscNode *node);
+MpscNode *mpsc_pop(MpscQueue *q);
+
+#endif
@@ -43,7 +43,10 @@ enum msg_type {
 	RECEIVER_EXISTENCE_ERROR,
 	TRY_AGAIN_Y_N,
 	QUIT_REQUEST,
-	SERVER_QUIT
+	SERVER_QUIT,
+	USER_MAP,
+	MULTICAST_HISTORY,
+	UNICAST_QUEUED
 };
 
 struct message {
@@ -51,6 +54,7 @@ struct message {
 	char nick_sender[NICK_LEN];
 	enum msg_type type;
 	char infos[INFOS_LEN];
+	unsigned int uid; // User ID, not part of v1 frames
 };
 
 static char* msg_type_str[] = {
@@ -75,7 +79,7 @@ static char* msg_type_str[] = {
 	"MULTICAST_LIST",
 	"MULTICAST_JOIN",
 	"MULTICAST_JOIN_SUCCESS",
-	"MULTICAST_JOIN_NOTIF",
+	"MULTICAST_JOIN_ERROR",
 	"MULTICAST_SEND",
 	"MULTICAST_SEND_SUCCESS",
 	"MULTICAST_SEND_ERROR",
@@ -91,7 +95,10 @@ static char* msg_type_str[] = {
 	"RECEIVER_EXISTENCE_ERROR",
 	"TRY_AGAIN_Y_N",
 	"QUIT_REQUEST",
-	"SERVER_QUIT"
+	"SERVER_QUIT",
+	"USER_MAP",
+	"MULTICAST_HISTORY",
+	"UNICAST_QUEUED"
 };
 
 #endif
@@ -0,0 +1,128 @@
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "common.h"
+#include "log.h"
+#include "nick_index.h"
+
+// Function to hash a nickname case-insensitively (FNV-1a over lowercased bytes)
+uint32_t nick_hash(const char *nick) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)nick; *p != '\0'; p++) {
+        hash ^= (uint32_t)tolower(*p);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Function to rebuild the table with cap slots
+static int nick_index_resize(NickIndex *idx, size_t cap) {
+    NickSlot *slots = calloc(cap, sizeof(NickSlot));
+    if (slots == NULL) {
+        log_perror("calloc");
+        return -1;
+    }
+    for (size_t i = 0; i < idx->cap; i++) {
+        if (idx->slots[i].client == NULL) {
+            continue;
+        }
+        size_t pos = idx->slots[i].hash & (cap - 1);
+        while (slots[pos].client != NULL) {
+            pos = (pos + 1) & (cap - 1);
+        }
+        slots[pos] = idx->slots[i];
+    }
+    free(idx->slots);
+    idx->slots = slots;
+    idx->cap = cap;
+    return 0;
+}
+
+// Function to add a session under its current nickname
+// A session without a nickname is never indexed, so it cannot be left behind once freed
+int nick_index_insert(NickIndex *idx, struct ClientInfo *client) {
+    if (client->nickname[0] == '\0') {
+        return -1;
+    }
+    if ((idx->count + 1) * 2 > idx->cap) {
+        if (nick_index_resize(idx, idx->cap > 0 ? idx->cap * 2 : NICK_INDEX_INIT) < 0) {
+            return -1;
+        }
+    }
+
+    uint32_t hash = nick_hash(client->nickname);
+    size_t pos = hash & (idx->cap - 1);
+    while (idx->slots[pos].client != NULL) {
+        pos = (pos + 1) & (idx->cap - 1);
+    }
+    idx->slots[pos].client = client;
+    idx->slots[pos].hash = hash;
+    idx->count++;
+    return 0;
+}
+
+// Function to find the slot holding a session, or -1
+static long nick_index_slot(const NickIndex *idx, struct ClientInfo *client) {
+    if (idx->cap == 0) {
+        return -1;
+    }
+    size_t pos = nick_hash(client->nickname) & (idx->cap - 1);
+    while (idx->slots[pos].client != NULL) {
+        if (idx->slots[pos].client == client) {
+            return (long)pos;
+        }
+        pos = (pos + 1) & (idx->cap - 1);
+    }
+    return -1;
+}
+
+// Function to drop a session, call it before its nickname changes
+void nick_index_remove(NickIndex *idx, struct ClientInfo *client) {
+    long found = nick_index_slot(idx, client);
+    if (found < 0) {
+        return;
+    }
+
+    // Backward-shift deletion: pull later entries of the cluster into the hole
+    // unless their home slot lies cyclically after it
+    size_t mask = idx->cap - 1;
+    size_t hole = (size_t)found;
+    size_t pos = (hole + 1) & mask;
+    while (idx->slots[pos].client != NULL) {
+        size_t home = idx->slots[pos].hash & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            idx->slots[hole] = idx->slots[pos];
+            hole = pos;
+        }
+        pos = (pos + 1) & mask;
+    }
+    idx->slots[hole].client = NULL;
+    idx->count--;
+}
+
+// Function to find the session using a nickname, ignoring case
+struct ClientInfo *nick_index_find(const NickIndex *idx, const char *nick) {
+    if (idx->cap == 0) {
+        return NULL;
+    }
+    uint32_t hash = nick_hash(nick);
+    size_t pos = hash & (idx->cap - 1);
+    while (idx->slots[pos].client != NULL) {
+        if (idx->slots[pos].hash == hash && strcasecmp(idx->slots[pos].client->nickname, nick) == 0) {
+            return idx->slots[pos].client;
+        }
+        pos = (pos + 1) & (idx->cap - 1);
+    }
+    return NULL;
+}
+
+// Function to release the table
+void nick_index_free(NickIndex *idx) {
+    free(idx->slots);
+    idx->slots = NULL;
+    idx->cap = 0;
+    idx->count = 0;
+}
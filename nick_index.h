@@ -0,0 +1,33 @@
+#ifndef NICK_INDEX_H
+#define NICK_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Open-addressing hash index of sessions by nickname (linear probing)
+// Keys are case-folded, matching the case-insensitive uniqueness rule for
+// nicknames, so one probe sequence answers both "is it taken?" and "who is it?".
+// Removal shifts the following entries back instead of leaving tombstones.
+
+struct ClientInfo;
+
+typedef struct NickSlot {
+    struct ClientInfo *client;  // NULL when the slot is free
+    uint32_t hash;
+} NickSlot;
+
+typedef struct NickIndex {
+    NickSlot *slots;
+    size_t cap;                 // Power of two
+    size_t count;
+} NickIndex;
+
+#define NICK_INDEX_INIT 1024    // Initial number of slots, kept at most half full
+
+uint32_t nick_hash(const char *nick);
+int nick_index_insert(NickIndex *idx, struct ClientInfo *client);
+void nick_index_remove(NickIndex *idx, struct ClientInfo *client);
+struct ClientInfo *nick_index_find(const NickIndex *idx, const char *nick);
+void nick_index_free(NickIndex *idx);
+
+#endif
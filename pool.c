@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "pool.h"
+
+// Bytes taken by a slab header, kept a multiple of POOL_ALIGN so objects stay aligned
+#define POOL_SLAB_HEADER (((sizeof(PoolSlab) + POOL_ALIGN - 1) / POOL_ALIGN) * POOL_ALIGN)
+
+// Function to set up an empty pool of obj_size-byte objects
+void pool_init(Pool *pool, const char *name, size_t obj_size, size_t slab_objs) {
+    memset(pool, 0, sizeof(Pool));
+    pool->name = name;
+    if (obj_size < sizeof(void *)) {
+        obj_size = sizeof(void *);
+    }
+    pool->obj_size = ((obj_size + POOL_ALIGN - 1) / POOL_ALIGN) * POOL_ALIGN;
+    pool->slab_objs = slab_objs > 0 ? slab_objs : 1;
+}
+
+// Function to add a slab of count objects to the free list
+static int pool_grow(Pool *pool, size_t count) {
+    size_t bytes = POOL_SLAB_HEADER + count * pool->obj_size;
+    PoolSlab *slab = aligned_alloc(POOL_ALIGN, bytes);
+    if (slab == NULL) {
+        log_perror("aligned_alloc");
+        return -1;
+    }
+    slab->next = pool->slabs;
+    slab->count = count;
+    pool->slabs = slab;
+
+    // Link the objects back to front so they are handed out in address order
+    char *objs = (char *)slab + POOL_SLAB_HEADER;
+    for (size_t i = count; i > 0; i--) {
+        void *obj = objs + (i - 1) * pool->obj_size;
+        *(void **)obj = pool->free_list;
+        pool->free_list = obj;
+    }
+    pool->capacity += count;
+    pool->bytes_reserved += bytes;
+    return 0;
+}
+
+// Function to make sure count objects can be in use without touching malloc
+int pool_reserve(Pool *pool, size_t count) {
+    if (count <= pool->capacity) {
+        return 0;
+    }
+    return pool_grow(pool, count - pool->capacity);
+}
+
+// Function to take an object from the pool, growing it by a slab when empty
+void *pool_alloc(Pool *pool) {
+    if (pool->free_list == NULL) {
+        if (pool_grow(pool, pool->slab_objs) < 0) {
+            return NULL;
+        }
+        log_info("[Pool] %s pool grew to %zu objects (%zu bytes reserved)",
+               pool->name, pool->capacity, pool->bytes_reserved);
+    }
+    void *obj = pool->free_list;
+    pool->free_list = *(void **)obj;
+    pool->in_use++;
+    if (pool->in_use > pool->high_water) {
+        pool->high_water = pool->in_use;
+    }
+    return obj;
+}
+
+// Function to give an object back to its pool
+void pool_free(Pool *pool, void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->in_use--;
+}
+
+// Function to read a pool's counters
+void pool_stats(const Pool *pool, PoolStats *stats) {
+    stats->in_use = pool->in_use;
+    stats->high_water = pool->high_water;
+    stats->capacity = pool->capacity;
+    stats->bytes_reserved = pool->bytes_reserved;
+}
+
+// Function to release every slab of a pool, objects still in use included
+void pool_destroy(Pool *pool) {
+    PoolSlab *slab = pool->slabs;
+    while (slab != NULL) {
+        PoolSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool_init(pool, pool->name, pool->obj_size, pool->slab_objs);
+}
@@ -0,0 +1,45 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Fixed-size object pool carved out of slabs (no per-object malloc/free)
+// Every object starts on its own cache line. Freed objects go on a free list
+// and are handed out again first. Slabs are only returned by pool_destroy(),
+// so a reconnect storm reuses the same memory instead of churning the heap.
+// A pool is not locked: the server only touches its pools under registry_lock.
+
+#define POOL_ALIGN 64             // Cache-line size objects are aligned to
+
+typedef struct PoolSlab {
+    struct PoolSlab *next;
+    size_t count;                 // Objects carved out of this slab
+} PoolSlab;
+
+typedef struct Pool {
+    const char *name;
+    size_t obj_size;              // Requested size rounded up to POOL_ALIGN
+    size_t slab_objs;             // Objects added when the free list runs dry
+    void *free_list;              // Linked through the first bytes of free objects
+    PoolSlab *slabs;
+    size_t in_use;
+    size_t high_water;            // Most objects in use at once
+    size_t capacity;              // Objects in all slabs
+    size_t bytes_reserved;        // Bytes of all slabs, headers included
+} Pool;
+
+typedef struct PoolStats {
+    size_t in_use;
+    size_t high_water;
+    size_t capacity;
+    size_t bytes_reserved;
+} PoolStats;
+
+void pool_init(Pool *pool, const char *name, size_t obj_size, size_t slab_objs);
+int pool_reserve(Pool *pool, size_t count);
+void *pool_alloc(Pool *pool);
+void pool_free(Pool *pool, void *obj);
+void pool_stats(const Pool *pool, PoolStats *stats);
+void pool_destroy(Pool *pool);
+
+#endif
@@ -0,0 +1,228 @@
+#include <string.h>
+#include "proto.h"
+
+// Function to write a varint, returns the number of bytes used
+size_t proto_put_varint(uint8_t *out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+// Function to read a varint
+// Returns 1 when decoded, 0 when more bytes are needed and -1 if it is malformed
+int proto_get_varint(const uint8_t *in, size_t avail, uint32_t *value, size_t *used) {
+    uint32_t result = 0;
+    for (size_t i = 0; i < PROTO_VARINT_MAX; i++) {
+        if (i >= avail) {
+            return 0;
+        }
+        result |= (uint32_t)(in[i] & 0x7f) << (7 * i);
+        if ((in[i] & 0x80) == 0) {
+            *value = result;
+            *used = i + 1;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+// Function to write the hello a v2 peer sends right after connecting
+void proto_hello(uint8_t *out, int version) {
+    memcpy(out, PROTO_MAGIC, PROTO_MAGIC_LEN);
+    out[PROTO_MAGIC_LEN] = (uint8_t)version;
+}
+
+// Function to recognize a hello at the start of a connection
+// Returns the version offered, 0 when more bytes are needed and -1 for a v1 peer
+int proto_parse_hello(const uint8_t *in, size_t avail) {
+    size_t check = avail < PROTO_MAGIC_LEN ? avail : PROTO_MAGIC_LEN;
+    if (memcmp(in, PROTO_MAGIC, check) != 0) {
+        return -1;
+    }
+    if (avail < PROTO_HELLO_LEN) {
+        return 0;
+    }
+    return in[PROTO_MAGIC_LEN];
+}
+
+// Function to compute the encoded size of a frame
+size_t proto_frame_len(int version, const struct message *msg, size_t len) {
+    if (version != PROTO_V2) {
+        return PROTO_V1_HEADER_LEN + len;
+    }
+
+    uint8_t scratch[PROTO_VARINT_MAX];
+    size_t nick_len = msg->uid != 0 ? 0 : strnlen(msg->nick_sender, NICK_LEN - 1);
+    size_t infos_len = strnlen(msg->infos, INFOS_LEN - 1);
+    size_t body = 2 + len;
+    if (nick_len > 0) {
+        body += proto_put_varint(scratch, nick_len) + nick_len;
+    }
+    if (infos_len > 0) {
+        body += proto_put_varint(scratch, infos_len) + infos_len;
+    }
+    if (msg->uid != 0) {
+        body += proto_put_varint(scratch, msg->uid);
+    }
+    return proto_put_varint(scratch, body) + body;
+}
+
+// Function to encode a frame, out must hold proto_frame_len() bytes
+size_t proto_encode(int version, uint8_t *out, const struct message *msg, const void *payload, size_t len) {
+    if (version != PROTO_V2) {
+        memcpy(out, msg, PROTO_V1_HEADER_LEN);
+        if (len > 0) {
+            memcpy(out + PROTO_V1_HEADER_LEN, payload, len);
+        }
+        return PROTO_V1_HEADER_LEN + len;
+    }
+
+    // With a uid, the receiver knows the nickname from its user map
+    size_t nick_len = msg->uid != 0 ? 0 : strnlen(msg->nick_sender, NICK_LEN - 1);
+    size_t infos_len = strnlen(msg->infos, INFOS_LEN - 1);
+    uint8_t fields[2 + 3 * PROTO_VARINT_MAX + NICK_LEN + INFOS_LEN];
+    size_t n = 0;
+
+    fields[n++] = (uint8_t)msg->type;
+    fields[n++] = (nick_len > 0 ? PROTO_F_NICK : 0) | (infos_len > 0 ? PROTO_F_INFOS : 0) | (msg->uid != 0 ? PROTO_F_UID : 0);
+    if (nick_len > 0) {
+        n += proto_put_varint(fields + n, nick_len);
+        memcpy(fields + n, msg->nick_sender, nick_len);
+        n += nick_len;
+    }
+    if (infos_len > 0) {
+        n += proto_put_varint(fields + n, infos_len);
+        memcpy(fields + n, msg->infos, infos_len);
+        n += infos_len;
+    }
+    if (msg->uid != 0) {
+        n += proto_put_varint(fields + n, msg->uid);
+    }
+
+    size_t off = proto_put_varint(out, n + len);
+    memcpy(out + off, fields, n);
+    off += n;
+    if (len > 0) {
+        memcpy(out + off, payload, len);
+    }
+    return off + len;
+}
+
+// Function to decode one length-prefixed string field into a NUL-terminated buffer
+static int proto_get_field(const uint8_t *in, size_t avail, char *dst, size_t dst_size, size_t *used) {
+    uint32_t len;
+    size_t n;
+    if (proto_get_varint(in, avail, &len, &n) != 1 || len >= dst_size || len > avail - n) {
+        return -1;
+    }
+    memcpy(dst, in + n, len);
+    dst[len] = '\0';
+    *used = n + len;
+    return 1;
+}
+
+// Function to decode the header fields of one v2 frame and locate its payload
+// The payload is left in place at in + *pld_off, msg->pld_len bytes long
+// Returns 1 when a frame was decoded, 0 when more bytes are needed and -1 if it is malformed or too large
+int proto_v2_decode_header(const uint8_t *in, size_t avail, struct message *msg, size_t max_payload, size_t *pld_off, size_t *used) {
+    uint32_t body;
+    size_t n;
+    int ret = proto_get_varint(in, avail, &body, &n);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    // Reject oversized frames before waiting for their bytes
+    if (body < 2 || body > PROTO_V2_MAX_FRAME(max_payload)) {
+        return -1;
+    }
+    if (avail - n < body) {
+        return 0;
+    }
+
+    const uint8_t *p = in + n;
+    size_t left = body;
+    msg->type = (enum msg_type)p[0];
+    uint8_t flags = p[1];
+    p += 2;
+    left -= 2;
+
+    // Absent fields read as empty; the rest of the struct is not cleared
+    msg->nick_sender[0] = '\0';
+    msg->infos[0] = '\0';
+    msg->uid = 0;
+
+    size_t field;
+    if (flags & PROTO_F_NICK) {
+        if (proto_get_field(p, left, msg->nick_sender, NICK_LEN, &field) < 0) {
+            return -1;
+        }
+        p += field;
+        left -= field;
+    }
+    if (flags & PROTO_F_INFOS) {
+        if (proto_get_field(p, left, msg->infos, INFOS_LEN, &field) < 0) {
+            return -1;
+        }
+        p += field;
+        left -= field;
+    }
+    if (flags & PROTO_F_UID) {
+        uint32_t uid;
+        if (proto_get_varint(p, left, &uid, &field) != 1) {
+            return -1;
+        }
+        msg->uid = uid;
+        p += field;
+        left -= field;
+    }
+    if (left >= max_payload) {
+        return -1;
+    }
+
+    msg->pld_len = left;
+    *pld_off = p - in;
+    *used = n + body;
+    return 1;
+}
+
+// Function to decode one v2 frame into a struct message and a NUL-terminated payload
+// Returns 1 when a frame was decoded, 0 when more bytes are needed and -1 if it is malformed or too large
+int proto_v2_decode(const uint8_t *in, size_t avail, struct message *msg, char *payload, size_t max_payload, size_t *used) {
+    size_t pld_off;
+    int ret = proto_v2_decode_header(in, avail, msg, max_payload, &pld_off, used);
+    if (ret != 1) {
+        return ret;
+    }
+    memcpy(payload, in + pld_off, msg->pld_len);
+    payload[msg->pld_len] = '\0';
+    return 1;
+}
+
+// Function to write one user map entry, an empty nick removes the user
+size_t proto_put_user(uint8_t *out, uint32_t uid, const char *nick) {
+    size_t nick_len = strnlen(nick, NICK_LEN - 1);
+    size_t n = proto_put_varint(out, uid);
+    n += proto_put_varint(out + n, nick_len);
+    memcpy(out + n, nick, nick_len);
+    return n + nick_len;
+}
+
+// Function to read one user map entry into a NUL-terminated nick
+// Returns 1 when an entry was read and -1 if it is malformed or truncated
+int proto_get_user(const uint8_t *in, size_t avail, uint32_t *uid, char *nick, size_t *used) {
+    size_t n;
+    size_t field;
+    if (proto_get_varint(in, avail, uid, &n) != 1) {
+        return -1;
+    }
+    if (proto_get_field(in + n, avail - n, nick, NICK_LEN, &field) < 0) {
+        return -1;
+    }
+    *used = n + field;
+    return 1;
+}
@@ -0,0 +1,66 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "msg_struct.h"
+
+// Wire protocol codecs shared by the server, the client and the benchmarks
+//
+// v1: the raw struct message up to infos (264 bytes) followed by pld_len payload bytes.
+// v2: negotiated by a hello right after connecting, then every frame is
+//
+//     varint  body_len        bytes that follow this varint
+//     u8      type            enum msg_type
+//     u8      flags           PROTO_F_NICK | PROTO_F_INFOS
+//     [varint len, bytes]     nick_sender, if PROTO_F_NICK
+//     [varint len, bytes]     infos, if PROTO_F_INFOS
+//     [varint]                uid, if PROTO_F_UID
+//     payload                 the rest of the body
+//
+// From a client, uid addresses the recipient; from the server, it names the
+// sender (or, in NICKNAME_SUCCESS, the client itself). nick_sender is left out
+// of v2 frames that carry a uid: peers resolve it from their USER_MAP, whose
+// payload is a list of [varint uid, varint len, nick] entries (len 0 = gone).
+//
+// Varints are little-endian base 128, so v2 frames do not depend on the
+// compiler's struct layout or on the host byte order.
+
+#define PROTO_V1 1
+#define PROTO_V2 2
+
+#define PROTO_MAGIC "CHT"          // Starts the v2 hello; as a v1 pld_len it is out of range
+#define PROTO_MAGIC_LEN 3
+#define PROTO_HELLO_LEN 4          // Magic followed by the protocol version
+
+#define PROTO_F_NICK 0x01
+#define PROTO_F_INFOS 0x02
+#define PROTO_F_UID 0x04
+
+// Bytes of struct message sent in a v1 frame (everything before uid)
+#define PROTO_V1_HEADER_LEN offsetof(struct message, uid)
+
+#define PROTO_VARINT_MAX 5         // Bytes needed for any 32-bit varint
+
+// Largest v2 frame carrying a payload of len bytes
+#define PROTO_V2_MAX_FRAME(len) (PROTO_VARINT_MAX + 2 + 3 * PROTO_VARINT_MAX + NICK_LEN + INFOS_LEN + (len))
+
+// Varints
+size_t proto_put_varint(uint8_t *out, uint32_t value);
+int proto_get_varint(const uint8_t *in, size_t avail, uint32_t *value, size_t *used);
+
+// Handshake
+void proto_hello(uint8_t *out, int version);
+int proto_parse_hello(const uint8_t *in, size_t avail);
+
+// Frames
+size_t proto_frame_len(int version, const struct message *msg, size_t len);
+size_t proto_encode(int version, uint8_t *out, const struct message *msg, const void *payload, size_t len);
+int proto_v2_decode_header(const uint8_t *in, size_t avail, struct message *msg, size_t max_payload, size_t *pld_off, size_t *used);
+int proto_v2_decode(const uint8_t *in, size_t avail, struct message *msg, char *payload, size_t max_payload, size_t *used);
+
+// User map entries
+size_t proto_put_user(uint8_t *out, uint32_t uid, const char *nick);
+int proto_get_user(const uint8_t *in, size_t avail, uint32_t *uid, char *nick, size_t *used);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -9,23 +10,124 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "common.h"
+#include "log.h"
+#include "metrics.h"
+#include "latency.h"
+#include "capture.h"
+#include "history.h"
+#include "mailbox.h"
 #include "msg_struct.h"
+#include "uring.h"
+#include "proto.h"
+#include "nick_index.h"
 #include <ctype.h>
 
 // Initialization of variables
 int online_clients = 0;
+int pending_logins = 0;    // Sessions that have not chosen a nickname yet
 ClientInfo *clientList;
 Channel *channel_list = NULL;
+Channel *channel_tail = NULL;
+
+// Channel registry: chained hash table of channel_list entries (one bucket per channel at most)
+Channel **channel_table = NULL;
+size_t channel_table_size = 0;
+size_t channel_count = 0;
 ClientInfo *clientList = NULL;
+ClientInfo *clientTail = NULL;
+
+// Connection table indexed by socket fd, grown on demand (no fixed client cap)
+// A worker reads the slots of its own sessions without registry_lock, so the table
+// is published atomically and the tables it outgrew are never freed
+ClientInfo **_Atomic conn_table = NULL;
+_Atomic int conn_table_size = 0;
+
+// Sessions with a nickname, hashed by case-folded nickname
+NickIndex nick_index = {0};
+
+// Slab pools for sessions, channels and memberships (used under registry_lock)
+Pool client_pool;
+Pool channel_pool;
+Pool membership_pool;
+
+// User table indexed by the slot bits of a user ID (slot 0 is never handed out, so 0 means no ID)
+UidSlot *uid_table = NULL;
+int uid_table_size = 0;
+int uid_next_slot = 1;
+int uid_free_head = -1;
+
+// Worker threads: each owns the sockets it accepted and runs its own epoll loop
+Worker *workers = NULL;
+int worker_count = 1;
+__thread Worker *current_worker = NULL;
+
+// Guards clientList, channel_list, conn_table, nick_index, the user table and online_clients across workers
+pthread_rwlock_t registry_lock;
+unsigned long next_conn_id = 1;
+
+// Bumped (under the exclusive registry_lock) whenever users, nicknames or channel memberships change
+// Starts at 1 so that empty snapshots never match
+unsigned long membership_generation = 1;
+
+// /who pages and /channel_list replies built at some generation, shared until it moves on
+ListSnapshot who_snapshots[WHO_SNAPSHOT_PAGES];
+ListSnapshot channel_list_snapshot;
+pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// io_uring backend state (active_ring is NULL for the poll/epoll backends)
+Uring *active_ring = NULL;
+UringConn *uring_conns = NULL;
+int uring_conns_size = 0;
+int *uring_dirty = NULL;
+size_t uring_dirty_len = 0;
+size_t uring_dirty_cap = 0;
 
 
 ////////////////////////////////////// User Functions //////////////////////////////////////
+// Function to make room for a socket fd in the connection table
+int conn_table_reserve(int sockfd) {
+    if (sockfd < conn_table_size) {
+        return 0;
+    }
+
+    int new_size = conn_table_size > 0 ? conn_table_size : CONN_TABLE_INIT;
+    while (new_size <= sockfd) {
+        new_size *= 2;
+    }
+
+    // The old table stays valid for readers; the tables left behind add up to less than the current one
+    ClientInfo **new_table = calloc(new_size, sizeof(ClientInfo *));
+    if (new_table == NULL) {
+        log_perror("calloc");
+        return -1;
+    }
+    if (conn_table_size > 0) {
+        memcpy(new_table, conn_table, conn_table_size * sizeof(ClientInfo *));
+    }
+    // The table goes first, so a reader that sees the new size also sees a table that large
+    conn_table = new_table;
+    conn_table_size = new_size;
+    return 0;
+}
+
 // Function to create a user
 void add_user(ClientInfo **list, int sockfd, struct sockaddr_in address) {
-    ClientInfo *new_user = (ClientInfo *)malloc(sizeof(ClientInfo));
+    if (conn_table_reserve(sockfd) < 0) {
+        return;
+    }
+
+    ClientInfo *new_user = (ClientInfo *)pool_alloc(&client_pool);
     if (new_user == NULL) {
-        perror("malloc");
         return;
     }
     new_user->sockfd = sockfd;
@@ -35,43 +137,189 @@ void add_user(ClientInfo **list, int sockfd, struct sockaddr_in address) {
     inet_ntop(AF_INET, &(address.sin_addr), new_user->ip_address, INET_ADDRSTRLEN);
     new_user->port_number = ntohs(address.sin_port);
     new_user->next = NULL;
-    memset(new_user->channel, 0, CHAN_LEN);
-
+    new_user->prev = NULL;
+    new_user->worker_id = current_worker != NULL ? current_worker->id : 0;
+    new_user->conn_id = next_conn_id++;
+    new_user->channels = NULL;
+    new_user->channels_len = 0;
+    new_user->channels_cap = 0;
+    memset(&new_user->decoder, 0, sizeof(FrameDecoder));
+    memset(&new_user->sendq, 0, sizeof(SendQueue));
+    new_user->proto = 0;
+    new_user->uid = 0;
+
+    // Append in O(1) using the tail pointer
     if (*list == NULL) {
         *list = new_user;
     } else {
-        ClientInfo *current = *list;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = new_user;
+        new_user->prev = clientTail;
+        clientTail->next = new_user;
     }
+    clientTail = new_user;
+    conn_table[sockfd] = new_user;
 }
 
 // Function to delete a user
 void remove_user(int sockfd) {
-    ClientInfo *curr = clientList;
-    ClientInfo *prev = NULL;
+    ClientInfo *curr = sockfd_to_client(clientList, sockfd);
 
-    while (curr != NULL) {
-        if (curr->sockfd == sockfd) {
-            if (prev == NULL) {
-                clientList = curr->next;
-            } else {
-                prev->next = curr->next;
+    if (curr == NULL) {
+        log_info("Client with sockfd: %d not found.", sockfd-4);
+        return;
+    }
+
+    // Unlink in O(1) using the back pointer
+    if (curr->prev == NULL) {
+        clientList = curr->next;
+    } else {
+        curr->prev->next = curr->next;
+    }
+    if (curr->next == NULL) {
+        clientTail = curr->prev;
+    } else {
+        curr->next->prev = curr->prev;
+    }
+    conn_table[sockfd] = NULL;
+    if (capture_enabled) {
+        capture_close(curr->conn_id);
+    }
+
+    // A client that never logged in was never listed, so cached lists stay valid
+    // Removal from the index is unconditional: it finds the session itself, not its nickname
+    int listed = curr->nickname[0] != '\0';
+    nick_index_remove(&nick_index, curr);
+    if (!listed) {
+        pending_logins--;
+    }
+    channel_leave_all(curr);
+
+    // Tell the remaining v2 clients that the ID is gone
+    if (curr->uid != 0) {
+        send_user_update(clientList, NULL, curr->uid, "");
+        release_uid(curr);
+    }
+
+    log_info(">> client %s with sockid number %d disconnected", curr->nickname,sockfd-4);
+    free(curr->decoder.buf);
+    sendq_clear(&curr->sendq);
+    pool_free(&client_pool, curr);
+    online_clients--;
+    if (listed) {
+        membership_generation++;
+    }
+}
+
+// Function to hand out a user ID, reusing the slots of departed users first
+// A session keeps the ID it already has; returns 0 if the table cannot grow
+unsigned int assign_uid(ClientInfo *client) {
+    if (client->uid != 0) {
+        return client->uid;
+    }
+    int slot = uid_free_head;
+    if (slot != -1) {
+        uid_free_head = uid_table[slot].next_free;
+    } else {
+        if (uid_next_slot > (int)UID_SLOT_MASK) {
+            log_error("No user ID left for %s.", client->nickname);
+            return 0;
+        }
+        if (uid_next_slot >= uid_table_size) {
+            int new_size = uid_table_size > 0 ? uid_table_size * 2 : UID_TABLE_INIT;
+            UidSlot *new_table = realloc(uid_table, new_size * sizeof(UidSlot));
+            if (new_table == NULL) {
+                log_perror("realloc");
+                return 0;
             }
+            memset(new_table + uid_table_size, 0, (new_size - uid_table_size) * sizeof(UidSlot));
+            uid_table = new_table;
+            uid_table_size = new_size;
+        }
+        slot = uid_next_slot++;
+    }
+
+    uid_table[slot].client = client;
+    uid_table[slot].next_free = -1;
+    client->uid = (uid_table[slot].gen << UID_SLOT_BITS) | (unsigned int)slot;
+    // The user shows up in /who from now on
+    membership_generation++;
+    return client->uid;
+}
+
+// Function to give a user's ID slot back
+void release_uid(ClientInfo *client) {
+    int slot = client->uid & UID_SLOT_MASK;
+    if (client->uid == 0 || slot >= uid_next_slot || uid_table[slot].client != client) {
+        return;
+    }
+    uid_table[slot].client = NULL;
+    uid_table[slot].gen = (uid_table[slot].gen + 1) & (UINT32_MAX >> UID_SLOT_BITS);
+    uid_table[slot].next_free = uid_free_head;
+    uid_free_head = slot;
+    client->uid = 0;
+}
 
-            printf( ">> client" " %s"" with sockid number %d disconnected"  "\n", curr->nickname,sockfd-4);
-            free(curr);
-            online_clients--;
+// Function to find a client using its user ID (O(1) through the user table)
+ClientInfo *uid_to_client(unsigned int uid) {
+    int slot = uid & UID_SLOT_MASK;
+    if (slot == 0 || slot >= uid_next_slot) {
+        return NULL;
+    }
+    ClientInfo *client = uid_table[slot].client;
+    return client != NULL && client->uid == uid ? client : NULL;
+}
 
-            return;
+// Function to find the recipient of a routed frame: by ID for v2 clients, by nickname for v1 ones
+ClientInfo *resolve_recipient(ClientInfo *list, unsigned int uid, char *nick) {
+    if (uid != 0) {
+        return uid_to_client(uid);
+    }
+    return nick_to_client(list, nick);
+}
+
+// Function to push the whole ID-to-nickname map to a v2 client that just logged in
+void send_user_map(ClientInfo *client) {
+    if (client->proto != PROTO_V2) {
+        return;
+    }
+
+    char payload[MSG_LEN];
+    size_t len = 0;
+    struct message msgstruct = {0};
+    msgstruct.type = USER_MAP;
+
+    for (ClientInfo *node = clientList; node != NULL; node = node->next) {
+        if (node->uid == 0) {
+            continue;
+        }
+        // Start a new frame when the next entry might not fit
+        if (len + 2 * PROTO_VARINT_MAX + NICK_LEN >= MSG_LEN) {
+            msgstruct.pld_len = len;
+            send_frame(client->sockfd, &msgstruct, payload, len);
+            len = 0;
         }
-        prev = curr;
-        curr = curr->next;
+        len += proto_put_user((uint8_t *)payload + len, node->uid, node->nickname);
     }
+    if (len > 0) {
+        msgstruct.pld_len = len;
+        send_frame(client->sockfd, &msgstruct, payload, len);
+    }
+}
 
-    printf("Client with sockfd: %d not found.\n", sockfd-4);
+// Function to push one map entry (an empty nick removes it) to every logged-in v2 client but skip
+void send_user_update(ClientInfo *list, ClientInfo *skip, unsigned int uid, const char *nick) {
+    char payload[2 * PROTO_VARINT_MAX + NICK_LEN];
+    struct message msgstruct = {0};
+    msgstruct.type = USER_MAP;
+    msgstruct.pld_len = proto_put_user((uint8_t *)payload, uid, nick);
+
+    Fanout fanout;
+    fanout_init(&fanout, &msgstruct, payload, msgstruct.pld_len);
+    for (ClientInfo *node = list; node != NULL; node = node->next) {
+        if (node != skip && node->uid != 0 && node->proto == PROTO_V2) {
+            fanout_send(&fanout, node->sockfd);
+        }
+    }
+    fanout_done(&fanout);
 }
 
 
@@ -80,65 +328,65 @@ void remove_user(int sockfd) {
 
 ////////////////////////////////////// Command handling Functions //////////////////////////////////////
 // Function to handle commands using switch case
-void handle_command(int sockfd, struct message msgstruct, char *nick_sender, ClientInfo *clients_list, char *buff) {
-    switch (msgstruct.type) {
+void handle_command(int sockfd, struct message *msgstruct, char *nick_sender, ClientInfo *clients_list, char *buff) {
+    switch (msgstruct->type) {
         case UNKNOWN_COMMAND:
             unknown_command(clients_list, nick_sender);
             break;
 
         case NICKNAME_NEW:
             // Command to change nickname
-            change_nickname(sockfd, msgstruct.infos, clients_list);
+            change_nickname(sockfd, msgstruct->infos, clients_list);
             break;
 
         case NICKNAME_LIST:
             // Command to list users
-            handle_who(sockfd, clients_list);
+            handle_who(sockfd, msgstruct->infos, clients_list);
             break;
 
         case NICKNAME_INFOS:
             // Command to get information about a user
-            handle_whois(sockfd, msgstruct.infos, clients_list);
+            handle_whois(sockfd, msgstruct->infos, clients_list);
             break;
 
         case WHOAMI:
             // Command to get information about the current user
-            handle_whoami(sockfd, msgstruct.nick_sender, clients_list);
+            handle_whoami(sockfd, msgstruct->nick_sender, clients_list);
             break;
 
         case ECHO_SEND:
             // Command to echo a message
-            handle_echo(sockfd, buff, msgstruct.pld_len, nick_sender);
+            handle_echo(sockfd, buff, msgstruct->pld_len, nick_sender);
             break;
 
         case UNICAST_SEND:
             // Command to send a message to a specific user
-            handle_msg(sockfd, buff, msgstruct.pld_len, msgstruct.infos, clients_list, nick_sender);
+            handle_msg(sockfd, buff, msgstruct->pld_len, msgstruct->uid, msgstruct->infos, clients_list, nick_sender);
             break;
 
         case BROADCAST_SEND:
             // Command to send a message to all users
-            handle_msgall(sockfd, buff, msgstruct.pld_len, clients_list);
+            handle_msgall(sockfd, buff, msgstruct->pld_len, clients_list);
             break;
 
         case MULTICAST_SEND:
             // Command to send a message to a specific group
-            handle_multicast(clients_list, nick_sender, buff, msgstruct.infos);
+            handle_multicast(clients_list, nick_sender, buff, msgstruct->infos);
             break;
 
         case MULTICAST_CREATE:
             // Command to create a group
-            handle_create(clients_list, nick_sender, msgstruct.infos);
+            handle_create(clients_list, nick_sender, msgstruct->infos);
             break;
 
         case MULTICAST_QUIT:
             // Command to quit a group
-            handle_quit(clients_list, nick_sender, msgstruct.infos);
+            handle_quit(clients_list, nick_sender, msgstruct->infos);
             break;
 
         case MULTICAST_JOIN:
             // Command to join a group
-            handle_join(clients_list, nick_sender, msgstruct.infos);
+            handle_join(clients_list, nick_sender, msgstruct->infos);
             break;
 
         case MULTICAST_LIST:
@@ -146,25 +394,30 @@ void handle_command(int sockfd, struct message msgstruct, char *nick_sender, Cli
             handle_channel_list(clients_list, nick_sender);
             break;
 
+        case MULTICAST_HISTORY:
+            // Command to get the last messages of a group
+            handle_history(clients_list, nick_sender, msgstruct->infos, buff);
+            break;
+
         case FILE_REQUEST:
             // Command to request file sending (unimplemented)
-             send_file_request(clients_list, msgstruct.nick_sender, msgstruct.infos, buff);
+            send_file_request(sockfd, clients_list, msgstruct->uid, msgstruct->infos, buff);
             break;
 
         case FILE_ACCEPT:
             // Command to handle file send acceptance (unimplemented)
-            respond_to_sender(clients_list, msgstruct.infos, buff, msgstruct);
+            respond_to_sender(sockfd, clients_list, msgstruct->infos, buff, *msgstruct);
             break;
 
         case FILE_REJECT:
             // Command to handle file send rejection (unimplemented)
-            respond_to_sender(clients_list, msgstruct.infos, buff, msgstruct);
-            printf("%s" " refused file transfer.\n" , nick_sender);
+            respond_to_sender(sockfd, clients_list, msgstruct->infos, buff, *msgstruct);
+            log_info("%s refused file transfer.", nick_sender);
             break;
 
         default:
             // Handle any unknown or unhandled command types
-            printf("Unknown message type received.\n");
+            log_info("Unknown message type received.");
             break;
     }
 }
@@ -173,17 +426,16 @@ void handle_command(int sockfd, struct message msgstruct, char *nick_sender, Cli
 void unknown_command(ClientInfo *client_list, char *nickname_sender) {
     ClientInfo *sender = nick_to_client(client_list, nickname_sender);
     if (!sender) {
-        printf( "[Server]:Client not found.\n" );
+        log_info("Client not found.");
         return;
     }
 
     struct message unknown_msg = { .type = UNKNOWN_COMMAND, .pld_len = strlen("Unknown command received") };
     char unknown_command[] = "Unknown command received";
 
-    if (send(sender->sockfd, &unknown_msg, sizeof(unknown_msg), 0) <= 0 ||
-        send(sender->sockfd, unknown_command, unknown_msg.pld_len, 0) <= 0) {
-        printf( "[Server]: error sending unknown command message to client %s.\n" , sender->nickname);
-        perror("send");
+    if (send_frame(sender->sockfd, &unknown_msg, unknown_command, unknown_msg.pld_len) < 0) {
+        log_error("error sending unknown command message to client %s.", sender->nickname);
+        log_perror("send");
     }
 }
 
@@ -199,29 +451,28 @@ int update_nickname(char *nickname) {
 
     // Check nickname length
     if (nickname_len < 1 || nickname_len >= NICK_LEN) {
-        printf( "%s"  " tried choosing a nickname with invalid length.\n" , current->nickname);
+        log_info("%s tried choosing a nickname with invalid length.", current->nickname);
         return 3;
     }
 
     // Reserved name check
     if (strcasecmp(nickname, "Server") == 0) {
-        printf("%s"" tried choosing 'server' as a nickname.\n" , current->nickname);
+        log_info("%s tried choosing 'server' as a nickname.", current->nickname);
         return 0;
     }
 
-    // Check if nickname already exists
-    for (ClientInfo *current = clientList; current != NULL; current = current->next) {
-        if (strcasecmp(nickname, current->nickname) == 0) {
-            printf("%s"" tried choosing an already used nickname.\n" , current->nickname);
-            return 0;
-        }
+    // Check if nickname already exists (the index ignores case)
+    ClientInfo *owner = nick_index_find(&nick_index, nickname);
+    if (owner != NULL) {
+        log_info("%s tried choosing an already used nickname.", owner->nickname);
+        return 0;
     }
 
     // Validate characters in nickname
     
     for (size_t i = 0; i < nickname_len; i++) {
         if (!isalnum(nickname[i])) {
-            printf( "%s"  " tried choosing a nickname with invalid characters.\n" , current->nickname);
+            log_info("%s tried choosing a nickname with invalid characters.", current->nickname);
             return 0;
         }
     }
@@ -240,33 +491,40 @@ void change_nickname(int sockfd, char *new_nickname, ClientInfo *clients_list) {
             old_nickname[NICK_LEN - 1] = '\0';
 
             if (update_nickname(new_nickname) == 1) {
-                strncpy(current->nickname, new_nickname, NICK_LEN);
-                printf( "%s"" has changed their nickname to ""%s"".\n" , old_nickname, current->nickname);
+                nick_index_remove(&nick_index, current);
+                snprintf(current->nickname, sizeof(current->nickname), "%s", new_nickname);
+                membership_generation++;
+                if (nick_index_insert(&nick_index, current) < 0) {
+                    log_error("Could not index nickname %s.", current->nickname);
+                }
+                log_info("%s has changed their nickname to %s.", old_nickname, current->nickname);
+                send_user_update(clients_list, NULL, current->uid, current->nickname);
 
-                if (strlen(current->channel) > 0) {
+                // Tell every channel the client is in
+                for (int i = 0; i < current->channels_len; i++) {
                     char notif_message[MSG_LEN];
                     snprintf(notif_message, MSG_LEN, "%s has changed their nickname to %s", old_nickname, current->nickname);
-                    send_notification(current->channel, notif_message, clients_list, current->nickname);
+                    send_notification(current->channels[i]->channel->channel_name, notif_message, clients_list, current->nickname);
                 }
 
                 struct message nickname_msg = { .type = NICKNAME_SUCCESS, .pld_len = strlen("Nickname changed successfully") };
                 strcpy(nickname_msg.nick_sender, current->nickname);
                 strcpy(nickname_msg.infos, new_nickname);
+                nickname_msg.uid = current->uid;
 
-                if (send(sockfd, &nickname_msg, sizeof(nickname_msg), 0) <= 0 || 
-                    send(sockfd, "Nickname changed successfully", nickname_msg.pld_len, 0) <= 0) {
-                    perror("send");
+                if (send_frame(sockfd, &nickname_msg, "Nickname changed successfully", nickname_msg.pld_len) < 0) {
+                    log_perror("send");
                 }
+                deliver_mailbox(current);
             } 
             else {
-                printf( "%s"" tried to change their nickname but failed.\n" , current->nickname);
+                log_info("%s tried to change their nickname but failed.", current->nickname);
                 struct message nickname_msg = { .type = NICKNAME_ERROR, .pld_len = strlen("Failed to change the nickname") };
                 strcpy(nickname_msg.nick_sender, current->nickname);
                 strcpy(nickname_msg.infos, "Failed to change the nickname");
 
-                if (send(sockfd, &nickname_msg, sizeof(nickname_msg), 0) <= 0 || 
-                    send(sockfd, "Failed to change the nickname", nickname_msg.pld_len, 0) <= 0) {
-                    perror("send");
+                if (send_frame(sockfd, &nickname_msg, "Failed to change the nickname", nickname_msg.pld_len) < 0) {
+                    log_perror("send");
                 }
             }
 
@@ -275,7 +533,7 @@ void change_nickname(int sockfd, char *new_nickname, ClientInfo *clients_list) {
         current = current->next;
     }
 
-    printf( " User not found.\n" );
+    log_info("User not found.");
 }
 
 
@@ -287,24 +545,22 @@ void change_nickname(int sockfd, char *new_nickname, ClientInfo *clients_list) {
 int check_channel_name(char *channel) {
     // Check if channel length is within the allowed range
     if (strlen(channel) < 1 || strlen(channel) >= CHAN_LEN) {
-        printf( "[Server]:"  " Channel name must be between 1 and %d characters.\n" , CHAN_LEN - 1);
+        log_info("Channel name must be between 1 and %d characters.", CHAN_LEN - 1);
         return 0;
     }
 
     // Ensure channel name contains only alphanumeric characters
     for (char *ch = channel; *ch != '\0'; ch++) {
         if (!isalnum(*ch)) {
-            printf( "[Server]:"  " Channel name must contain only letters and numbers.\n" );
+            log_info("Channel name must contain only letters and numbers.");
             return 0;
         }
     }
 
     // Confirm the channel name is not already in use
-    for (ClientInfo *client = clientList; client != NULL; client = client->next) {
-        if (strcmp(channel, client->channel) == 0) {
-            printf( "[Server]:"  " Channel name already taken. Please select a different name.\n" );
-            return 0;
-        }
+    if (channel_info(channel_list, channel) != NULL) {
+        log_info("Channel name already taken. Please select a different name.");
+        return 0;
     }
 
     return 1;
@@ -312,57 +568,190 @@ int check_channel_name(char *channel) {
 
 // Function to check if a channel exists
 int check_channel_existence(ClientInfo *list, char *channel) {
-    for (ClientInfo *curr = list; curr != NULL; curr = curr->next) {
-        if (strcmp(curr->channel, channel) == 0) {
-            return 1;
+    (void)list;
+    return channel_info(channel_list, channel) != NULL;
+}
+
+// Function to hash a channel name (FNV-1a)
+uint32_t channel_hash(const char *c_name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)c_name; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Function to grow the channel registry so chains stay short
+int channel_table_grow(void) {
+    size_t new_size = channel_table_size > 0 ? channel_table_size * 2 : CHANNEL_TABLE_INIT;
+    Channel **new_table = calloc(new_size, sizeof(Channel *));
+    if (new_table == NULL) {
+        log_perror("calloc");
+        return -1;
+    }
+    for (size_t i = 0; i < channel_table_size; i++) {
+        Channel *channel = channel_table[i];
+        while (channel != NULL) {
+            Channel *next = channel->hash_next;
+            size_t bucket = channel->hash & (new_size - 1);
+            channel->hash_next = new_table[bucket];
+            new_table[bucket] = channel;
+            channel = next;
         }
     }
+    free(channel_table);
+    channel_table = new_table;
+    channel_table_size = new_size;
     return 0;
 }
 
+// Function to register a new, empty channel
+// Callers have checked the name with check_channel_name()
+Channel *addChannel(char *channel_name) {
+    if (channel_count >= channel_table_size && channel_table_grow() < 0) {
+        return NULL;
+    }
+
+    Channel *new_c = (Channel *)pool_alloc(&channel_pool);
+    if (new_c == NULL) {
+        log_error("Memory allocation error for the new channel.");
+        return NULL;
+    }
+    strncpy(new_c->channel_name, channel_name, CHAN_LEN - 1);
+    new_c->channel_name[CHAN_LEN - 1] = '\0';
+    new_c->activ_client = 0;
+    new_c->members = NULL;
+    new_c->history = history_open(new_c->channel_name);
+    new_c->hash = channel_hash(new_c->channel_name);
+
+    size_t bucket = new_c->hash & (channel_table_size - 1);
+    new_c->hash_next = channel_table[bucket];
+    channel_table[bucket] = new_c;
+
+    // Keep the creation order for /channel_list
+    new_c->channel_next = NULL;
+    new_c->channel_prev = channel_tail;
+    if (channel_tail == NULL) {
+        channel_list = new_c;
+    } else {
+        channel_tail->channel_next = new_c;
+    }
+    channel_tail = new_c;
+    channel_count++;
+    return new_c;
+}
+
+// Function to find where a channel sits in a client's membership set, -1 if absent
+static int channel_slot(ClientInfo *client, Channel *channel) {
+    for (int i = 0; i < client->channels_len; i++) {
+        if (client->channels[i]->channel == channel) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Function to find a client's membership of a channel, NULL if it is not a member
+Membership *channel_membership(ClientInfo *client, Channel *channel) {
+    int slot = channel_slot(client, channel);
+    return slot < 0 ? NULL : client->channels[slot];
+}
+
+// Function to add a client to a channel's member list, keeping its other channels
+// Returns 1 when it joined, 0 if it was already a member and -1 on error
+int channel_add_member(Channel *channel, ClientInfo *client) {
+    if (channel_slot(client, channel) >= 0) {
+        return 0;
+    }
+    if (client->channels_len >= MAX_CLIENT_CHANNELS) {
+        log_info("%s is already in %d channels.", client->nickname, client->channels_len);
+        return -1;
+    }
+    if (client->channels_len == client->channels_cap) {
+        int new_cap = client->channels_cap > 0 ? client->channels_cap * 2 : CLIENT_CHANNELS_INIT;
+        Membership **grown = realloc(client->channels, new_cap * sizeof(Membership *));
+        if (grown == NULL) {
+            log_perror("realloc");
+            return -1;
+        }
+        client->channels = grown;
+        client->channels_cap = new_cap;
+    }
+
+    Membership *member = (Membership *)pool_alloc(&membership_pool);
+    if (member == NULL) {
+        return -1;
+    }
+    member->client = client;
+    member->channel = channel;
+    member->chan_prev = NULL;
+    member->chan_next = channel->members;
+    if (channel->members != NULL) {
+        channel->members->chan_prev = member;
+    }
+    channel->members = member;
+    channel->activ_client++;
+    client->channels[client->channels_len++] = member;
+    return 1;
+}
+
+// Function to take a client out of one channel, destroying the channel once empty
+void channel_remove_member(ClientInfo *client, Channel *channel) {
+    int slot = channel_slot(client, channel);
+    if (slot < 0) {
+        return;
+    }
+    Membership *member = client->channels[slot];
+
+    if (member->chan_prev == NULL) {
+        channel->members = member->chan_next;
+    } else {
+        member->chan_prev->chan_next = member->chan_next;
+    }
+    if (member->chan_next != NULL) {
+        member->chan_next->chan_prev = member->chan_prev;
+    }
+    client->channels[slot] = client->channels[--client->channels_len];
+    pool_free(&membership_pool, member);
+
+    channel->activ_client--;
+    if (channel->members == NULL) {
+        destroy_channel(channel->channel_name);
+    }
+}
+
+// Function to take a client out of every channel it belongs to
+void channel_leave_all(ClientInfo *client) {
+    while (client->channels_len > 0) {
+        channel_remove_member(client, client->channels[client->channels_len - 1]->channel);
+    }
+    free(client->channels);
+    client->channels = NULL;
+    client->channels_cap = 0;
+}
+
 // Function to handle creating a new channel
 void handle_create(ClientInfo *client_list, char *nick_sender, char *c_name) {
     ClientInfo *client = nick_to_client(client_list, nick_sender);
-    struct message msgstruct;
+    struct message msgstruct = {0};
     char payload[INFOS_LEN];
 
-    // Check if the specified channel already exists
+    // Check if the specified channel already exists, then that the name is valid (it also names a
+    // directory with -d, so it must stay a plain alphanumeric file name)
     int channel_exists = check_channel_existence(client_list, c_name);
+    int name_valid = channel_exists || check_channel_name(c_name);
 
     if (client != NULL) {
-        char old_c_name[CHAN_LEN];
-        strncpy(old_c_name, client->channel, CHAN_LEN - 1);
-        old_c_name[CHAN_LEN - 1] = '\0';
-
-        if (channel_exists == 0) {
-            // Allocate memory for a new channel
-            Channel *new_c = (Channel *)malloc(sizeof(Channel));
-            if (new_c == NULL) {
-                fprintf(stderr, "Memory allocation error for the new channel.\n");
-                exit(EXIT_FAILURE);
-            }
-            // Initialize the new channel properties
-            strncpy(new_c->channel_name, c_name, CHAN_LEN - 1);
-            new_c->channel_name[CHAN_LEN - 1] = '\0';
-            new_c->activ_client = 0;
-            new_c->channel_next = NULL;
-            // Add the new channel to the channel list
-            if (channel_list == NULL) {
-                channel_list = new_c;
-            } else {
-                Channel *current_c = channel_list;
-                while (current_c->channel_next != NULL) {
-                    current_c = current_c->channel_next;
-                }
-                current_c->channel_next = new_c;
-            }
-            // Update client and channel information
-            Channel *channel = channel_info(channel_list, c_name);
-            if (channel != NULL) {
-                channel->activ_client++;
-            }
-            strncpy(client->channel, c_name, CHAN_LEN - 1);
-            client->channel[CHAN_LEN - 1] = '\0';
+        // The creator joins the new channel on top of the ones it is already in
+        Channel *new_c = (channel_exists || !name_valid || client->channels_len >= MAX_CLIENT_CHANNELS) ? NULL : addChannel(c_name);
+        if (new_c != NULL && channel_add_member(new_c, client) < 0) {
+            destroy_channel(new_c->channel_name);
+            new_c = NULL;
+        }
+        if (new_c != NULL) {
+            membership_generation++;
+
             // Send success message to the client
             msgstruct.type = MULTICAST_CREATE_SUCCESS;
             strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
@@ -373,94 +762,58 @@ void handle_create(ClientInfo *client_list, char *nick_sender, char *c_name) {
             strncpy(msgstruct.infos, c_name, INFOS_LEN - 1);
             msgstruct.infos[INFOS_LEN - 1] = '\0';
 
-            if (send(client->sockfd, &msgstruct, sizeof(struct message), 0) <= 0 ||
-                send(client->sockfd, payload, strlen(payload), 0) <= 0) {
-                perror("send");
-                printf( "Error: sending success message.\n" );
+            if (send_frame(client->sockfd, &msgstruct, payload, strlen(payload)) < 0) {
+                log_perror("send");
+                log_error("sending success message.");
             }
             // Notify other users in the channel
             char notification_message[MSG_LEN];
             snprintf(notification_message, MSG_LEN, ">> Channel"  " %s"  " has been created by"  " %s." , c_name, nick_sender);
             handle_multicast(client_list, nick_sender, notification_message, c_name);
-
-            // Notify the previous channel if the client left it
-            if (strlen(old_c_name) > 0) {
-                snprintf(notification_message, MSG_LEN, "Goodbye :)\n"  "[Server]:"  " %s left the channel.\n", nick_sender);
-                send_notification(old_c_name, notification_message, client_list, nick_sender);
-            }
-            printf( "%s "  "created a new channel: %s.\n" , nick_sender, c_name);
+            log_info("%s created a new channel: %s.", nick_sender, c_name);
 
         } else {
-            // Channel already exists; send error message to client
-            printf( "Error: "  "%s"  " tried creating a channel that already exists (%s).\n" , nick_sender, c_name);
+            // Channel already exists, its name is invalid or the client is in too many; send error message to client
+            log_error("%s could not create channel %s.", nick_sender, c_name);
             msgstruct.type = MULTICAST_CREATE_ERROR;
             strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
             msgstruct.nick_sender[NICK_LEN - 1] = '\0';
-            strncpy(payload, "Error creating channel. Channel already exists.", INFOS_LEN - 1);
+            strncpy(payload, channel_exists ? "Error creating channel. Channel already exists."
+                           : !name_valid ? "Error creating channel. Invalid channel name."
+                                         : "Error creating channel. Too many channels joined.", INFOS_LEN - 1);
             payload[INFOS_LEN - 1] = '\0';
             msgstruct.pld_len = strlen(payload);
             strncpy(msgstruct.infos, "", INFOS_LEN - 1);
             msgstruct.infos[INFOS_LEN - 1] = '\0';
 
-            if (send(client->sockfd, &msgstruct, sizeof(struct message), 0) <= 0 ||
-                send(client->sockfd, payload, strlen(payload), 0) <= 0) {
-                perror("send");
-                printf( "Error: sending error message to the requester.\n" );
+            if (send_frame(client->sockfd, &msgstruct, payload, strlen(payload)) < 0) {
+                log_perror("send");
+                log_error("sending error message to the requester.");
             }
         }
     } else {
-        // Client not found; send error message
-        printf( "Error: Client not found.\n" );
-        msgstruct.type = MULTICAST_CREATE_ERROR;
-        strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
-        msgstruct.nick_sender[NICK_LEN - 1] = '\0';
-        strncpy(payload, "Error creating channel. Client not found.", INFOS_LEN - 1);
-        payload[INFOS_LEN - 1] = '\0';
-        msgstruct.pld_len = strlen(payload);
-        strncpy(msgstruct.infos, "", INFOS_LEN - 1);
-        msgstruct.infos[INFOS_LEN - 1] = '\0';
-
-        if (send(client->sockfd, &msgstruct, sizeof(struct message), 0) <= 0 ||
-            send(client->sockfd, payload, strlen(payload), 0) <= 0) {
-            perror("send");
-            printf( "Error: sending error message to the requester.\n" );
-        }
+        // Client not found; nobody to answer
+        log_error("Client not found.");
     }
 }
 
 // Function to handle joining an existing channel
 void handle_join(ClientInfo *client_list, char *nick_sender, char *channel_name) {
     ClientInfo *client = nick_to_client(client_list, nick_sender);
-    struct message msg;
+    struct message msg = {0};
     char buffer_pld[MSG_LEN];
 
     if (client != NULL) {
-        // Store the name of the old channel before joining the new channel
-        char old_channel_name[CHAN_LEN];
-        strncpy(old_channel_name, client->channel, CHAN_LEN - 1);
-        old_channel_name[CHAN_LEN - 1] = '\0';
+        // Find the channel by name
+        Channel *channel_to_join = channel_info(channel_list, channel_name);
 
-        if (check_channel_existence(client_list, channel_name)) {
-            // Find the channel by name
-            Channel *channel_to_join = channel_info(channel_list, channel_name);
+        // Add the channel to the ones the client is in, joining twice only selects it again
+        int joined = channel_to_join != NULL ? channel_add_member(channel_to_join, client) : -1;
 
-
-            // Inform clients in the old channel (if applicable)
-            char notification_message_new_2[MSG_LEN];
-            
-            if (strlen(old_channel_name) != 0) {
-                snprintf(notification_message_new_2, MSG_LEN, "Goodbye :)\n""[Server]:"" %s left the channel.\n", nick_sender);
-                handle_multicast(client_list, nick_sender, notification_message_new_2, old_channel_name);
-            }
-
-            // Add the client to the new channel
-            strncpy(client->channel, channel_name, CHAN_LEN - 1);
-            client->channel[CHAN_LEN - 1] = '\0';
-
-            // Increment the value of activ_client for the new channel
-            if (channel_to_join != NULL) {
-                channel_to_join->activ_client++;
-            }
+        if (joined == 1) {
+            membership_generation++;
+        }
+        if (joined >= 0) {
             // Send a success message to the client
             msg.type = MULTICAST_JOIN_SUCCESS;
             strncpy(msg.nick_sender, "Server", NICK_LEN - 1);
@@ -471,133 +824,253 @@ void handle_join(ClientInfo *client_list, char *nick_sender, char *channel_name)
             snprintf(buffer_pld, MSG_LEN, "You joined channel %s.", channel_name);
             msg.pld_len = strlen(buffer_pld);
 
-            if (send(client->sockfd, &msg, sizeof(struct message), 0) <= 0 ||
-                send(client->sockfd, buffer_pld, msg.pld_len, 0) <= 0) {
-                perror("send");
-                printf( "Error: sending the success message.\n" );
+            if (send_frame(client->sockfd, &msg, buffer_pld, msg.pld_len) < 0) {
+                log_perror("send");
+                log_error("sending the success message.");
             }
 
             // Notify clients in the new channel
-            char notification_message_new_1[MSG_LEN];
-            snprintf(notification_message_new_1, MSG_LEN, "Hello, i just joined this channel !\n");
-            handle_multicast(client_list, nick_sender, notification_message_new_1, channel_name);
-
-
-            printf("%s"" joined channel %s\n" , nick_sender, channel_name);
+            if (joined == 1) {
+                char notification_message_new_1[MSG_LEN];
+                snprintf(notification_message_new_1, MSG_LEN, "Hello, i just joined this channel !\n");
+                handle_multicast(client_list, nick_sender, notification_message_new_1, channel_name);
+                log_info("%s joined channel %s", nick_sender, channel_name);
+            }
         } else {
-            // Handling an invalid channel name
+            // Handling an invalid channel name or a full membership set
+            const char *reason = channel_to_join == NULL ? "Invalid channel name. Use only letters and numbers."
+                                                         : "Too many channels joined.";
             msg.type = MULTICAST_JOIN_ERROR;
             strncpy(msg.nick_sender, "Server", NICK_LEN - 1);
             msg.nick_sender[NICK_LEN - 1] = '\0';
-            strncpy(msg.infos, "Invalid channel name. Use only letters and numbers.", INFOS_LEN - 1);
+            strncpy(msg.infos, reason, INFOS_LEN - 1);
             msg.infos[INFOS_LEN - 1] = '\0';
             msg.pld_len = strlen(msg.infos);
 
-            snprintf(buffer_pld, MSG_LEN, "Invalid channel name. Use only letters and numbers.");
-            if (send(client->sockfd, &msg, sizeof(struct message), 0) <= 0 ||
-                send(client->sockfd, buffer_pld, strlen(buffer_pld), 0) <= 0) {
-                perror("send");
-                printf( "Error: sending the error message to the client.\n" );
+            snprintf(buffer_pld, MSG_LEN, "%s", reason);
+            if (send_frame(client->sockfd, &msg, buffer_pld, strlen(buffer_pld)) < 0) {
+                log_perror("send");
+                log_error("sending the error message to the client.");
             }
         }
     } else {
         // Handling an unfound client
-        printf( "Error: Client not found.\n" );
+        log_error("Client not found.");
+    }
+}
+
+// Function to build the /channel_list reply, the same for every requester
+static SharedFrame *channel_list_build(int version) {
+    char msg[MSG_LEN];
+    size_t len = 0;
+    int unique_channel_count = 0;
+
+    // The header is written last, once the count is known; whole lines only
+    char channels[MSG_LEN - sizeof(" Active channels (2147483647):\n")];
+    for (Channel *channel = channel_list; channel != NULL; channel = channel->channel_next) {
+        int n = snprintf(channels + len, sizeof(channels) - len, "  - %s (%d online)\n",
+                         channel->channel_name, channel->activ_client);
+        if (n < 0 || (size_t)n >= sizeof(channels) - len) {
+            break;
+        }
+        len += n;
+        unique_channel_count++;
     }
+    channels[len] = '\0';
+    snprintf(msg, MSG_LEN, " Active channels (%d):\n%s", unique_channel_count,
+             unique_channel_count > 0 ? channels : " - no active channels.\n");
+
+    struct message msgstruct = { .type = MULTICAST_LIST, .pld_len = strlen(msg) };
+    strcpy(msgstruct.nick_sender, "Server");
+    return shared_frame_new(version, &msgstruct, msg, msgstruct.pld_len);
 }
 
 // Function to list all available channels
+// Clients mark the channels they are in, so one reply per membership generation serves everyone
 void handle_channel_list(ClientInfo *client_list, char *nickname_sender) {
     ClientInfo *client = nick_to_client(client_list, nickname_sender);
+    if (client == NULL) {
+        log_info("Client not found.");
+        return;
+    }
 
-    if (client != NULL) {
-        int sockfd = client->sockfd;
-        char channels[CHAN_LEN * 50] = {0}; // Buffer for channels list
-        char added_channels[50][CHAN_LEN] = {0}; // Track added channels
-        int unique_channel_count = 0;
-
-        ClientInfo *current = client_list;
-
-        while (current != NULL) {
-            if (strlen(current->channel) > 0) {
-                int already_added = 0;
-                for (int i = 0; i < unique_channel_count; i++) {
-                    if (strcmp(added_channels[i], current->channel) == 0) {
-                        already_added = 1;
-                        break;
-                    }
-                }
-
-                if (!already_added) {
-                    Channel *channel = channel_info(channel_list, current->channel);
-                    int num_connected = (channel != NULL) ? channel->activ_client : 0;
+    int v2 = client->proto == PROTO_V2;
+    SharedFrame *reply = snapshot_get(&channel_list_snapshot, 1, 0, v2);
+    if (reply == NULL) {
+        reply = channel_list_build(v2 ? PROTO_V2 : PROTO_V1);
+        if (reply == NULL) {
+            metrics_add(&thread_metrics->send_errors, 1);
+            return;
+        }
+        snapshot_put(&channel_list_snapshot, 1, 0, v2, reply);
+    }
+    if (send_shared(client, reply, MULTICAST_LIST) < 0) {
+        log_perror("send");
+        log_error("sending message to the requester.");
+    }
+    shared_frame_release(reply);
+}
 
-                    snprintf(added_channels[unique_channel_count], CHAN_LEN, "%s", current->channel);
-                    unique_channel_count++;
+// /history reply being built, one MSG_LEN chunk at a time
+typedef struct HistoryReply {
+    SharedFrame *frames;
+    size_t cap;
+    int version;
+    char chunk[MSG_LEN];
+    size_t len;
+    int failed;
+} HistoryReply;
+
+// Function to add the chunk built so far to the /history reply as one MULTICAST_HISTORY frame
+static void history_reply_flush(HistoryReply *reply, const char *infos) {
+    struct message msgstruct = { .type = MULTICAST_HISTORY, .pld_len = reply->len };
+    strcpy(msgstruct.nick_sender, "Server");
+    strcpy(msgstruct.infos, infos);
+    if (!reply->failed && shared_frame_append(&reply->frames, &reply->cap, reply->version, &msgstruct, reply->chunk, reply->len) < 0) {
+        reply->failed = 1;
+    }
+    reply->len = 0;
+}
 
-                    snprintf(channels + strlen(channels), CHAN_LEN * 50 - strlen(channels),
-                             "  - %s (%d online%s)\n", current->channel, num_connected,
-                             (strcmp(nickname_sender, current->nickname) == 0) ? ", me" : "");
-                }
-            }
-            current = current->next;
-        }
+// Function to write one past message into the /history reply, starting a new chunk when it is full
+static void history_reply_line(void *ctx, long long time_ms, const char *text, size_t len) {
+    HistoryReply *reply = ctx;
+    char stamp[16];
+    time_t seconds = time_ms / 1000;
+    struct tm tm;
+    size_t stamp_len = strftime(stamp, sizeof(stamp), "[%H:%M:%S] ", localtime_r(&seconds, &tm));
+
+    // Some messages (join notices) already end their line
+    if (len > 0 && text[len - 1] == '\n') {
+        len--;
+    }
+    if (len > MSG_LEN - 1 - stamp_len - 1) {
+        len = MSG_LEN - 1 - stamp_len - 1;
+    }
+    if (reply->len + stamp_len + len + 1 > MSG_LEN - 1) {
+        history_reply_flush(reply, "more");
+    }
+    memcpy(reply->chunk + reply->len, stamp, stamp_len);
+    memcpy(reply->chunk + reply->len + stamp_len, text, len);
+    reply->len += stamp_len + len;
+    reply->chunk[reply->len++] = '\n';
+}
 
-        char msg[MSG_LEN];
-        snprintf(msg, MSG_LEN, " Active channels (%d):\n%s", unique_channel_count, 
-                 unique_channel_count > 0 ? channels : " - no active channels.\n");
+// Function to send the last messages of a channel back to one of its members
+// The messages are packed into MSG_LEN chunks, queued together as one buffer;
+// the last chunk has infos "end", the others "more"
+void handle_history(ClientInfo *client_list, char *nickname_sender, char *channel_name, char *count) {
+    ClientInfo *client = nick_to_client(client_list, nickname_sender);
+    Channel *channel = channel_info(channel_list, channel_name);
+    if (client == NULL) {
+        log_error("Client not found.");
+        return;
+    }
 
-        struct message msgstruct = { .type = MULTICAST_LIST, .pld_len = strlen(msg) };
-        strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
-        msgstruct.nick_sender[NICK_LEN - 1] = '\0';
-        msgstruct.infos[0] = '\0';
+    int wanted = count[0] != '\0' ? atoi(count) : HISTORY_DEFAULT;
+    if (wanted < 1) {
+        wanted = HISTORY_DEFAULT;
+    } else if (wanted > HISTORY_MAX_REQUEST) {
+        wanted = HISTORY_MAX_REQUEST;
+    }
 
-        if (send(sockfd, &msgstruct, sizeof(msgstruct), 0) <= 0 ||
-            send(sockfd, msg, strlen(msg), 0) <= 0) {
-            perror("send");
-            printf("[Server]: Error sending message to the requester.\n");
+    HistoryReply *reply = malloc(sizeof(HistoryReply));
+    if (reply == NULL) {
+        log_perror("malloc");
+        return;
+    }
+    reply->frames = NULL;
+    reply->cap = 0;
+    reply->version = client->proto == PROTO_V2 ? PROTO_V2 : PROTO_V1;
+    reply->failed = 0;
+
+    // Like channel messages, history is for members only
+    // Segments are mapped with the shared registry_lock dropped: the log is held open in case the
+    // channel goes away meanwhile, and only this worker removes the client
+    int found = -1;
+    if (channel != NULL && channel_membership(client, channel) != NULL && channel->history != NULL) {
+        HistoryLog *log = history_open(channel->channel_name);
+        reply->len = snprintf(reply->chunk, MSG_LEN, " Last messages of %s:\n", channel_name);
+        pthread_rwlock_unlock(&registry_lock);
+        if (log != NULL) {
+            found = history_read(log, wanted, history_reply_line, reply);
+            history_close(log);
         }
-    } else {
-        printf( "Client not found.\n" );
+        pthread_rwlock_rdlock(&registry_lock);
+    }
+    if (found < 0 && channel_name[0] == '\0') {
+        reply->len = snprintf(reply->chunk, MSG_LEN, " You are not in a channel.\n");
+    } else if (found < 0) {
+        reply->len = snprintf(reply->chunk, MSG_LEN, " You are not in channel %s.\n", channel_name);
+    } else if (found == 0) {
+        reply->len += snprintf(reply->chunk + reply->len, MSG_LEN - reply->len, " - no messages yet.\n");
+    }
+    history_reply_flush(reply, "end");
+
+    if (reply->failed) {
+        metrics_add(&thread_metrics->send_errors, 1);
+    } else if (send_shared(client, reply->frames, MULTICAST_HISTORY) < 0) {
+        log_perror("send");
     }
+    if (reply->frames != NULL) {
+        shared_frame_release(reply->frames);
+    }
+    free(reply);
+    log_info("%d past messages of channel %s sent to %s.", found > 0 ? found : 0, channel_name, nickname_sender);
 }
 
-// Function to handle multicast messages
+// Function to handle multicast messages (touches only the channel's members)
 void handle_multicast(ClientInfo *client_list, char *nickname_sender, char *message, char *channel_name) {
     ClientInfo *sender = nick_to_client(client_list, nickname_sender);
-    message[MSG_LEN - 1] = '\0';
+    Channel *channel = channel_info(channel_list, channel_name);
 
     if (sender == NULL) {
-        printf( "Error: Client not found.\n" );
+        log_error("Client not found.");
         return;
     }
 
-    // Verify sender is in the specified channel
-   
-
-    int success = 1; // Track if all sends are successful
-    for (ClientInfo *current = client_list; current != NULL; current = current->next) {
-        if (current != sender && strcmp(current->channel, channel_name) == 0) {
-            struct message msg = { .type = MULTICAST_SEND };
-            char buffer_pld[MSG_LEN];
+    // Only members may write to a channel
+    int is_member = channel != NULL && channel_membership(sender, channel) != NULL;
+    int success = is_member; // Track if all sends are successful
+    if (!success) {
+        log_info("%s is not a member of channel %s", nickname_sender, channel_name);
+    }
 
-            strncpy(msg.nick_sender, nickname_sender, NICK_LEN - 1);
-            msg.nick_sender[NICK_LEN - 1] = '\0';
-            msg.infos[0] = '\0';
-            
-            snprintf(buffer_pld, MSG_LEN,  "[%s]: "  "%s", nickname_sender, message);
-            msg.pld_len = strlen(buffer_pld);
+    // Every member gets the same bytes: format and encode them once
+    struct message msg = { .type = MULTICAST_SEND };
+    char buffer_pld[MSG_LEN];
+    Fanout fanout;
 
-            if (send(current->sockfd, &msg, sizeof(msg), 0) <= 0 || send(current->sockfd, buffer_pld, strlen(buffer_pld), 0) <= 0) {
-                perror("send");
-                printf( "Error: sending message to client %s.\n" , current->nickname);
+    strncpy(msg.nick_sender, nickname_sender, NICK_LEN - 1);
+    msg.nick_sender[NICK_LEN - 1] = '\0';
+    // Name the channel, the recipient may be in several
+    strncpy(msg.infos, channel_name, INFOS_LEN - 1);
+    msg.infos[INFOS_LEN - 1] = '\0';
+    snprintf(buffer_pld, MSG_LEN,  "[%s]: "  "%s", nickname_sender, message);
+    msg.pld_len = strlen(buffer_pld);
+    fanout_init(&fanout, &msg, buffer_pld, msg.pld_len);
+
+    int recipients = 0;
+    for (Membership *member = is_member ? channel->members : NULL; member != NULL; member = member->chan_next) {
+        ClientInfo *current = member->client;
+        if (current != sender) {
+            if (fanout_send(&fanout, current->sockfd) < 0) {
+                log_trace("Could not queue a channel message for %s.", current->nickname);
                 success = 0;
             }
+            recipients++;
+        }
+    }
+    fanout_done(&fanout);
+    if (is_member) {
+        metrics_fanout(FANOUT_MULTICAST, recipients);
+        if (channel->history != NULL) {
+            history_append(channel->history, buffer_pld, msg.pld_len);
         }
     }
 
     // Send success or error notification back to the sender
-    struct message response_msg;
+    struct message response_msg = {0};
     char response_pld[MSG_LEN];
     response_msg.type = success ? MULTICAST_SEND_SUCCESS : MULTICAST_SEND_ERROR;
     strncpy(response_msg.nick_sender, "Server", NICK_LEN - 1);
@@ -607,7 +1080,7 @@ void handle_multicast(ClientInfo *client_list, char *nickname_sender, char *mess
         strncpy(response_msg.infos, "Message sent successfully.", INFOS_LEN - 1);
         response_msg.infos[INFOS_LEN - 1] = '\0';
         snprintf(response_pld, MSG_LEN, "Your message was sent successfully.");
-        printf( "%s"  " sent a multicast message to channel %s\n" , nickname_sender, channel_name);
+        log_info("%s sent a multicast message to channel %s", nickname_sender, channel_name);
     } else {
         strncpy(response_msg.infos, "Failed to send message.", INFOS_LEN - 1);
         response_msg.infos[INFOS_LEN - 1] = '\0';
@@ -615,23 +1088,22 @@ void handle_multicast(ClientInfo *client_list, char *nickname_sender, char *mess
     }
     response_msg.pld_len = strlen(response_pld);
 
-    if (send(sender->sockfd, &response_msg, sizeof(response_msg), 0) <= 0 ||
-        send(sender->sockfd, response_pld, strlen(response_pld), 0) <= 0) {
-        perror("send");
-        printf( "Error: sending response to client %s.\n" , sender->nickname);
+    if (send_frame(sender->sockfd, &response_msg, response_pld, strlen(response_pld)) < 0) {
+        log_perror("send");
+        log_error("sending response to client %s.", sender->nickname);
     }
 }
 
 // Funciton to quit a channel
 void handle_quit(ClientInfo *client_list, char *nickname_sender, char *channel_to_quit) {
     ClientInfo *client = nick_to_client(client_list, nickname_sender);
-    struct message msgstruct;
+    struct message msgstruct = {0};
     char buffer_pld[INFOS_LEN];
 
     if (client != NULL) {
         Channel *channel_to_leave = channel_info(channel_list, channel_to_quit);
 
-        if (channel_to_leave != NULL && strcmp(client->channel, channel_to_quit) == 0) {
+        if (channel_to_leave != NULL && channel_membership(client, channel_to_leave) != NULL) {
             char multicast_message[MSG_LEN];
 
             snprintf(multicast_message, MSG_LEN, "Goodbye :)\n""[Server]:"" %s left the channel.\n", nickname_sender);
@@ -640,12 +1112,10 @@ void handle_quit(ClientInfo *client_list, char *nickname_sender, char *channel_t
             if (channel_to_leave->activ_client == 1) {
                 snprintf(multicast_message, MSG_LEN,  "[Server]:""you were the last user in the channel" " %s"  "\nchannel closed.\n", channel_to_leave->channel_name);
                 send_notification2(client_list, channel_to_quit, multicast_message, nickname_sender);
-                destroy_channel(channel_to_leave->channel_name);
-            } else {
-                channel_to_leave->activ_client--;
             }
-            strncpy(client->channel, "", CHAN_LEN - 1);
-            client->channel[CHAN_LEN - 1] = '\0';
+            // The channel is destroyed with its last member
+            channel_remove_member(client, channel_to_leave);
+            membership_generation++;
 
             
             msgstruct.type = MULTICAST_QUIT_SUCCESS;
@@ -659,14 +1129,11 @@ void handle_quit(ClientInfo *client_list, char *nickname_sender, char *channel_t
 
             msgstruct.pld_len = strlen(buffer_pld);
 
-            if (send(client->sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
-                perror("send");
-                printf( "Error: sending success message to the client.\n" );
-            } else if (send(client->sockfd, buffer_pld, msgstruct.pld_len, 0) <= 0) {
-                perror("send");
-                printf( "Error: sending success message content to the client.\n" );
+            if (send_frame(client->sockfd, &msgstruct, buffer_pld, msgstruct.pld_len) < 0) {
+                log_perror("send");
+                log_error("sending success message to the client.");
             }
-            printf( "%s"" left channel %s\n" , nickname_sender,channel_to_quit);
+            log_info("%s left channel %s", nickname_sender,channel_to_quit);
         } else {
             // Gestion d'un client n'étant pas dans le salon spécifié
             msgstruct.type = MULTICAST_QUIT_ERROR;
@@ -681,17 +1148,14 @@ void handle_quit(ClientInfo *client_list, char *nickname_sender, char *channel_t
             msgstruct.pld_len = strlen(buffer_pld);
 
             
-            if (send(client->sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
-                perror("send");
-                printf( "Error: sending error message to the client.\n" );
-            } else if (send(client->sockfd, buffer_pld, msgstruct.pld_len, 0) <= 0) {
-                perror("send");
-                printf( "Error: sending error message content to the client.\n" );
+            if (send_frame(client->sockfd, &msgstruct, buffer_pld, msgstruct.pld_len) < 0) {
+                log_perror("send");
+                log_error("sending error message to the client.");
             }
         }
     } else {
         // Gestion d'un client introuvable
-        printf( "Client not found.\n" );
+        log_info("Client not found.");
 
         msgstruct.type = MULTICAST_QUIT_ERROR;
         strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
@@ -703,45 +1167,67 @@ void handle_quit(ClientInfo *client_list, char *nickname_sender, char *channel_t
         buffer_pld[INFOS_LEN - 1] = '\0';
 
         msgstruct.pld_len = strlen(buffer_pld);
-        if (send(client->sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
-            perror("send");
-        } else if (send(client->sockfd, buffer_pld, msgstruct.pld_len, 0) <= 0) {
-            perror("send");
+        if (send_frame(client->sockfd, &msgstruct, buffer_pld, msgstruct.pld_len) < 0) {
+            log_perror("send");
         }
     }
 }
 
-// Function to destroy a channel
+// Function to destroy a channel, its members are moved out first
 void destroy_channel(char *c_name) {
-    Channel *prev_c = NULL;
-    Channel *curr_c = channel_list;
+    Channel *curr_c = channel_info(channel_list, c_name);
+    if (curr_c == NULL) {
+        log_info("Channel '%s' not found.", c_name);
+        return;
+    }
 
-    while (curr_c != NULL) {
-        if (strcmp(curr_c->channel_name, c_name) == 0) {
-            if (prev_c == NULL) {
-                channel_list = curr_c->channel_next;
-            } 
-            else {
-                prev_c->channel_next = curr_c->channel_next;
-            }
-            free(curr_c);
-            return;
-        }
-        prev_c = curr_c;
-        curr_c = curr_c->channel_next;
+    while (curr_c->members != NULL) {
+        Membership *member = curr_c->members;
+        ClientInfo *client = member->client;
+        int slot = channel_slot(client, curr_c);
+        client->channels[slot] = client->channels[--client->channels_len];
+        curr_c->members = member->chan_next;
+        pool_free(&membership_pool, member);
+    }
+
+    // Unlink from the registry bucket
+    Channel **link = &channel_table[curr_c->hash & (channel_table_size - 1)];
+    while (*link != curr_c) {
+        link = &(*link)->hash_next;
+    }
+    *link = curr_c->hash_next;
+
+    // Unlink from the ordered list in O(1) using the back pointer
+    if (curr_c->channel_prev == NULL) {
+        channel_list = curr_c->channel_next;
+    } else {
+        curr_c->channel_prev->channel_next = curr_c->channel_next;
+    }
+    if (curr_c->channel_next == NULL) {
+        channel_tail = curr_c->channel_prev;
+    } else {
+        curr_c->channel_next->channel_prev = curr_c->channel_prev;
     }
-    fprintf(stderr, "Channel '%s' not found.\n", c_name);
+    channel_count--;
+    if (curr_c->history != NULL) {
+        history_close(curr_c->history);
+    }
+    pool_free(&channel_pool, curr_c);
+    membership_generation++;
 }
 
-// Function to find channel info using its name
+// Function to find channel info using its name (hashed registry lookup)
 Channel* channel_info(Channel *c_list, char *c_name) {
-    Channel *curr = c_list;
+    (void)c_list;
+    if (channel_table_size == 0) {
+        return NULL;
+    }
 
-    while (curr != NULL) {
-        if (strcmp(curr->channel_name, c_name) == 0) {
+    uint32_t hash = channel_hash(c_name);
+    for (Channel *curr = channel_table[hash & (channel_table_size - 1)]; curr != NULL; curr = curr->hash_next) {
+        if (curr->hash == hash && strcmp(curr->channel_name, c_name) == 0) {
             return curr;
         }
-        curr = curr->channel_next;
     }
     return NULL;
 }
@@ -753,11 +1239,11 @@ void send_notification(char *channel_name, char *message, ClientInfo *client_lis
 
     // If the channel does not exist, log an error message and exit
     if (channel == NULL) {
-        printf("Channel '%s' does not exist.\n", channel_name);
+        log_info("Channel '%s' does not exist.", channel_name);
         return;
     }
 
-    struct message msgstruct;
+    struct message msgstruct = {0};
     // Set the sender nickname and message type
     snprintf(msgstruct.nick_sender, NICK_LEN, "%s", sender_nick);
     msgstruct.type = MULTICAST_SEND;
@@ -772,34 +1258,30 @@ void send_notification(char *channel_name, char *message, ClientInfo *client_lis
 
 // Function to notify all clients in a specific channel with a message
 void send_notification2(ClientInfo *client_list, char *channel_name, char *message, char *sender_nick) {
-    // Traverse the client list to find clients in the specified channel
-    ClientInfo *current = client_list;
-    while (current != NULL) {
-        // Check if the client is in the target channel
-        if (strcmp(current->channel, channel_name) == 0) {
-            struct message msgstruct;
-            // Set the sender nickname and message type
-            snprintf(msgstruct.nick_sender, NICK_LEN, "%s", sender_nick);
-            msgstruct.type = MULTICAST_SEND;
-            // Include null terminator in payload length
-            msgstruct.pld_len = strlen(message) + 1;
-            // Store channel information in the message
-            snprintf(msgstruct.infos, INFOS_LEN, "%s", channel_name);
-
-            // Send the structured message to the client
-            if (send(current->sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
-                perror("send");
-                printf( "[Server]: --> Error sending multicast message to %s.\n" , current->nickname);
-            }
-            // Send the message content to the client
-            else if (send(current->sockfd, message, msgstruct.pld_len, 0) <= 0) {
-                perror("send");
-                printf( "[Server]: --> Error sending multicast message content to %s.\n" , current->nickname);
-            }
+    // Traverse the member list of the channel
+    Channel *channel = channel_info(channel_list, channel_name);
+    Membership *member = channel != NULL ? channel->members : NULL;
+    struct message msgstruct = {0};
+    // Set the sender nickname and message type
+    snprintf(msgstruct.nick_sender, NICK_LEN, "%s", sender_nick);
+    msgstruct.type = MULTICAST_SEND;
+    // Include null terminator in payload length
+    msgstruct.pld_len = strlen(message) + 1;
+    // Store channel information in the message
+    snprintf(msgstruct.infos, INFOS_LEN, "%s", channel_name);
+
+    Fanout fanout;
+    fanout_init(&fanout, &msgstruct, message, msgstruct.pld_len);
+    while (member != NULL) {
+        ClientInfo *current = member->client;
+        // Send the structured message and its content to the client
+        if (fanout_send(&fanout, current->sockfd) < 0) {
+            log_trace("Could not queue a channel notification for %s.", current->nickname);
         }
-        // Move to the next client in the list
-        current = current->next;
+        // Move to the next member of the channel
+        member = member->chan_next;
     }
+    fanout_done(&fanout);
 }
 
 
@@ -807,83 +1289,98 @@ void send_notification2(ClientInfo *client_list, char *channel_name, char *messa
 
 
 ////////////////////////////////////// Messaging Functions //////////////////////////////////////
-// Function to handle who message
-void handle_who(int sockfd, ClientInfo *clients_list) {
-    ClientInfo *curr = clients_list;
-    char nlist[MSG_LEN] = "";
-
-    char requester[NICK_LEN];
-    strncpy(requester, sockfd_to_nick(clients_list, sockfd), NICK_LEN - 1);
-    requester[NICK_LEN - 1] = '\0';
-
-    int online_users = 0; 
-    while (curr != NULL) {
-        if (curr->sockfd != sockfd) {
-            size_t remaining_space = MSG_LEN - strlen(nlist) - 1;
-            size_t nlength = strlen(curr->nickname);
-
-            if (nlength <= remaining_space) {
-                strcat(nlist, "\n  - ");
-
-                if (strcmp(curr->nickname, requester) == 0) {
-                    strcat(nlist, curr->nickname);
-                    strcat(nlist, " (me)");
-                } else {
-                    strcat(nlist, curr->nickname);
-                }
-                online_users++; 
-            } else {
-                break;
-            }
-        } else {
-            size_t remaining_space = MSG_LEN - strlen(nlist) - 1; 
-            size_t nlength = strlen(requester) + strlen(" (me)");
-
-            if (nlength <= remaining_space) {
-                strcat(nlist, "\n  - ");
-                strcat(nlist, requester);
-                strcat(nlist, " (me)");
-                online_users++; 
-                
-            } else {
-                break;
+// Function to add one chunk of a /who reply to the frames being built
+static int who_add_chunk(SharedFrame **reply, size_t *cap, int version, const char *infos, const char *chunk, size_t len) {
+    struct message msgstruct = {0};
+    msgstruct.type = NICKNAME_LIST;
+    strcpy(msgstruct.nick_sender, "Server");
+    snprintf(msgstruct.infos, sizeof(msgstruct.infos), "%s", infos);
+    msgstruct.pld_len = len;
+    return shared_frame_append(reply, cap, version, &msgstruct, chunk, len);
+}
+
+// Function to build a /who page: the users whose nickname starts with prefix, walking
+// the user table from slot cursor. Entries are written one after the other into
+// MSG_LEN chunks, each encoded as a NICKNAME_LIST frame with infos "more". After
+// WHO_PAGE_USERS entries the last chunk says "next <cursor>" and the client asks
+// for the rest; the chunk that ends the list says "end". The page is the same for
+// every requester (clients mark their own nickname), so it can be shared.
+static SharedFrame *who_build_page(int version, int cursor, const char *prefix) {
+    SharedFrame *reply = NULL;
+    size_t cap = 0;
+    size_t prefix_len = strlen(prefix);
+    char chunk[MSG_LEN];
+    size_t len = 0;
+    int listed = 0;
+    int slot;
+    for (slot = cursor; slot < uid_next_slot && listed < WHO_PAGE_USERS; slot++) {
+        ClientInfo *client = uid_table[slot].client;
+        if (client == NULL || strncasecmp(client->nickname, prefix, prefix_len) != 0) {
+            continue;
+        }
+        size_t nick_len = strlen(client->nickname);
+        if (len + nick_len + sizeof("\n  - ") > sizeof(chunk)) {
+            if (who_add_chunk(&reply, &cap, version, "more", chunk, len) < 0) {
+                return NULL;
             }
+            len = 0;
         }
-        curr = curr->next;
+        memcpy(chunk + len, "\n  - ", 5);
+        memcpy(chunk + len + 5, client->nickname, nick_len);
+        len += 5 + nick_len;
+        listed++;
     }
 
-    
-    char count_clients_str[20];
-    sprintf(count_clients_str, "(%d)", online_users);
-
-    char msg[MSG_LEN] = " Online users ";
-    if (online_users == 0) {
-        strcat(msg, "(0 users): \n");
-        strcat(msg, " - There are no connected users.\n");
+    char infos[INFOS_LEN];
+    if (slot < uid_next_slot) {
+        snprintf(infos, INFOS_LEN, "next %d", slot);
     } else {
-        strcat(msg, count_clients_str);
-        strcat(msg, ":");
-        strcat(msg, nlist);
+        strcpy(infos, "end");
     }
+    if (who_add_chunk(&reply, &cap, version, infos, chunk, len) < 0) {
+        return NULL;
+    }
+    return reply;
+}
 
-    struct message msgstruct;
-    msgstruct.type = NICKNAME_LIST;
-    strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
-    msgstruct.nick_sender[NICK_LEN - 1] = '\0';
-    msgstruct.pld_len = strlen(msg);
-    strncpy(msgstruct.infos, "", INFOS_LEN - 1);
-    msgstruct.infos[INFOS_LEN - 1] = '\0';
-
+// Function to handle who message
+// request is "[cursor] [prefix]"; pages of the whole list come from the snapshots of
+// the current membership generation, so a repeated /who is a single enqueue
+void handle_who(int sockfd, char *request, ClientInfo *clients_list) {
+    ClientInfo *requester = sockfd_to_client(clients_list, sockfd);
+    if (requester == NULL) {
+        return;
+    }
 
-    if (send(sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
-        perror("send");
+    char *prefix;
+    unsigned long cursor = strtoul(request, &prefix, 10);
+    while (*prefix == ' ') {
+        prefix++;
+    }
+    if (cursor < 1) {
+        cursor = 1;
+    } else if (cursor > (unsigned long)uid_next_slot) {
+        cursor = uid_next_slot;
     }
 
-    if (send(sockfd, msg, strlen(msg), 0) <= 0) {
-        perror("send");
+    int v2 = requester->proto == PROTO_V2;
+    SharedFrame *reply = prefix[0] == '\0' ? snapshot_get(who_snapshots, WHO_SNAPSHOT_PAGES, (int)cursor, v2) : NULL;
+    if (reply == NULL) {
+        reply = who_build_page(v2 ? PROTO_V2 : PROTO_V1, (int)cursor, prefix);
+        if (reply == NULL) {
+            metrics_add(&thread_metrics->send_errors, 1);
+            return;
+        }
+        if (prefix[0] == '\0') {
+            snapshot_put(who_snapshots, WHO_SNAPSHOT_PAGES, (int)cursor, v2, reply);
+        }
+    }
+    if (send_shared(requester, reply, NICKNAME_LIST) < 0) {
+        log_perror("send");
     }
+    shared_frame_release(reply);
 
-    printf( "List of connected users sent to ""%s.\n" , requester);
+    log_info("Connected users from slot %lu sent to %s.", cursor, requester->nickname);
 }
 
 // Function to handle whois message
@@ -891,22 +1388,18 @@ void handle_whois(int sockfd, char *rqstnick, ClientInfo *clients_list) {
     char buff_res[MSG_LEN];
     memset(buff_res, 0, MSG_LEN);
 
-    ClientInfo *current = clients_list;
+    ClientInfo *current = nick_to_client(clients_list, rqstnick);
     int exists = 0; 
 
-    while (current != NULL) {
-        if (strcmp(current->nickname, rqstnick) == 0) {
-            exists = 1;
-            struct sockaddr_in clientAddr = current->address;
-            char ip_str[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &(clientAddr.sin_addr), ip_str, INET_ADDRSTRLEN);
-            snprintf(buff_res, MSG_LEN, "[Server]:"" %s"" connected since %s with IP address %s and port number %d\n", current->nickname, ctime(&current->connect_time), ip_str, ntohs(current->port_number));
-            break;
-        }
-        current = current->next;
+    if (current != NULL) {
+        exists = 1;
+        struct sockaddr_in clientAddr = current->address;
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(clientAddr.sin_addr), ip_str, INET_ADDRSTRLEN);
+        snprintf(buff_res, MSG_LEN, "[Server]:"" %s"" connected since %s with IP address %s and port number %d\n", current->nickname, ctime(&current->connect_time), ip_str, ntohs(current->port_number));
     }
 
-    struct message msgstruct;
+    struct message msgstruct = {0};
     msgstruct.type = NICKNAME_INFOS;
     strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
     msgstruct.nick_sender[NICK_LEN - 1] = '\0';
@@ -921,20 +1414,16 @@ void handle_whois(int sockfd, char *rqstnick, ClientInfo *clients_list) {
     strncpy(msgstruct.infos, rqstnick, INFOS_LEN - 1);
     msgstruct.infos[INFOS_LEN - 1] = '\0';
 
-    if (send(sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
-        perror("send");
-    }
-
-    if (exists && send(sockfd, buff_res, strlen(buff_res), 0) <= 0) {
-        perror("send");
+    if (send_frame(sockfd, &msgstruct, buff_res, exists ? strlen(buff_res) : 0) < 0) {
+        log_perror("send");
     } else {
-            printf("(whois) data sent to ""%s"".\n" , rqstnick);
+            log_info("(whois) data sent to %s.", rqstnick);
         }  
 }
 
 // Function to handle echo replies
 void handle_echo(int sockfd, char *buff, int buff_len, char *nick_sender) {
-    struct message msgstruct;
+    struct message msgstruct = {0};
     msgstruct.type = ECHO_SEND;
     strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
     msgstruct.nick_sender[NICK_LEN - 1] = '\0';
@@ -944,23 +1433,19 @@ void handle_echo(int sockfd, char *buff, int buff_len, char *nick_sender) {
 
     if (buff_len > 0) {  
         
-        if (send(sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
-            perror("send");
+        if (send_frame(sockfd, &msgstruct, buff, buff_len) < 0) {
+            log_perror("send");
         }
+    }
 
-        if (send(sockfd, buff, buff_len, 0) <= 0) {
-            perror("send");
-        }
-    }
-
-    printf("echoed a message to %s.\n",nick_sender);
+    log_info("echoed a message to %s.",nick_sender);
 }
 
 // Function to handle broadcasts
 void handle_msgall(int sender_fd, char *message, int msg_length, ClientInfo *clients) {
     ClientInfo *node = clients;
     char payload_buffer[MSG_LEN];
-    struct message feedback_msg;
+    struct message feedback_msg = {0};
     char sender_nickname[NICK_LEN];
 
     memset(sender_nickname, 0, NICK_LEN);
@@ -968,104 +1453,89 @@ void handle_msgall(int sender_fd, char *message, int msg_length, ClientInfo *cli
     // Retrieve sender's nickname
     while (node != NULL) {
         if (node->sockfd == sender_fd) {
-            strncpy(sender_nickname, node->nickname, NICK_LEN - 1);
+            snprintf(sender_nickname, sizeof(sender_nickname), "%s", node->nickname);
             break;
         }
         node = node->next;
     }
 
-    // Broadcast message to all clients except sender
+    // Broadcast message to all clients except sender, encoded once for all of them
     node = clients;
     int transmission_failure = 0;
-
+    int recipients = 0;
+    struct message broadcast_packet;
+    memset(&broadcast_packet, 0, sizeof(struct message));
+    broadcast_packet.type = BROADCAST_SEND;
+    snprintf(broadcast_packet.nick_sender, sizeof(broadcast_packet.nick_sender), "%s", sender_nickname);
+    broadcast_packet.pld_len = msg_length;
+
+    Fanout fanout;
+    fanout_init(&fanout, &broadcast_packet, message, msg_length);
     while (node != NULL) {
         if (node->sockfd != sender_fd) {
-            struct message broadcast_packet;
-            memset(&broadcast_packet, 0, sizeof(struct message));
-
-            broadcast_packet.type = BROADCAST_SEND;
-            strncpy(broadcast_packet.nick_sender, sender_nickname, NICK_LEN - 1);
-            broadcast_packet.pld_len = msg_length;
-            memset(broadcast_packet.infos, 0, INFOS_LEN);
-
-            // Send header
-            if (send(node->sockfd, &broadcast_packet, sizeof(struct message), 0) <= 0) {
-                transmission_failure = 1;
-                fprintf(stderr, "[Error] Failed to send header to %s.\n", node->nickname);
-            }
-
-            // Send payload
-            if (send(node->sockfd, message, msg_length, 0) <= 0) {
+            // Send header and payload
+            if (fanout_send(&fanout, node->sockfd) < 0) {
                 transmission_failure = 1;
-                fprintf(stderr, "[Error] Failed to send message to %s.\n", node->nickname);
+                log_trace("Could not queue a broadcast for %s.", node->nickname);
             }
-
-            printf("[Info] Broadcast sent to %s by %s.\n", node->nickname, sender_nickname);
+            recipients++;
         }
         node = node->next;
     }
+    fanout_done(&fanout);
+    metrics_fanout(FANOUT_BROADCAST, recipients);
+    log_info("Broadcast by %s sent to %d clients.", sender_nickname, recipients);
 
     // Provide feedback to sender
     memset(&feedback_msg, 0, sizeof(struct message));
     if (transmission_failure) {
         feedback_msg.pld_len = strlen("Broadcast failed.");
         feedback_msg.type = BROADCAST_ERROR;
-        strncpy(feedback_msg.nick_sender, sender_nickname, NICK_LEN - 1);
+        snprintf(feedback_msg.nick_sender, sizeof(feedback_msg.nick_sender), "%s", sender_nickname);
         strncpy(feedback_msg.infos, "Broadcast failed.", INFOS_LEN - 1);
         strncpy(payload_buffer, "Broadcast failed.", MSG_LEN - 1);
 
-        fprintf(stderr, "[Warning] %s encountered errors during broadcast.\n", sender_nickname);
+        log_warn("%s encountered errors during broadcast.", sender_nickname);
     } else {
         feedback_msg.pld_len = strlen("Broadcast successful.");
         feedback_msg.type = BROADCAST_SUCCESS;
-        strncpy(feedback_msg.nick_sender, sender_nickname, NICK_LEN - 1);
+        snprintf(feedback_msg.nick_sender, sizeof(feedback_msg.nick_sender), "%s", sender_nickname);
         strncpy(feedback_msg.infos, "Broadcast successful.", INFOS_LEN - 1);
         strncpy(payload_buffer, "Broadcast successful.", MSG_LEN - 1);
 
-        printf("[Success] %s successfully broadcasted a message.\n", sender_nickname);
+        log_info("%s successfully broadcasted a message.", sender_nickname);
     }
 
-    if (send(sender_fd, &feedback_msg, sizeof(struct message), 0) <= 0) {
-        perror("send feedback header");
-    }
-    if (send(sender_fd, payload_buffer, feedback_msg.pld_len, 0) <= 0) {
-        perror("send feedback payload");
+    if (send_frame(sender_fd, &feedback_msg, payload_buffer, feedback_msg.pld_len) < 0) {
+        log_perror("send feedback");
     }
 }
 
 
 // Function to handle unicast messages
-void handle_msg(int sockfd, char *buff, int buff_len, char *recipient_nickname, ClientInfo *clients_list, char *s_nick) {
-    int recipient_sockfd = -1;
+void handle_msg(int sockfd, char *buff, int buff_len, unsigned int recipient_uid, char *recipient_nickname, ClientInfo *clients_list, char *s_nick) {
     char buffer_pld[MSG_LEN];
-    struct message msg_response;
-    ClientInfo *current = clients_list;
+    struct message msg_response = {0};
+    ClientInfo *sender = sockfd_to_client(clients_list, sockfd);
 
-    // Find recipient socket by nickname
-    for (current = clients_list; current != NULL; current = current->next) {
-        if (strcmp(current->nickname, recipient_nickname) == 0) {
-            recipient_sockfd = current->sockfd;
-            break;
-        }
-    }
+    // Find recipient by ID, or by nickname for v1 clients
+    ClientInfo *recipient = resolve_recipient(clients_list, recipient_uid, recipient_nickname);
 
-    if (recipient_sockfd != -1) {
-        // Send unicast message to recipient
+    if (recipient != NULL) {
+        // Send unicast message to recipient, v2 clients render the sender from its ID
         struct message msgstruct = {
             .type = UNICAST_SEND,
-            .pld_len = buff_len
+            .pld_len = buff_len,
+            .uid = sender != NULL ? sender->uid : 0
         };
-        strncpy(msgstruct.nick_sender, s_nick, NICK_LEN - 1);
-        msgstruct.nick_sender[NICK_LEN - 1] = '\0';
-        strncpy(msgstruct.infos, recipient_nickname, INFOS_LEN - 1);
-        msgstruct.infos[INFOS_LEN - 1] = '\0';
+        snprintf(msgstruct.nick_sender, sizeof(msgstruct.nick_sender), "%s", s_nick);
+        snprintf(msgstruct.infos, sizeof(msgstruct.infos), "%s", recipient->nickname);
 
-        if (send(recipient_sockfd, &msgstruct, sizeof(msgstruct), 0) <= 0 ||
-            send(recipient_sockfd, buff, buff_len, 0) <= 0) {
-            perror("Error sending message to recipient");
+        if (send_frame(recipient->sockfd, &msgstruct, buff, buff_len) < 0) {
+            log_perror("Error sending message to recipient");
             return;
         }
-        printf(">> %s sent a unicast message to %s\n", s_nick, recipient_nickname);
+        log_info(">> %s sent a unicast message to %s", s_nick, recipient->nickname);
 
         // Notify sender of successful unicast
         msg_response = (struct message) {
@@ -1076,8 +1546,22 @@ void handle_msg(int sockfd, char *buff, int buff_len, char *recipient_nickname,
         msg_response.nick_sender[NICK_LEN - 1] = '\0';
         strncpy(buffer_pld, "Unicast message sent successfully", MSG_LEN);
 
+    } else if (mailbox_put(recipient_nickname, s_nick, buff, buff_len) == 0) {
+        // Nobody uses that nickname, keep the message until someone logs in with it
+        msg_response = (struct message) {
+            .type = UNICAST_QUEUED,
+            .pld_len = strlen("Recipient offline, message queued")
+        };
+        strncpy(msg_response.nick_sender, s_nick, NICK_LEN - 1);
+        msg_response.nick_sender[NICK_LEN - 1] = '\0';
+        strncpy(msg_response.infos, recipient_nickname, INFOS_LEN - 1);
+        msg_response.infos[INFOS_LEN - 1] = '\0';
+        strncpy(buffer_pld, "Recipient offline, message queued", MSG_LEN);
+
+        log_info(">> %s queued a unicast message for %s", s_nick, recipient_nickname);
+
     } else {
-        // Notify sender that recipient was not found
+        // Notify sender that recipient was not found (or that its mailbox is full)
         msg_response = (struct message) {
             .type = UNICAST_ERROR,
             .pld_len = strlen("Recipient not found")
@@ -1086,13 +1570,56 @@ void handle_msg(int sockfd, char *buff, int buff_len, char *recipient_nickname,
         msg_response.nick_sender[NICK_LEN - 1] = '\0';
         strncpy(buffer_pld, "Recipient not found", MSG_LEN);
 
-        printf("Error: Recipient %s not found.\n" , recipient_nickname);
+        log_error("Recipient %s (ID %u) not found.", recipient_nickname, recipient_uid);
     }
 
     // Send response message to sender
-    if (send(sockfd, &msg_response, sizeof(msg_response), 0) <= 0 ||
-        send(sockfd, buffer_pld, msg_response.pld_len, 0) <= 0) {
-        perror("Error sending response to sender");
+    if (send_frame(sockfd, &msg_response, buffer_pld, msg_response.pld_len) < 0) {
+        log_perror("Error sending response to sender");
+    }
+}
+
+// Mailbox handed over at login, one UNICAST_SEND frame per message
+typedef struct MailboxBurst {
+    SharedFrame *frames;
+    size_t cap;
+    int version;
+    int failed;
+} MailboxBurst;
+
+// Function to add one queued message to the burst; infos tells when it was sent
+static void mailbox_burst_add(void *ctx, long long time_ms, const char *sender, const char *text, size_t len) {
+    MailboxBurst *burst = ctx;
+    struct message msgstruct = { .type = UNICAST_SEND, .pld_len = len };
+    time_t seconds = time_ms / 1000;
+    struct tm tm;
+    snprintf(msgstruct.nick_sender, NICK_LEN, "%s", sender);
+    strftime(msgstruct.infos, INFOS_LEN, "queued %Y-%m-%d %H:%M", localtime_r(&seconds, &tm));
+    if (!burst->failed && shared_frame_append(&burst->frames, &burst->cap, burst->version, &msgstruct, text, len) < 0) {
+        burst->failed = 1;
+    }
+}
+
+// Function to send a client the messages queued for its nickname while nobody used it
+// They are queued together as one buffer
+void deliver_mailbox(ClientInfo *client) {
+    MailboxBurst burst = {
+        .version = client->proto == PROTO_V2 ? PROTO_V2 : PROTO_V1
+    };
+    int count = mailbox_take(client->nickname, mailbox_burst_add, &burst);
+    if (count == 0) {
+        return;
+    }
+    if (burst.failed) {
+        metrics_add(&thread_metrics->send_errors, 1);
+        log_error("%d queued messages for %s were lost.", count, client->nickname);
+    } else if (send_shared(client, burst.frames, UNICAST_SEND) < 0) {
+        log_perror("send");
+    } else {
+        log_info("%d queued messages delivered to %s.", count, client->nickname);
+    }
+    if (burst.frames != NULL) {
+        shared_frame_release(burst.frames);
     }
 }
 
@@ -1109,7 +1636,7 @@ void handle_whoami(int sockfd, char *rqstnick, ClientInfo *clients_list) {
         snprintf(buff_res, MSG_LEN,  "Client '%s' not found.\n" , rqstnick);
         
         // Prepare message structure for error
-        struct message msgstruct;
+        struct message msgstruct = {0};
         msgstruct.type = NICKNAME_INFOS_ERROR;
         strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
         msgstruct.nick_sender[NICK_LEN - 1] = '\0';
@@ -1118,8 +1645,7 @@ void handle_whoami(int sockfd, char *rqstnick, ClientInfo *clients_list) {
         msgstruct.infos[INFOS_LEN - 1] = '\0';
 
         // Send error message struct and payload
-        send(sockfd, &msgstruct, sizeof(struct message), 0);
-        send(sockfd, buff_res, msgstruct.pld_len, 0);
+        send_frame(sockfd, &msgstruct, buff_res, msgstruct.pld_len);
         return;
     }
 
@@ -1131,7 +1657,7 @@ void handle_whoami(int sockfd, char *rqstnick, ClientInfo *clients_list) {
              sender->nickname, ctime(&sender->connect_time), ip_str, ntohs(sender->port_number));
     
     // Prepare message structure for success
-    struct message msgstruct;
+    struct message msgstruct = {0};
     msgstruct.type = NICKNAME_INFOS;
     strncpy(msgstruct.nick_sender, "Server", NICK_LEN - 1);
     msgstruct.nick_sender[NICK_LEN - 1] = '\0';
@@ -1140,14 +1666,11 @@ void handle_whoami(int sockfd, char *rqstnick, ClientInfo *clients_list) {
     msgstruct.infos[INFOS_LEN - 1] = '\0';
 
     // Send message struct and payload
-    if (send(sockfd, &msgstruct, sizeof(struct message), 0) <= 0) {
-        perror("send");
-    }
-    if (send(sockfd, buff_res, strlen(buff_res), 0) <= 0) {
-        perror("send");
+    if (send_frame(sockfd, &msgstruct, buff_res, strlen(buff_res)) < 0) {
+        log_perror("send");
     } else {
         if (rqstnick != NULL){
-            printf("(whoami) data sent to ""%s"".\n" , rqstnick);
+            log_info("(whoami) data sent to %s.", rqstnick);
         }
     }
 }
@@ -1158,40 +1681,34 @@ void handle_whoami(int sockfd, char *rqstnick, ClientInfo *clients_list) {
 
 ////////////////////////// File Functions  //////////////////////////
 // Function to send a file sending request to the receiver
-void send_file_request(ClientInfo *client_list, char *sender_nick, char *receiver_nick, char *file_name) {
-    ClientInfo *receiver = nick_to_client(client_list, receiver_nick);
-    ClientInfo *sender = nick_to_client(client_list, sender_nick); // Get the sender's client info
+void send_file_request(int sockfd, ClientInfo *client_list, unsigned int receiver_uid, char *receiver_nick, char *file_name) {
+    ClientInfo *receiver = resolve_recipient(client_list, receiver_uid, receiver_nick);
+    ClientInfo *sender = sockfd_to_client(client_list, sockfd); // Get the sender's client info
+    char *sender_nick = sender->nickname;
     char buffer_pld[MSG_LEN];
-    struct message msg;
+    struct message msg = {0};
 
     // Check if the receiver exists
     if (receiver == NULL) {
         // Receiver does not exist; inform the sender
         msg.type = RECEIVER_EXISTENCE_ERROR;
 
-        strncpy(msg.nick_sender, sender_nick, NICK_LEN - 1);
-        msg.nick_sender[NICK_LEN - 1] = '\0';
+        snprintf(msg.nick_sender, sizeof(msg.nick_sender), "%s", sender_nick);
 
-        strncpy(msg.infos, sender_nick, INFOS_LEN - 1);
-        msg.infos[INFOS_LEN - 1] = '\0';
+        snprintf(msg.infos, sizeof(msg.infos), "%s", sender_nick);
 
         strncpy(buffer_pld, "Receiver not found.", MSG_LEN);
         buffer_pld[MSG_LEN - 1] = '\0';
         msg.pld_len = strlen(buffer_pld);
 
         // Send the error message to the sender
-        if (send(sender->sockfd, &msg, sizeof(struct message), 0) <= 0) {
-            perror("send");
-            return;
-        }
-
-        if (send(sender->sockfd, buffer_pld, msg.pld_len, 0) <= 0) {
-            perror("send");
+        if (send_frame(sender->sockfd, &msg, buffer_pld, msg.pld_len) < 0) {
+            log_perror("send");
             return;
         }
 
         // Log on the server side
-        printf( "%s"" tried to send a file request to a non-existent user: %s.\n", sender_nick, receiver_nick);
+        log_info("%s tried to send a file request to a non-existent user: %s.", sender_nick, receiver_nick);
         return;
     }
 
@@ -1211,28 +1728,24 @@ void send_file_request(ClientInfo *client_list, char *sender_nick, char *receive
         msg.pld_len = strlen(buffer_pld);
 
         // Send the error message to the sender
-        if (send(sender->sockfd, &msg, sizeof(struct message), 0) <= 0) {
-            perror("send");
-            return;
-        }
-
-        if (send(sender->sockfd, buffer_pld, msg.pld_len, 0) <= 0) {
-            perror("send");
+        if (send_frame(sender->sockfd, &msg, buffer_pld, msg.pld_len) < 0) {
+            log_perror("send");
             return;
         }
 
         // Log on the server side
-        printf( "%s"  " tried to send a non-existent file: %s.\n", sender_nick, file_name);
+        log_info("%s tried to send a non-existent file: %s.", sender_nick, file_name);
         return;
     }
 
     // Proceed with sending the file request if both receiver and file exist
     msg.type = FILE_REQUEST;
+    msg.uid = sender->uid;
 
     strncpy(msg.nick_sender, sender_nick, NICK_LEN - 1);
     msg.nick_sender[NICK_LEN - 1] = '\0';
 
-    strncpy(msg.infos, receiver_nick, INFOS_LEN - 1);
+    strncpy(msg.infos, receiver->nickname, INFOS_LEN - 1);
     msg.infos[INFOS_LEN - 1] = '\0';
 
     strncpy(buffer_pld, file_name, MSG_LEN - 1);
@@ -1240,33 +1753,31 @@ void send_file_request(ClientInfo *client_list, char *sender_nick, char *receive
     msg.pld_len = strlen(buffer_pld);
 
     // Send file request to the receiver
-    if (send(receiver->sockfd, &msg, sizeof(struct message), 0) <= 0) {
-        perror("send");
-    }
-
-    if (send(receiver->sockfd, buffer_pld, msg.pld_len, 0) <= 0) {
-        perror("send");
+    if (send_frame(receiver->sockfd, &msg, buffer_pld, msg.pld_len) < 0) {
+        log_perror("send");
     }
 
     // Log the file request on the server side
-    printf("%s"" sent a file sending request to %s.\n", sender_nick, receiver_nick);
+    log_info("%s sent a file sending request to %s.", sender_nick, receiver->nickname);
 }
 
-void respond_to_sender(ClientInfo *client_list, char *nick_sender, char *buffer_pld, struct message msg_response) {
+void respond_to_sender(int sockfd, ClientInfo *client_list, char *nick_sender, char *buffer_pld, struct message msg_response) {
     // Find the recipient in the list of clients
-    ClientInfo *sender = nick_to_client(client_list, nick_sender);
+    ClientInfo *sender = resolve_recipient(client_list, msg_response.uid, nick_sender);
+    ClientInfo *responder = sockfd_to_client(client_list, sockfd);
 
     if (sender != NULL) {
-        // Send the file response to the recipient
-        if (send(sender->sockfd, &msg_response, sizeof(struct message), 0) <= 0) {
-                perror("send");
-            }
+        // The relayed frame names the responder, not the recipient
+        msg_response.uid = responder->uid;
+        strncpy(msg_response.nick_sender, responder->nickname, NICK_LEN - 1);
+        msg_response.nick_sender[NICK_LEN - 1] = '\0';
 
-        if (send(sender->sockfd, buffer_pld, msg_response.pld_len, 0) <= 0) {
-                perror("send");
-            }
+        // Send the file response to the recipient
+        if (send_frame(sender->sockfd, &msg_response, buffer_pld, msg_response.pld_len) < 0) {
+                log_perror("send");
+        }
     } else {
-        printf("Recipient not found in the list of clients.\n");
+        log_info("Recipient not found in the list of clients.");
     }
 }
 
@@ -1275,294 +1786,2028 @@ void respond_to_sender(ClientInfo *client_list, char *nick_sender, char *buffer_
 
 
 ////////////////////////////////////// Other Functions //////////////////////////////////////
-// Function to split a message
-void split_message(const char *buff, char *result1, char *result2) {
-    const char *msg1 = strchr(buff, ' ');
+// Function to allocate an outbound frame of len bytes
+OutFrame *outframe_alloc(size_t len) {
+    OutFrame *frame = malloc(sizeof(OutFrame) + len);
+    if (frame == NULL) {
+        log_perror("malloc");
+        return NULL;
+    }
+    frame->next = NULL;
+    frame->len = len;
+    frame->data = frame->inline_data;
+    frame->shared = NULL;
+    return frame;
+}
 
-    if (msg1 != NULL) {
-        msg1++;  // Move to the character after the first space
-        const char *msg2 = strchr(msg1, ' ');
+// Function to encode a header and its payload into one outbound frame
+OutFrame *outframe_new(int version, struct message *msg, const void *payload, size_t len) {
+    OutFrame *frame = outframe_alloc(proto_frame_len(version, msg, len));
+    if (frame != NULL) {
+        proto_encode(version, (uint8_t *)frame->inline_data, msg, payload, len);
+    }
+    return frame;
+}
 
-        if (msg2 != NULL) {
-            msg2++;  // Move to the character after the second space
-            strcpy(result2, msg2);
-        }
+// Function to queue a reference to a shared frame instead of a copy of its bytes
+OutFrame *outframe_share(SharedFrame *shared) {
+    OutFrame *frame = outframe_alloc(0);
+    if (frame == NULL) {
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&shared->refs, 1, memory_order_relaxed);
+    frame->len = shared->len;
+    frame->data = shared->data;
+    frame->shared = shared;
+    return frame;
+}
 
-        strncpy(result1, msg1, msg2 ? (size_t)(msg2 - msg1) : strlen(msg1));
-    } else {
-        strcpy(result1, " ");
+// Function to release an outbound frame once it was written or dropped
+void outframe_free(OutFrame *frame) {
+    if (frame->shared != NULL) {
+        shared_frame_release(frame->shared);
     }
+    free(frame);
 }
 
-// Function to find a client using socket fd
-ClientInfo* sockfd_to_client(ClientInfo* list, int sockfd) {
-    ClientInfo* curr = list;
-    while (curr != NULL) {
-        if (curr->sockfd == sockfd) {
-            return curr;
+// Function to encode a frame once for every queue of a fan-out
+SharedFrame *shared_frame_new(int version, struct message *msg, const void *payload, size_t len) {
+    size_t frame_len = proto_frame_len(version, msg, len);
+    SharedFrame *shared = malloc(sizeof(SharedFrame) + frame_len);
+    if (shared == NULL) {
+        log_perror("malloc");
+        return NULL;
+    }
+    atomic_init(&shared->refs, 1);
+    shared->len = proto_encode(version, (uint8_t *)shared->data, msg, payload, len);
+    return shared;
+}
+
+// Function to encode one more frame at the end of a shared buffer that is still being built
+// Returns -1 (and frees the buffer) if it cannot grow
+int shared_frame_append(SharedFrame **shared, size_t *cap, int version, struct message *msg, const void *payload, size_t len) {
+    size_t used = *shared != NULL ? (*shared)->len : 0;
+    size_t need = used + proto_frame_len(version, msg, len);
+    if (need > *cap) {
+        size_t new_cap = *cap > 0 ? *cap : MSG_LEN;
+        while (new_cap < need) {
+            new_cap *= 2;
         }
-        curr = curr->next;
+        SharedFrame *grown = realloc(*shared, sizeof(SharedFrame) + new_cap);
+        if (grown == NULL) {
+            log_perror("realloc");
+            free(*shared);
+            *shared = NULL;
+            return -1;
+        }
+        if (*shared == NULL) {
+            atomic_init(&grown->refs, 1);
+        }
+        *shared = grown;
+        *cap = new_cap;
     }
-    return NULL; 
+    (*shared)->len = used + proto_encode(version, (uint8_t *)(*shared)->data + used, msg, payload, len);
+    return 0;
 }
 
-// Function to find nickname using socket fd
-char* sockfd_to_nick(ClientInfo *list, int sockfd) {
-    ClientInfo *curr = list;
-    while (curr != NULL) {
-        if (curr->sockfd == sockfd) {
-            return curr->nickname;
+// Function to take a reference to the snapshot answering cursor, NULL if it is stale or missing
+SharedFrame *snapshot_get(ListSnapshot *snapshots, int count, int cursor, int v2) {
+    SharedFrame *shared = NULL;
+    pthread_mutex_lock(&snapshot_lock);
+    for (int i = 0; i < count; i++) {
+        ListSnapshot *snap = &snapshots[i];
+        if (snap->generation == membership_generation && snap->cursor == cursor && snap->encoded[v2] != NULL) {
+            shared = snap->encoded[v2];
+            atomic_fetch_add_explicit(&shared->refs, 1, memory_order_relaxed);
+            break;
         }
-        curr = curr->next;
     }
-    return NULL;
+    pthread_mutex_unlock(&snapshot_lock);
+    return shared;
 }
 
-// Function to find a client using nickname
-ClientInfo* nick_to_client(ClientInfo *list, char *nick) {
-    ClientInfo *curr = list;
+// Function to keep a freshly built reply for the next requests of this generation
+// It replaces the entry for the same cursor, then a stale one, then the first one
+void snapshot_put(ListSnapshot *snapshots, int count, int cursor, int v2, SharedFrame *shared) {
+    pthread_mutex_lock(&snapshot_lock);
+    ListSnapshot *snap = NULL;
+    for (int i = 0; i < count && snap == NULL; i++) {
+        if (snapshots[i].generation == membership_generation && snapshots[i].cursor == cursor) {
+            snap = &snapshots[i];
+        }
+    }
+    for (int i = 0; i < count && snap == NULL; i++) {
+        if (snapshots[i].generation != membership_generation) {
+            snap = &snapshots[i];
+        }
+    }
+    if (snap == NULL) {
+        snap = &snapshots[0];
+    }
 
-    while (curr != NULL) {
-        if (strcmp(curr->nickname, nick) == 0) {
-            return curr;
+    if (snap->generation != membership_generation || snap->cursor != cursor) {
+        for (int i = 0; i < 2; i++) {
+            if (snap->encoded[i] != NULL) {
+                shared_frame_release(snap->encoded[i]);
+                snap->encoded[i] = NULL;
+            }
         }
-        curr = curr->next;
+        snap->generation = membership_generation;
+        snap->cursor = cursor;
+    }
+    if (snap->encoded[v2] != NULL) {
+        shared_frame_release(snap->encoded[v2]);
+    }
+    atomic_fetch_add_explicit(&shared->refs, 1, memory_order_relaxed);
+    snap->encoded[v2] = shared;
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+// Function to drop one reference to a shared frame, the last one frees it
+void shared_frame_release(SharedFrame *shared) {
+    if (atomic_fetch_sub_explicit(&shared->refs, 1, memory_order_acq_rel) == 1) {
+        free(shared);
     }
-    return NULL; 
 }
 
+// Function to start a fan-out of one message, nothing is encoded until a recipient needs it
+void fanout_init(Fanout *fanout, struct message *msg, const void *payload, size_t len) {
+    fanout->msg = msg;
+    fanout->payload = payload;
+    fanout->len = len;
+    fanout->encoded[0] = NULL;
+    fanout->encoded[1] = NULL;
+}
 
+// Function to queue a fan-out's frame for one recipient, encoded in its protocol version
+int fanout_send(Fanout *fanout, int sockfd) {
+    ClientInfo *recipient = sockfd_to_client(clientList, sockfd);
+    if (recipient == NULL) {
+        return -1;
+    }
 
+    int v2 = recipient->proto == PROTO_V2;
+    if (fanout->encoded[v2] == NULL) {
+        fanout->encoded[v2] = shared_frame_new(v2 ? PROTO_V2 : PROTO_V1, fanout->msg, fanout->payload, fanout->len);
+        if (fanout->encoded[v2] == NULL) {
+            metrics_add(&thread_metrics->send_errors, 1);
+            return -1;
+        }
+    }
+    return send_shared(recipient, fanout->encoded[v2], fanout->msg->type);
+}
 
+// Function to queue a reference to already encoded bytes for one recipient
+int send_shared(ClientInfo *recipient, SharedFrame *shared, enum msg_type type) {
+    int ret;
 
-////////////////////////////////////// Big Boss Functions //////////////////////////////////////
-// Function to handle multiple clients
-void handle_multiple_clients(int sfd) {
-    struct pollfd fds[MAX_CLIENTS + 1];
-    memset(fds, 0, sizeof(fds));
-    fds[0].fd = sfd;
-    fds[0].events = POLLIN;
-    int nfds = 1;
-    
-    printf( "\nWaiting for connections");
-    fflush(stdout);
-    for (int i = 0; i < 3; ++i){
-            printf(".");
-            fflush(stdout);
-            usleep(200000);
+    // The io_uring backend copies into its own submission buffers
+    if (active_ring != NULL) {
+        ret = uring_queue_send(recipient->sockfd, shared->data, shared->len) < 0 ? -1 : 0;
+    } else {
+        OutFrame *frame = outframe_share(shared);
+        ret = frame != NULL ? send_outframe(recipient, frame) : -1;
     }
-    printf("\n");
-       
-    
-    while (1) {
-        int ret = poll(fds, nfds, -1);
-        if (ret == -1) {
-            perror("poll");
-            break;
+
+    if (ret < 0) {
+        metrics_add(&thread_metrics->send_errors, 1);
+    } else {
+        metrics_frame_out(type, shared->len);
+    }
+    return ret;
+}
+
+// Function to end a fan-out, the frames are freed when the last queue lets go of them
+void fanout_done(Fanout *fanout) {
+    for (int i = 0; i < 2; i++) {
+        if (fanout->encoded[i] != NULL) {
+            shared_frame_release(fanout->encoded[i]);
+            fanout->encoded[i] = NULL;
         }
-        if (fds[0].revents & POLLIN) {
-            struct sockaddr_in clientAddr;
-            socklen_t clientLen = sizeof(clientAddr);
-            int newsockfd = accept(sfd, (struct sockaddr *)&clientAddr, &clientLen);
+    }
+}
 
-            if (newsockfd < 0) {
-                perror("accept");
-                continue;
-            }
+// Function to queue raw bytes for a connection (owner thread only)
+int send_bytes(ClientInfo *client, const void *data, size_t len) {
+    if (active_ring != NULL) {
+        return uring_queue_send(client->sockfd, data, len) < 0 ? -1 : 0;
+    }
+    OutFrame *frame = outframe_alloc(len);
+    if (frame == NULL) {
+        return -1;
+    }
+    memcpy(frame->inline_data, data, len);
+    sendq_push(client, frame);
+    return 0;
+}
 
-            if (nfds < MAX_CLIENTS + 1) {
-                add_user(&clientList, newsockfd, clientAddr);
-                ClientInfo *new_user = sockfd_to_client(clientList, newsockfd);
-                printf( "New client connected from ip"" %s"" and port"" %d"".",new_user->ip_address, new_user->port_number);
-                printf( "\nWaiting for nicknames");
-                fflush(stdout);
-                for (int i = 0; i < 3; ++i){
-                    printf(".");
-                    fflush(stdout);
-                    usleep(200000);
-                }
-                            
+// Function to hand a frame to the send queue of its recipient (callers hold registry_lock)
+// Frames for sockets owned by another worker are handed to that worker's inbox
+int send_outframe(ClientInfo *recipient, OutFrame *frame) {
+    if (worker_count > 1 && current_worker != NULL && recipient->worker_id != current_worker->id) {
+        Delivery *delivery = malloc(sizeof(Delivery));
+        if (delivery == NULL) {
+            log_perror("malloc");
+            outframe_free(frame);
+            return -1;
+        }
+        delivery->sockfd = recipient->sockfd;
+        delivery->conn_id = recipient->conn_id;
+        delivery->frame = frame;
+        worker_post(&workers[recipient->worker_id], delivery);
+        return 0;
+    }
+
+    sendq_push(recipient, frame);
+    return 0;
+}
 
-                online_clients++;
+// Function to queue a header and its payload as one frame (callers hold registry_lock)
+// The frame is encoded in the recipient's protocol version
+int send_frame(int sockfd, struct message *msg, const void *payload, size_t len) {
+    ClientInfo *recipient = sockfd_to_client(clientList, sockfd);
+    if (recipient == NULL) {
+        return -1;
+    }
 
-                fds[nfds].fd = newsockfd;
-                fds[nfds].events = POLLIN;
-                nfds++;
-            } else {
-                printf( "Error: Maximum number of clients reached, connection refused.\n");
-                close(newsockfd);
-            }
+    OutFrame *frame = outframe_new(recipient->proto, msg, payload, len);
+    if (frame == NULL) {
+        metrics_add(&thread_metrics->send_errors, 1);
+        return -1;
+    }
+    size_t frame_len = frame->len;
+    int ret;
+
+    // The io_uring backend batches sends into its own submissions
+    if (active_ring != NULL) {
+        ret = uring_queue_send(sockfd, frame->data, frame->len) < 0 ? -1 : 0;
+        outframe_free(frame);
+    } else {
+        ret = send_outframe(recipient, frame);
+    }
+
+    if (ret < 0) {
+        metrics_add(&thread_metrics->send_errors, 1);
+    } else {
+        metrics_frame_out(msg->type, frame_len);
+    }
+    return ret;
+}
+
+// Function to pick the protocol version from the first bytes of a connection
+// v2 clients open with a hello, which is answered; anything else is a v1 client
+// Returns 1 once decided, 0 when more bytes are needed and -1 on failure
+int negotiate_protocol(ClientInfo *client) {
+    FrameDecoder *dec = &client->decoder;
+    int offered = proto_parse_hello((uint8_t *)dec->buf + dec->start, dec->len);
+    if (offered == 0) {
+        return 0;
+    }
+
+    int version = PROTO_V1;
+    if (offered > 0) {
+        version = offered >= PROTO_V2 ? PROTO_V2 : PROTO_V1;
+        dec->start += PROTO_HELLO_LEN;
+        dec->len -= PROTO_HELLO_LEN;
+
+        uint8_t hello[PROTO_HELLO_LEN];
+        proto_hello(hello, version);
+        if (send_bytes(client, hello, PROTO_HELLO_LEN) < 0) {
+            return -1;
         }
+    }
 
-        int messagesReceived = 0;
+    // Other workers read the version when they encode frames for this client
+    pthread_rwlock_wrlock(&registry_lock);
+    client->proto = version;
+    pthread_rwlock_unlock(&registry_lock);
+    return 1;
+}
 
-        for (int i = 1; i < nfds; i++) {
-            if (fds[i].revents & POLLIN) {
-                struct message msgstruct;
-                char buff[MSG_LEN];
+// Function to record a decoded frame of a client in the capture
+// User IDs are only valid on this server: a frame addressed by ID is recorded with the
+// recipient's nickname in infos, so that a replay can address it on another server
+void capture_inbound(ClientInfo *current, const struct message *msgstruct, const char *pld, size_t len) {
+    if (msgstruct->uid == 0 || msgstruct->infos[0] != '\0') {
+        capture_frame(current->conn_id, current->proto, msgstruct, pld, len);
+        return;
+    }
+    struct message named = *msgstruct;
+    pthread_rwlock_rdlock(&registry_lock);
+    ClientInfo *recipient = uid_to_client(msgstruct->uid);
+    if (recipient != NULL) {
+        strncpy(named.infos, recipient->nickname, INFOS_LEN - 1);
+        named.infos[INFOS_LEN - 1] = '\0';
+    }
+    pthread_rwlock_unlock(&registry_lock);
+    capture_frame(current->conn_id, current->proto, &named, pld, len);
+}
 
-                // Memory cleanup
-                memset(&msgstruct, 0, sizeof(struct message));
-                memset(buff, 0, MSG_LEN);
+// Function to dispatch every complete frame buffered for a client
+// Returns the number of frames handled, or -1 if the connection must be closed
+int process_frames(ClientInfo *current) {
+    // Frames are dispatched straight from the read buffer, nothing is copied or cleared
+    struct message *msgstruct = &current->decoder.header;
+    char *pld;
+    int frames = 0;
+
+    if (current->proto == 0) {
+        int ret = negotiate_protocol(current);
+        if (ret <= 0) {
+            return ret;
+        }
+    }
 
-                int bytesReceived = recv(fds[i].fd, &msgstruct, sizeof(struct message), 0);
+    while (1) {
+        int ret;
+        size_t frame_start = current->decoder.start;
+        if (current->proto == PROTO_V2) {
+            ret = decoder_next_frame_v2(&current->decoder, &pld);
+        } else {
+            // v1 clients without a nickname only send headers
+            ret = decoder_next_frame(&current->decoder, current->nickname[0] != '\0', &pld);
+        }
+        if (ret == 0) {
+            break;
+        }
+        if (ret < 0) {
+            log_every(LOG_RATE_PER_SEC, LOG_ERROR, "Malformed or oversized frame from %s, closing connection.", current->nickname);
+            return -1;
+        }
+        metrics_frame_in(msgstruct->type, current->decoder.start - frame_start);
+        if (capture_enabled) {
+            int has_payload = current->proto == PROTO_V2 || current->nickname[0] != '\0';
+            capture_inbound(current, msgstruct, pld, has_payload ? msgstruct->pld_len : 0);
+        }
 
-                if (bytesReceived <= 0) {
-                    remove_user(fds[i].fd);
-                    close(fds[i].fd);
-                    fds[i].fd = -1;
-                } else {
-                    ClientInfo *current = sockfd_to_client(clientList, fds[i].fd);
-
-                    if (strlen(current->nickname) == 0) {
-                        // If the client doesn't have a nickname, try to set the nickname
-                        if (msgstruct.type == NICKNAME_NEW) {
-                            char newNickname[NICK_LEN];
-                            strncpy(newNickname, msgstruct.infos, NICK_LEN);
-                            newNickname[NICK_LEN - 1] = '\0';
-
-                            if (update_nickname(newNickname)) {
-                                strcpy(current->nickname, newNickname);
-
-                                // Display message when nickname is set
-                                printf( "%s"" connected from ip"" %s"" and port ""%d"".",current->nickname, current->ip_address, current->port_number);
-
-                                // Send success message to the client
-                                struct message success_message;
-                                success_message.type = NICKNAME_SUCCESS;
-                                if (send(current->sockfd, &success_message, sizeof(struct message), 0) < 0) {
-                                    perror("send");
-                                    printf("\nError: Unable to send the message to the recipient.\n");
-                                }
-                            } else {
-                                // Send error message to the client if the nickname already exists
-                                struct message error_message_struct;
-                                error_message_struct.type = NICKNAME_ERROR;
-                                if (send(current->sockfd, &error_message_struct, sizeof(struct message), 0) < 0) {
-                                    perror("send");
-                                    printf("\nError: Unable to send the message to the recipient.\n");
-                                }
-                            }
-                        }
-                    } else {
-                        // The client has a nickname, process commands as before
-                        if (msgstruct.pld_len > 0) {
-                            bytesReceived = recv(fds[i].fd, buff, msgstruct.pld_len, 0);
-                        }
-
-                        if (bytesReceived <= 0) {
-                            remove_user(fds[i].fd);
-                            close(fds[i].fd);
-                            fds[i].fd = -1;
-                        } else {
-                            buff[bytesReceived] = '\0';
-                            if (strncmp(buff, MSG_QUIT, strlen(MSG_QUIT)) == 0) {
-                                remove_user(fds[i].fd);
-                                close(fds[i].fd);
-                                fds[i].fd = -1;
-                            } else {
-                                // If the client didn't send "/quit", process the command
-                                handle_command(fds[i].fd, msgstruct, current->nickname, clientList, buff);
-                                messagesReceived++;
-                            }
-                        }
-                    }
-                }
-            }
+        // Handlers queue every frame they produce before returning
+        int type = msgstruct->type;
+        long long decoded_ns = latency_now_ns();
+        if (dispatch_frame(current, msgstruct, pld) < 0) {
+            return -1;
         }
+        latency_record(type, decoded_ns);
+        frames++;
 
-        if (nfds > 1 && messagesReceived == 0) {
-            if (online_clients == 0) {
-                printf( "\nWaiting for connections");
-                fflush(stdout);
-                for (int i = 0; i < 3; ++i){
-                    printf(".");
-                    fflush(stdout);
-                    usleep(200000);
-                }   
-                printf("\n");       
-            } 
-            
-            else {
-                printf( "\nWaiting for messages");
-                fflush(stdout);
-                for (int i = 0; i < 3; ++i){
-                    printf(".");
-                    fflush(stdout);
-                    usleep(200000);
-                }        
-                printf("\n");       
-    
-            }
+        // Keep the rest buffered until the client reads its replies
+        if (current->sendq.paused) {
+            break;
         }
     }
+    decoder_compact(&current->decoder);
+    return frames;
 }
 
-// Function to bind the server to the specified port
-int handle_bind(const char *port) {
-    struct addrinfo hints, *result, *rp;
-    int serverSocket;
+// Function to switch a socket to non-blocking mode
+int set_nonblocking(int sockfd) {
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        log_perror("fcntl");
+        return -1;
+    }
+    return 0;
+}
 
-    memset(&hints, 0, sizeof(struct addrinfo)); // Clear hints structure
-    hints.ai_family = AF_UNSPEC; // Allow IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; // Use TCP socket
-    hints.ai_flags = AI_PASSIVE; // For wildcard IP address
+// Function to raise the open files limit so the server can hold many sessions
+void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+            log_perror("setrlimit");
+        }
+    }
+}
 
-    // Get address info for binding
-    if (getaddrinfo(NULL, port, &hints, &result) != 0) {
-        perror( "getaddrinfo()" );
-        exit(EXIT_FAILURE);
+// Function to set up the object pools, reserving room for the expected load up front
+// With sessions > 0, accepting that many clients never reaches malloc()
+int pools_init(size_t sessions, size_t channels) {
+    pool_init(&client_pool, "client", sizeof(ClientInfo), CLIENT_POOL_SLAB);
+    pool_init(&channel_pool, "channel", sizeof(Channel), CHANNEL_POOL_SLAB);
+    pool_init(&membership_pool, "membership", sizeof(Membership), MEMBERSHIP_POOL_SLAB);
+
+    if (pool_reserve(&client_pool, sessions) < 0 ||
+        pool_reserve(&channel_pool, channels) < 0 ||
+        pool_reserve(&membership_pool, sessions > channels ? sessions : channels) < 0) {
+        return -1;
+    }
+    if (sessions > 0 && conn_table_reserve((int)sessions + PREALLOC_FD_SLACK) < 0) {
+        return -1;
     }
+    while (channel_table_size < channels) {
+        if (channel_table_grow() < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    // Iterate through the results and bind
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-        serverSocket = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (serverSocket == -1) {
-            continue; // Try next address
+// Function to print the pool counters on the server console
+void print_pool_stats(void) {
+    Pool *pools[] = { &client_pool, &channel_pool, &membership_pool };
+    for (size_t i = 0; i < sizeof(pools) / sizeof(pools[0]); i++) {
+        PoolStats stats;
+        pool_stats(pools[i], &stats);
+        log_info("[Pool] %-10s in use %zu, high-water %zu, capacity %zu, %zu bytes reserved",
+               pools[i]->name, stats.in_use, stats.high_water, stats.capacity, stats.bytes_reserved);
+    }
+}
+
+// Function to write the registry's gauges, the slow-consumer counters and the latency percentiles into a metrics scrape
+void write_server_metrics(FILE *out) {
+    pthread_rwlock_rdlock(&registry_lock);
+    int clients = online_clients;
+    int pending = pending_logins;
+    size_t channels = channel_count;
+    long members = 0;
+    int largest = 0;
+    for (Channel *channel = channel_list; channel != NULL; channel = channel->channel_next) {
+        members += channel->activ_client;
+        if (channel->activ_client > largest) {
+            largest = channel->activ_client;
         }
+    }
+    size_t pool_bytes = client_pool.bytes_reserved + channel_pool.bytes_reserved + membership_pool.bytes_reserved;
+    pthread_rwlock_unlock(&registry_lock);
+
+    metrics_gauge(out, "chat_connections", "Open client connections.", clients);
+    metrics_gauge(out, "chat_pending_logins", "Connections that have not chosen a nickname yet.", pending);
+    metrics_gauge(out, "chat_channels", "Channels in the registry.", channels);
+    metrics_gauge(out, "chat_channel_members", "Memberships across all channels.", members);
+    metrics_gauge(out, "chat_channel_members_max", "Members of the largest channel.", largest);
+    metrics_gauge(out, "chat_pool_bytes", "Bytes reserved by the session, channel and membership pools.", pool_bytes);
+    metrics_counter(out, "chat_slow_dropped_oldest_total", "Queued frames dropped by the drop-oldest policy.",
+                    atomic_load_explicit(&slow_stats.dropped_oldest, memory_order_relaxed));
+    metrics_counter(out, "chat_slow_dropped_newest_total", "Frames dropped by the drop-newest policy.",
+                    atomic_load_explicit(&slow_stats.dropped_newest, memory_order_relaxed));
+    metrics_counter(out, "chat_slow_disconnects_total", "Clients disconnected for falling behind.",
+                    atomic_load_explicit(&slow_stats.disconnects, memory_order_relaxed));
+    latency_write_metrics(out);
+}
 
-        // Set socket options
-        int opt = 1;
-        setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// Function to split a message
+void split_message(const char *buff, char *result1, char *result2) {
+    const char *msg1 = strchr(buff, ' ');
 
-        // Bind the socket to the address
-        if (bind(serverSocket, rp->ai_addr, rp->ai_addrlen) == 0) {
-            fprintf(stdout, "Server launched successfully on port %s.\n", port);
-            break; // Successfully bound
+    if (msg1 != NULL) {
+        msg1++;  // Move to the character after the first space
+        const char *msg2 = strchr(msg1, ' ');
+
+        if (msg2 != NULL) {
+            msg2++;  // Move to the character after the second space
+            strcpy(result2, msg2);
         }
 
-        close(serverSocket); // Close if bind failed
+        strncpy(result1, msg1, msg2 ? (size_t)(msg2 - msg1) : strlen(msg1));
+    } else {
+        strcpy(result1, " ");
     }
+}
 
-    // If binding failed
-    if (rp == NULL) {
-        fprintf(stderr,  "Could not bind. Please try again." );
-        exit(EXIT_FAILURE);
+// Function to find a client using socket fd (O(1) through the connection table)
+// Callers hold registry_lock, or own the session: only its worker adds or removes it
+ClientInfo* sockfd_to_client(ClientInfo* list, int sockfd) {
+    (void)list;
+    if (sockfd < 0 || sockfd >= conn_table_size) {
+        return NULL;
     }
-
-    freeaddrinfo(result); // Free the address info
-    return serverSocket; // Return the bound socket
+    return conn_table[sockfd];
 }
 
-// Main Program 
-int main(int argc, char *argv[]) {
+// Function to find nickname using socket fd
+char* sockfd_to_nick(ClientInfo *list, int sockfd) {
+    ClientInfo *curr = sockfd_to_client(list, sockfd);
+    return curr != NULL ? curr->nickname : NULL;
+}
 
-    if (argc != 2) {
-        printf( "Missing arguments. Usage: %s <server_port>\n" , argv[0]);
-        exit(EXIT_FAILURE);
+// Function to find a client using nickname (O(1) through the nickname index)
+// The index ignores case; lookups keep matching the exact nickname
+ClientInfo* nick_to_client(ClientInfo *list, char *nick) {
+    (void)list;
+    ClientInfo *curr = nick_index_find(&nick_index, nick);
+    if (curr != NULL && strcmp(curr->nickname, nick) == 0) {
+        return curr;
     }
+    return NULL; 
+}
+
 
-   const char *server_port = argv[1];
-    int sfd; 
-    sfd = handle_bind(server_port);
 
-    if ((listen(sfd, SOMAXCONN)) != 0) {
-        perror( "listen" );
-        exit(EXIT_FAILURE);
-    }
 
-    handle_multiple_clients(sfd);
+
+////////////////////////////////////// Big Boss Functions //////////////////////////////////////
+// Function to tell whether a frame changes the shared user/channel registry
+int frame_needs_exclusive(ClientInfo *current, struct message *msgstruct) {
+    if (strlen(current->nickname) == 0) {
+        return 1;
+    }
+    switch (msgstruct->type) {
+        case NICKNAME_NEW:
+        case MULTICAST_CREATE:
+        case MULTICAST_JOIN:
+        case MULTICAST_QUIT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Function to dispatch one decoded frame from a client
+// Returns 1 if the frame was handled and -1 if the client asked to leave
+// Only the worker owning a session writes its nickname, so it can be read here unlocked
+int dispatch_frame(ClientInfo *current, struct message *msgstruct, char *buff) {
+    if (strlen(current->nickname) > 0 && strncmp(buff, MSG_QUIT, strlen(MSG_QUIT)) == 0) {
+        return -1;
+    }
+
+    // Echoes only touch the sender's own session, which its worker reaches without the lock
+    int locked = strlen(current->nickname) == 0 || msgstruct->type != ECHO_SEND;
+
+    // Registry changes are exclusive; lookups and fan-out run concurrently across workers
+    if (locked && frame_needs_exclusive(current, msgstruct)) {
+        pthread_rwlock_wrlock(&registry_lock);
+    } else if (locked) {
+        pthread_rwlock_rdlock(&registry_lock);
+    }
+
+    if (strlen(current->nickname) == 0) {
+        // If the client doesn't have a nickname, try to set the nickname
+        if (msgstruct->type == NICKNAME_NEW) {
+            char newNickname[NICK_LEN];
+            strncpy(newNickname, msgstruct->infos, NICK_LEN);
+            newNickname[NICK_LEN - 1] = '\0';
+
+            // update_nickname() returns 3 for an invalid length, which is a refusal too
+            if (update_nickname(newNickname) == 1 && assign_uid(current) != 0) {
+                // Only the change from unnamed to named leaves the pending count, as remove_user() assumes
+                int was_pending = current->nickname[0] == '\0';
+                strcpy(current->nickname, newNickname);
+                if (was_pending && current->nickname[0] != '\0') {
+                    pending_logins--;
+                }
+                if (nick_index_insert(&nick_index, current) < 0) {
+                    log_error("Could not index nickname %s.", current->nickname);
+                }
+
+                // Display message when nickname is set
+                log_info("%s connected from ip %s and port %d.",current->nickname, current->ip_address, current->port_number);
+
+                // Send success message to the client
+                struct message success_message;
+                memset(&success_message, 0, sizeof(struct message));
+                success_message.type = NICKNAME_SUCCESS;
+                success_message.uid = current->uid;
+                if (send_frame(current->sockfd, &success_message, NULL, 0) < 0) {
+                    log_perror("send");
+                    log_error("Unable to send the message to the recipient.");
+                }
+                send_user_map(current);
+                send_user_update(clientList, current, current->uid, current->nickname);
+                deliver_mailbox(current);
+            } else {
+                // Send error message to the client if the nickname already exists
+                struct message error_message_struct;
+                memset(&error_message_struct, 0, sizeof(struct message));
+                error_message_struct.type = NICKNAME_ERROR;
+                if (send_frame(current->sockfd, &error_message_struct, NULL, 0) < 0) {
+                    log_perror("send");
+                    log_error("Unable to send the message to the recipient.");
+                }
+            }
+        }
+    } else {
+        // If the client didn't send "/quit", process the command
+        handle_command(current->sockfd, msgstruct, current->nickname, clientList, buff);
+    }
+
+    if (locked) {
+        pthread_rwlock_unlock(&registry_lock);
+    }
+    return 1;
+}
+
+// Function to read whatever a client sent and dispatch the complete frames
+// Returns 1 if bytes were read, 0 once the socket has nothing more and -1 to close it
+int handle_client_input(int sockfd) {
+    // The socket belongs to this worker, so its slot needs no lock
+    ClientInfo *current = sockfd_to_client(clientList, sockfd);
+    if (current == NULL) {
+        return -1;
+    }
+
+    FrameDecoder *dec = &current->decoder;
+    if (decoder_reserve(dec) < 0) {
+        return -1;
+    }
+
+    // Frames left over while the input was paused go first
+    if (dec->len > 0 && process_frames(current) < 0) {
+        return -1;
+    }
+    if (current->sendq.paused) {
+        return 0;
+    }
+
+    // Leftovers are always shorter than one frame, so there is room for more
+    ssize_t n = recv(sockfd, dec->buf + dec->start + dec->len, RECV_BUF_SIZE - dec->start - dec->len, 0);
+    if (n < 0 && errno == EINTR) {
+        return 1;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    if (n <= 0) {
+        return -1;
+    }
+    dec->len += n;
+    metrics_add(&thread_metrics->socket_bytes_in, n);
+
+    return process_frames(current) < 0 ? -1 : 1;
+}
+
+////////////////////////////////////// Send Queues //////////////////////////////////////
+// Connections with queued frames, flushed at the end of each event loop tick
+__thread FlushEntry *flush_list = NULL;
+__thread size_t flush_len = 0;
+__thread size_t flush_cap = 0;
+
+// Monotonic time of the current tick, used to date queued frames
+__thread long long tick_ms = 0;
+
+// What happens to clients that fall behind, and how often it happened
+SlowConsumerConfig slow_config = { SLOW_DISCONNECT, SENDQ_MAX_BYTES, SENDQ_MAX_LAG_MS };
+SlowConsumerStats slow_stats;
+
+// Function to refresh the tick clock once per event loop iteration
+void update_tick_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    tick_ms = (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Function to parse a slow-consumer policy name
+int parse_slow_policy(const char *name, enum slow_policy *policy) {
+    if (strcmp(name, "drop-oldest") == 0) {
+        *policy = SLOW_DROP_OLDEST;
+    } else if (strcmp(name, "drop-newest") == 0) {
+        *policy = SLOW_DROP_NEWEST;
+    } else if (strcmp(name, "disconnect") == 0) {
+        *policy = SLOW_DISCONNECT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Function to list a connection for the end-of-tick flush
+void sendq_schedule(ClientInfo *client) {
+    if (client->sendq.dirty) {
+        return;
+    }
+    if (flush_len == flush_cap) {
+        size_t new_cap = flush_cap > 0 ? flush_cap * 2 : CONN_TABLE_INIT;
+        FlushEntry *new_list = realloc(flush_list, new_cap * sizeof(FlushEntry));
+        if (new_list == NULL) {
+            log_perror("realloc");
+            return;
+        }
+        flush_list = new_list;
+        flush_cap = new_cap;
+    }
+    flush_list[flush_len].sockfd = client->sockfd;
+    flush_list[flush_len].conn_id = client->conn_id;
+    flush_len++;
+    client->sendq.dirty = 1;
+}
+
+// Function to tell whether a connection's oldest queued frame is too old
+int sendq_lagging(SendQueue *q) {
+    return slow_config.max_lag_ms > 0 && q->head != NULL && tick_ms - q->head->queued_ms > slow_config.max_lag_ms;
+}
+
+// Function to drop a connection that fell too far behind
+// The read side notices the shutdown and closes the session
+void sendq_disconnect(ClientInfo *client) {
+    SendQueue *q = &client->sendq;
+    log_warn("%s fell behind (%zu bytes queued), disconnecting.", client->nickname, q->bytes);
+
+    int dirty = q->dirty;
+    sendq_clear(q);
+    q->dirty = dirty;
+    q->doomed = 1;
+    shutdown(client->sockfd, SHUT_RDWR);
+    atomic_fetch_add_explicit(&slow_stats.disconnects, 1, memory_order_relaxed);
+}
+
+// Function to apply the slow-consumer policy before queueing a frame
+// Returns 1 if the policy consumed the frame
+int sendq_enforce_policy(ClientInfo *client, OutFrame *frame) {
+    SendQueue *q = &client->sendq;
+    int over_bytes = q->bytes + frame->len > slow_config.max_bytes;
+
+    if (slow_config.policy == SLOW_DISCONNECT) {
+        if (!over_bytes && !sendq_lagging(q)) {
+            return 0;
+        }
+        outframe_free(frame);
+        sendq_disconnect(client);
+        return 1;
+    }
+    if (!over_bytes) {
+        return 0;
+    }
+
+    if (q->dropped == 0) {
+        log_every(LOG_RATE_PER_SEC, LOG_WARN, "%s is not keeping up, dropping frames.", client->nickname);
+    }
+
+    if (slow_config.policy == SLOW_DROP_NEWEST) {
+        outframe_free(frame);
+        q->dropped++;
+        atomic_fetch_add_explicit(&slow_stats.dropped_newest, 1, memory_order_relaxed);
+        return 1;
+    }
+
+    // Drop oldest: a partly written head frame has to stay
+    OutFrame **link = q->head_off > 0 ? &q->head->next : &q->head;
+    while (*link != NULL && q->bytes + frame->len > slow_config.max_bytes) {
+        OutFrame *old = *link;
+        *link = old->next;
+        q->bytes -= old->len;
+        q->frames--;
+        q->dropped++;
+        metrics_add(&thread_metrics->released_bytes, old->len);
+        metrics_add(&thread_metrics->released_frames, 1);
+        outframe_free(old);
+        atomic_fetch_add_explicit(&slow_stats.dropped_oldest, 1, memory_order_relaxed);
+    }
+    if (*link == NULL) {
+        q->tail = q->head;
+    }
+    return 0;
+}
+
+// Function to append a frame to a connection's send queue (owner thread only)
+void sendq_push(ClientInfo *client, OutFrame *frame) {
+    SendQueue *q = &client->sendq;
+
+    if (q->doomed) {
+        outframe_free(frame);
+        return;
+    }
+    if (sendq_enforce_policy(client, frame)) {
+        return;
+    }
+
+    frame->queued_ms = tick_ms;
+    if (q->tail == NULL) {
+        q->head = frame;
+    } else {
+        q->tail->next = frame;
+    }
+    q->tail = frame;
+    q->bytes += frame->len;
+    q->frames++;
+    metrics_add(&thread_metrics->queued_bytes, frame->len);
+    metrics_add(&thread_metrics->queued_frames, 1);
+    if (q->bytes > q->peak_bytes) {
+        q->peak_bytes = q->bytes;
+    }
+
+    // A client that does not read its replies stops being read from
+    if (!q->paused && q->bytes > SENDQ_HIGH_WATER) {
+        q->paused = 1;
+        log_every(LOG_RATE_PER_SEC, LOG_WARN, "Send queue of %s above %d bytes, pausing its input.", client->nickname, SENDQ_HIGH_WATER);
+    }
+    sendq_schedule(client);
+}
+
+// Function to release every frame still queued for a connection
+void sendq_clear(SendQueue *q) {
+    metrics_add(&thread_metrics->released_bytes, q->bytes);
+    metrics_add(&thread_metrics->released_frames, q->frames);
+    OutFrame *frame = q->head;
+    while (frame != NULL) {
+        OutFrame *next = frame->next;
+        outframe_free(frame);
+        frame = next;
+    }
+    memset(q, 0, sizeof(SendQueue));
+}
+
+// Function to write as much of a send queue as the socket accepts, several frames per writev()
+// Returns -1 if the connection failed
+int sendq_flush(ClientInfo *client) {
+    SendQueue *q = &client->sendq;
+    struct iovec iov[SENDQ_IOV_MAX];
+
+    while (q->head != NULL) {
+        int iovcnt = 0;
+        size_t off = q->head_off;
+        for (OutFrame *frame = q->head; frame != NULL && iovcnt < SENDQ_IOV_MAX; frame = frame->next) {
+            iov[iovcnt].iov_base = (void *)(frame->data + off);
+            iov[iovcnt].iov_len = frame->len - off;
+            iovcnt++;
+            off = 0;
+        }
+
+        ssize_t n = writev(client->sockfd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;    // Resumed on the next writable event
+            }
+            metrics_add(&thread_metrics->write_errors, 1);
+            return -1;
+        }
+        metrics_add(&thread_metrics->socket_bytes_out, n);
+
+        // Drop the frames that left completely
+        size_t written = n;
+        while (written > 0) {
+            OutFrame *frame = q->head;
+            size_t left = frame->len - q->head_off;
+            if (written < left) {
+                q->head_off += written;
+                break;
+            }
+            written -= left;
+            q->head = frame->next;
+            q->head_off = 0;
+            q->bytes -= frame->len;
+            q->frames--;
+            metrics_add(&thread_metrics->released_bytes, frame->len);
+            metrics_add(&thread_metrics->released_frames, 1);
+            outframe_free(frame);
+        }
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+    }
+    return 0;
+}
+
+// Function to flush every connection listed during this tick
+// With resume_input set, connections that drained below the low watermark are read again
+void flush_pending_sends(int resume_input) {
+    while (flush_len > 0) {
+        int resumed[SENDQ_IOV_MAX];
+        int nresumed = 0;
+
+        // Only this worker's sessions are listed, and only it touches their queues
+        size_t i = 0;
+        for (; i < flush_len && nresumed < SENDQ_IOV_MAX; i++) {
+            ClientInfo *client = sockfd_to_client(clientList, flush_list[i].sockfd);
+            if (client == NULL || client->conn_id != flush_list[i].conn_id) {
+                continue;
+            }
+            client->sendq.dirty = 0;
+            if (sendq_flush(client) < 0) {
+                // The read side notices the shutdown and closes the session
+                shutdown(client->sockfd, SHUT_RDWR);
+                continue;
+            }
+            if (slow_config.policy == SLOW_DISCONNECT && sendq_lagging(&client->sendq)) {
+                sendq_disconnect(client);
+                continue;
+            }
+            if (client->sendq.paused && client->sendq.bytes <= SENDQ_LOW_WATER) {
+                client->sendq.paused = 0;
+                if (resume_input) {
+                    resumed[nresumed++] = client->sockfd;
+                }
+            }
+        }
+        memmove(flush_list, flush_list + i, (flush_len - i) * sizeof(FlushEntry));
+        flush_len -= i;
+
+        // Edge-triggered sockets must be drained again once their input resumes
+        for (int j = 0; j < nresumed; j++) {
+            drain_client_input(resumed[j]);
+        }
+    }
+}
+
+// Function to read and dispatch everything an edge-triggered socket has
+void drain_client_input(int sockfd) {
+    int ret;
+    while ((ret = handle_client_input(sockfd)) > 0);
+    if (ret < 0) {
+        close_client(sockfd);
+    }
+}
+
+// Function to close a client connection and release its session
+void close_client(int sockfd) {
+    pthread_rwlock_wrlock(&registry_lock);
+    remove_user(sockfd);
+    pthread_rwlock_unlock(&registry_lock);
+    close(sockfd);
+}
+
+////////////////////////////////////// Admission Control //////////////////////////////////////
+// How many sessions may be logging in at once, and for how long
+AdmissionConfig admission = { MAX_PENDING_LOGINS, LOGIN_TIMEOUT_MS, 0 };
+
+// Login deadlines of the sessions accepted by this thread, oldest first
+__thread LoginDeadline *login_queue = NULL;
+__thread size_t login_head = 0;
+__thread size_t login_len = 0;
+__thread size_t login_cap = 0;
+
+// Function to register an accepted connection, unless too many sessions are still logging in
+// Returns the new session, or NULL if the caller must close the socket
+ClientInfo *admit_client(int sockfd, struct sockaddr_in address) {
+    ClientInfo *new_user = NULL;
+
+    pthread_rwlock_wrlock(&registry_lock);
+    if (pending_logins < admission.max_pending) {
+        add_user(&clientList, sockfd, address);
+        new_user = sockfd_to_client(clientList, sockfd);
+    }
+    if (new_user != NULL) {
+        pending_logins++;
+        online_clients++;
+    }
+    int pending = pending_logins;
+    pthread_rwlock_unlock(&registry_lock);
+
+    if (new_user == NULL) {
+        metrics_add(&thread_metrics->refused, 1);
+        log_every(LOG_RATE_PER_SEC, LOG_WARN, "Refused a connection, %d sessions are still logging in.", pending);
+        return NULL;
+    }
+    metrics_add(&thread_metrics->accepted, 1);
+    login_queue_push(new_user);
+    log_info("New client connected from ip %s and port %d.", new_user->ip_address, new_user->port_number);
+    return new_user;
+}
+
+// Function to start the login clock of a new session
+void login_queue_push(ClientInfo *client) {
+    if (admission.login_timeout_ms <= 0) {
+        return;
+    }
+    if (login_head + login_len == login_cap) {
+        if (login_head > 0) {
+            memmove(login_queue, login_queue + login_head, login_len * sizeof(LoginDeadline));
+            login_head = 0;
+        } else {
+            size_t new_cap = login_cap > 0 ? login_cap * 2 : CONN_TABLE_INIT;
+            LoginDeadline *new_queue = realloc(login_queue, new_cap * sizeof(LoginDeadline));
+            if (new_queue == NULL) {
+                log_perror("realloc");
+                return;
+            }
+            login_queue = new_queue;
+            login_cap = new_cap;
+        }
+    }
+    LoginDeadline *entry = &login_queue[login_head + login_len++];
+    entry->sockfd = client->sockfd;
+    entry->conn_id = client->conn_id;
+    entry->deadline_ms = tick_ms + admission.login_timeout_ms;
+}
+
+// Function to find the next session that let its login deadline pass without choosing a nickname
+// Returns its socket, or -1 once no deadline has passed; the caller closes the socket
+int next_expired_login(void) {
+    while (login_len > 0 && login_queue[login_head].deadline_ms <= tick_ms) {
+        LoginDeadline entry = login_queue[login_head++];
+        login_len--;
+
+        // Sessions that logged in or left since then are skipped
+        pthread_rwlock_rdlock(&registry_lock);
+        ClientInfo *client = sockfd_to_client(clientList, entry.sockfd);
+        int expired = client != NULL && client->conn_id == entry.conn_id && client->nickname[0] == '\0';
+        pthread_rwlock_unlock(&registry_lock);
+        if (expired) {
+            metrics_add(&thread_metrics->login_timeouts, 1);
+            log_info("Closing socket %d, no nickname after %ld ms.", entry.sockfd, admission.login_timeout_ms);
+            return entry.sockfd;
+        }
+    }
+    if (login_len == 0) {
+        login_head = 0;
+    }
+    return -1;
+}
+
+// Function to get how long an event loop may sleep before the next login deadline (-1 = no deadline)
+int login_wait_ms(void) {
+    if (login_len == 0) {
+        return -1;
+    }
+    long long wait = login_queue[login_head].deadline_ms - tick_ms;
+    return wait > 0 ? (int)wait : 0;
+}
+
+// Function to animate the console while the poll backend waits (skipped when headless)
+void waiting_animation(const char *what) {
+    if (admission.headless) {
+        return;
+    }
+    printf( "\n%s", what);
+    fflush(stdout);
+    for (int i = 0; i < 3; ++i){
+        printf(".");
+        fflush(stdout);
+        usleep(200000);
+    }
+    printf("\n");
+}
+
+// Function to accept up to ACCEPT_BUDGET pending connections into free poll slots
+// Returns 1 if the budget ran out before the backlog did
+int poll_accept_clients(int sfd, struct pollfd *fds, int *nfds) {
+    for (int accepted = 0; accepted < ACCEPT_BUDGET; accepted++) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
+        int newsockfd = accept4(sfd, (struct sockaddr *)&clientAddr, &clientLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (newsockfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_perror("accept4");
+            }
+            return 0;
+        }
+
+        // Reuse the slot of a closed client before growing the set
+        int slot = 1;
+        while (slot < *nfds && fds[slot].fd >= 0) {
+            slot++;
+        }
+        if (slot == MAX_CLIENTS + 1) {
+            log_every(LOG_RATE_PER_SEC, LOG_ERROR, "Maximum number of clients reached, connection refused.");
+            close(newsockfd);
+            continue;
+        }
+        if (admit_client(newsockfd, clientAddr) == NULL) {
+            close(newsockfd);
+            continue;
+        }
+
+        fds[slot].fd = newsockfd;
+        fds[slot].events = POLLIN;
+        fds[slot].revents = 0;
+        if (slot == *nfds) {
+            (*nfds)++;
+        }
+    }
+    return 1;
+}
+
+// Function to handle multiple clients (poll backend, capped at MAX_CLIENTS)
+void handle_multiple_clients(int sfd) {
+    metrics_register_thread();
+    latency_register_thread();
+    struct pollfd fds[MAX_CLIENTS + 1];
+    memset(fds, 0, sizeof(fds));
+    fds[0].fd = sfd;
+    fds[0].events = POLLIN;
+    int nfds = 1;
+    int accept_backlog = 0;
+
+    if (set_nonblocking(sfd) < 0) {
+        return;
+    }
+    waiting_animation("Waiting for connections");
+
+    while (1) {
+        // Leftover connections and login deadlines bound the wait
+        int ret = poll(fds, nfds, accept_backlog ? 0 : login_wait_ms());
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_perror("poll");
+            break;
+        }
+        update_tick_clock();
+
+        int messagesReceived = 0;
+
+        for (int i = 1; i < nfds; i++) {
+            if (fds[i].fd < 0) {
+                continue;
+            }
+            if (fds[i].revents & POLLOUT) {
+                pthread_rwlock_rdlock(&registry_lock);
+                ClientInfo *client = sockfd_to_client(clientList, fds[i].fd);
+                if (client != NULL) {
+                    sendq_schedule(client);
+                }
+                pthread_rwlock_unlock(&registry_lock);
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                int ret = handle_client_input(fds[i].fd);
+
+                if (ret < 0) {
+                    close_client(fds[i].fd);
+                    fds[i].fd = -1;
+                } else {
+                    messagesReceived += ret;
+                }
+            }
+        }
+        flush_pending_sends(0);
+
+        int sockfd;
+        while ((sockfd = next_expired_login()) >= 0) {
+            for (int i = 1; i < nfds; i++) {
+                if (fds[i].fd == sockfd) {
+                    fds[i].fd = -1;
+                }
+            }
+            close_client(sockfd);
+        }
+
+        // New connections are taken once the existing clients have been served
+        if ((fds[0].revents & POLLIN) || accept_backlog) {
+            int pending = pending_logins;
+            accept_backlog = poll_accept_clients(sfd, fds, &nfds);
+            if (pending_logins > pending) {
+                waiting_animation("Waiting for nicknames");
+            }
+        }
+
+        // Wait for room on sockets with queued frames, stop reading paused ones
+        pthread_rwlock_rdlock(&registry_lock);
+        for (int i = 1; i < nfds; i++) {
+            ClientInfo *client = fds[i].fd >= 0 ? sockfd_to_client(clientList, fds[i].fd) : NULL;
+            if (client != NULL) {
+                fds[i].events = (client->sendq.paused ? 0 : POLLIN) | (client->sendq.head != NULL ? POLLOUT : 0);
+            }
+            fds[i].revents = 0;
+        }
+        pthread_rwlock_unlock(&registry_lock);
+
+        if (nfds > 1 && messagesReceived == 0) {
+            waiting_animation(online_clients == 0 ? "Waiting for connections" : "Waiting for messages");
+        }
+    }
+}
+
+// Function to accept up to ACCEPT_BUDGET pending connections on the non-blocking listener
+// Returns 1 if the budget ran out before the backlog did
+int accept_pending_clients(Worker *worker) {
+    for (int accepted = 0; accepted < ACCEPT_BUDGET; accepted++) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
+        int newsockfd = accept4(worker->sfd, (struct sockaddr *)&clientAddr, &clientLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (newsockfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_perror("accept4");
+            }
+            return 0;
+        }
+
+        if (admit_client(newsockfd, clientAddr) == NULL) {
+            close(newsockfd);
+            continue;
+        }
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.fd = newsockfd };
+        if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, newsockfd, &ev) == -1) {
+            log_perror("epoll_ctl");
+            close_client(newsockfd);
+        }
+    }
+    return 1;
+}
+
+// Function to hand a frame to the worker that owns the recipient's socket
+void worker_post(Worker *worker, Delivery *delivery) {
+    mpsc_push(&worker->inbox, &delivery->node);
+
+    // Only the first post after a drain needs to wake the worker up
+    if (atomic_exchange(&worker->wake_pending, 1) == 0) {
+        uint64_t one = 1;
+        if (write(worker->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            log_perror("write eventfd");
+        }
+    }
+}
+
+// Function to move every frame other workers posted into this worker's send queues
+void worker_drain_inbox(Worker *worker) {
+    uint64_t count;
+    while (read(worker->wake_fd, &count, sizeof(count)) > 0);
+    atomic_store(&worker->wake_pending, 0);
+
+    MpscNode *node;
+    pthread_rwlock_rdlock(&registry_lock);
+    while ((node = mpsc_pop(&worker->inbox)) != NULL) {
+        Delivery *delivery = (Delivery *)node;
+        ClientInfo *recipient = sockfd_to_client(clientList, delivery->sockfd);
+
+        // Drop frames for sessions that ended since the frame was queued
+        if (recipient != NULL && recipient->conn_id == delivery->conn_id && recipient->worker_id == worker->id) {
+            sendq_push(recipient, delivery->frame);
+        } else {
+            outframe_free(delivery->frame);
+        }
+        free(delivery);
+    }
+    pthread_rwlock_unlock(&registry_lock);
+}
+
+// Function to run one worker's edge-triggered epoll loop
+void *worker_loop(void *arg) {
+    Worker *worker = arg;
+    current_worker = worker;
+    log_set_thread(worker->id);
+    metrics_register_thread();
+    latency_register_thread();
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.fd = worker->sfd };
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->sfd, &ev) == -1) {
+        log_perror("epoll_ctl");
+        return NULL;
+    }
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.fd = worker->wake_fd };
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->wake_fd, &wake_ev) == -1) {
+        log_perror("epoll_ctl");
+        return NULL;
+    }
+
+    struct epoll_event events[EPOLL_BATCH];
+
+    while (1) {
+        // Leftover connections and login deadlines bound the wait
+        int n = epoll_wait(worker->epfd, events, EPOLL_BATCH, worker->accept_backlog ? 0 : login_wait_ms());
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_perror("epoll_wait");
+            break;
+        }
+        update_tick_clock();
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == worker->sfd) {
+                worker->accept_backlog = 1;
+                continue;
+            }
+            if (fd == worker->wake_fd) {
+                worker_drain_inbox(worker);
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_client(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                pthread_rwlock_rdlock(&registry_lock);
+                ClientInfo *client = sockfd_to_client(clientList, fd);
+                if (client != NULL) {
+                    sendq_schedule(client);
+                }
+                pthread_rwlock_unlock(&registry_lock);
+            }
+
+            // Edge-triggered: drain every frame before waiting again
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                drain_client_input(fd);
+            }
+        }
+
+        // Everything queued during this tick leaves in one writev() per connection
+        flush_pending_sends(1);
+
+        int sockfd;
+        while ((sockfd = next_expired_login()) >= 0) {
+            close_client(sockfd);
+        }
+
+        // New connections are taken once the existing clients have been served
+        if (worker->accept_backlog) {
+            worker->accept_backlog = accept_pending_clients(worker);
+        }
+    }
+    return NULL;
+}
+
+// Function to prepare a worker around its own listening socket
+int worker_init(Worker *worker, int id, int sfd) {
+    memset(worker, 0, sizeof(Worker));
+    worker->id = id;
+    worker->sfd = sfd;
+    mpsc_init(&worker->inbox);
+    atomic_init(&worker->wake_pending, 0);
+
+    worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+    worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->epfd == -1 || worker->wake_fd == -1) {
+        log_perror("epoll_create1/eventfd");
+        return -1;
+    }
+    return set_nonblocking(sfd);
+}
+
+// Function to handle multiple clients (edge-triggered epoll backend, no client cap)
+// With several workers, each thread runs its own loop on its own SO_REUSEPORT listener
+void handle_multiple_clients_epoll(int sfd, const char *port, int nworkers) {
+    workers = calloc(nworkers, sizeof(Worker));
+    if (workers == NULL) {
+        log_perror("calloc");
+        return;
+    }
+    worker_count = nworkers;
+
+    for (int i = 0; i < nworkers; i++) {
+        int worker_sfd = sfd;
+        if (i > 0) {
+            worker_sfd = handle_bind(port, 1);
+            if (listen(worker_sfd, SOMAXCONN) != 0) {
+                log_perror("listen");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (worker_init(&workers[i], i, worker_sfd) < 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    log_info("Waiting for connections (%d worker%s)...", nworkers, nworkers > 1 ? "s" : "");
+
+    // Worker 0 runs on the main thread
+    for (int i = 1; i < nworkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_loop, &workers[i]) != 0) {
+            log_perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    worker_loop(&workers[0]);
+}
+
+////////////////////////////////////// io_uring Backend //////////////////////////////////////
+// Operation tags stored in the upper bits of each request's user_data
+enum uring_op {
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_CANCEL,
+    URING_OP_TIMEOUT
+};
+
+#define URING_DATA(op, fd) (((unsigned long long)(op) << 32) | (unsigned)(fd))
+#define URING_DATA_OP(data) ((int)((data) >> 32))
+#define URING_DATA_FD(data) ((int)((data) & 0xffffffffu))
+
+// Function to get the io_uring state of a socket, growing the table if needed
+UringConn *uring_conn(int sockfd) {
+    if (sockfd < 0) {
+        return NULL;
+    }
+    if (sockfd >= uring_conns_size) {
+        int new_size = uring_conns_size > 0 ? uring_conns_size : CONN_TABLE_INIT;
+        while (new_size <= sockfd) {
+            new_size *= 2;
+        }
+        UringConn *new_conns = realloc(uring_conns, new_size * sizeof(UringConn));
+        if (new_conns == NULL) {
+            log_perror("realloc");
+            return NULL;
+        }
+        memset(new_conns + uring_conns_size, 0, (new_size - uring_conns_size) * sizeof(UringConn));
+        uring_conns = new_conns;
+        uring_conns_size = new_size;
+    }
+    return &uring_conns[sockfd];
+}
+
+// Function to append bytes to a growable buffer
+int uring_buf_append(char **buf, size_t *len, size_t *cap, const void *data, size_t data_len) {
+    if (*len + data_len > *cap) {
+        size_t new_cap = *cap > 0 ? *cap : MSG_LEN;
+        while (new_cap < *len + data_len) {
+            new_cap *= 2;
+        }
+        char *new_buf = realloc(*buf, new_cap);
+        if (new_buf == NULL) {
+            log_perror("realloc");
+            return -1;
+        }
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+    return 0;
+}
+
+// Function to apply the slow-consumer policy before queueing len more bytes for a connection
+// Same limits as sendq_enforce_policy(); the frames already submitted to the kernel always stay
+// Returns 1 if the bytes must not be queued
+int uring_enforce_policy(int sockfd, UringConn *conn, size_t len) {
+    // The in-flight buffer counts until all of it is sent, submitted or still waiting for an SQE
+    int inflight_left = conn->inflight_len > conn->inflight_off;
+    size_t unsent = conn->pending_len;
+    if (inflight_left) {
+        unsent += conn->inflight_len - conn->inflight_off;
+    }
+    long long oldest_ms = inflight_left ? conn->inflight_ms : conn->pending_ms;
+    int over_bytes = unsent + len > slow_config.max_bytes;
+    int lagging = slow_config.max_lag_ms > 0 && unsent > 0 && tick_ms - oldest_ms > slow_config.max_lag_ms;
+
+    if (slow_config.policy == SLOW_DISCONNECT) {
+        if (!over_bytes && !lagging) {
+            return 0;
+        }
+        // The multishot receive ends on the shutdown and closes the session
+        log_warn("Connection %d fell behind (%zu bytes unsent), disconnecting.", sockfd, unsent);
+        metrics_add(&thread_metrics->released_bytes, conn->pending_len);
+        metrics_add(&thread_metrics->released_frames, conn->pending_frames);
+        conn->pending_len = 0;
+        conn->pending_frames = 0;
+        conn->doomed = 1;
+        shutdown(sockfd, SHUT_RDWR);
+        atomic_fetch_add_explicit(&slow_stats.disconnects, 1, memory_order_relaxed);
+        return 1;
+    }
+    if (!over_bytes) {
+        return 0;
+    }
+
+    if (conn->dropped == 0) {
+        log_every(LOG_RATE_PER_SEC, LOG_WARN, "Connection %d is not keeping up, dropping frames.", sockfd);
+    }
+    if (slow_config.policy == SLOW_DROP_NEWEST) {
+        conn->dropped++;
+        atomic_fetch_add_explicit(&slow_stats.dropped_newest, 1, memory_order_relaxed);
+        return 1;
+    }
+
+    // Drop oldest: the pending buffer only holds whole frames, not yet submitted
+    metrics_add(&thread_metrics->released_bytes, conn->pending_len);
+    metrics_add(&thread_metrics->released_frames, conn->pending_frames);
+    conn->dropped += conn->pending_frames;
+    atomic_fetch_add_explicit(&slow_stats.dropped_oldest, conn->pending_frames, memory_order_relaxed);
+    conn->pending_len = 0;
+    conn->pending_frames = 0;
+    return 0;
+}
+
+// Function to list a connection for the next uring_flush_sends()
+void uring_mark_dirty(int sockfd, UringConn *conn) {
+    if (!conn->dirty) {
+        conn->dirty = 1;
+        uring_buf_append((char **)&uring_dirty, &uring_dirty_len, &uring_dirty_cap, &sockfd, sizeof(int));
+    }
+}
+
+// Function to queue outgoing bytes; they are submitted in one batch at the end of the tick
+ssize_t uring_queue_send(int sockfd, const void *buf, size_t len) {
+    UringConn *conn = uring_conn(sockfd);
+    if (conn == NULL || !conn->active || conn->closing) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (conn->doomed || uring_enforce_policy(sockfd, conn, len)) {
+        return 0;
+    }
+    if (conn->pending_len == 0) {
+        conn->pending_ms = tick_ms;
+    }
+    if (uring_buf_append(&conn->pending, &conn->pending_len, &conn->pending_cap, buf, len) < 0) {
+        return -1;
+    }
+    conn->pending_frames++;
+    metrics_add(&thread_metrics->queued_bytes, len);
+    uring_mark_dirty(sockfd, conn);
+    return len;
+}
+
+// Function to submit a send for the rest of the in-flight buffer, or once it is all sent, for everything pending
+// The SQE is taken first: without one nothing moves, and the connection is retried at the next flush
+void uring_start_send(int sockfd, UringConn *conn) {
+    int inflight_left = conn->inflight_len > conn->inflight_off;
+    if (conn->send_inflight || (!inflight_left && conn->pending_len == 0)) {
+        return;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(active_ring);
+    if (sqe == NULL) {
+        log_every(LOG_RATE_PER_SEC, LOG_ERROR, "io_uring submission queue full.");
+        uring_mark_dirty(sockfd, conn);
+        return;
+    }
+
+    if (!inflight_left) {
+        // Swap buffers: the kernel owns 'inflight' until the send completes
+        char *tmp_buf = conn->inflight;
+        size_t tmp_cap = conn->inflight_cap;
+        conn->inflight = conn->pending;
+        conn->inflight_cap = conn->pending_cap;
+        conn->inflight_len = conn->pending_len;
+        conn->inflight_off = 0;
+        conn->inflight_ms = conn->pending_ms;
+        conn->pending = tmp_buf;
+        conn->pending_cap = tmp_cap;
+        conn->pending_len = 0;
+        conn->pending_frames = 0;
+    }
+    uring_prep_send(sqe, sockfd, conn->inflight + conn->inflight_off, conn->inflight_len - conn->inflight_off,
+                    URING_DATA(URING_OP_SEND, sockfd));
+    conn->send_inflight = 1;
+}
+
+// Function to turn every connection with pending output into send submissions
+// Connections that found no free SQE list themselves again and are kept for the next flush
+void uring_flush_sends(void) {
+    size_t count = uring_dirty_len / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+        int sockfd = uring_dirty[i];
+        UringConn *conn = uring_conn(sockfd);
+        if (conn == NULL) {
+            continue;
+        }
+        conn->dirty = 0;
+        if (conn->active && !conn->closing) {
+            uring_start_send(sockfd, conn);
+        }
+    }
+    uring_dirty_len -= count * sizeof(int);
+    memmove(uring_dirty, uring_dirty + count, uring_dirty_len);
+}
+
+// Function to arm a multishot receive on a connection
+void uring_arm_recv(int sockfd, UringConn *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(active_ring);
+    if (sqe == NULL) {
+        log_every(LOG_RATE_PER_SEC, LOG_ERROR, "io_uring submission queue full.");
+        return;
+    }
+    uring_prep_multishot_recv(sqe, sockfd, URING_BGID, URING_DATA(URING_OP_RECV, sockfd));
+    conn->recv_armed = 1;
+}
+
+// Function to arm the multishot accept on the listening socket
+void uring_arm_accept(int sfd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(active_ring);
+    if (sqe == NULL) {
+        log_every(LOG_RATE_PER_SEC, LOG_ERROR, "io_uring submission queue full.");
+        return;
+    }
+    uring_prep_multishot_accept(sqe, sfd, URING_DATA(URING_OP_ACCEPT, sfd));
+}
+
+// Function to release a connection once the kernel no longer references it
+void uring_maybe_release(int sockfd, UringConn *conn) {
+    if (!conn->closing || conn->recv_armed || conn->send_inflight) {
+        return;
+    }
+    close(sockfd);
+    size_t unsent = conn->pending_len + (conn->inflight_len > conn->inflight_off ? conn->inflight_len - conn->inflight_off : 0);
+    metrics_add(&thread_metrics->released_bytes, unsent);
+    free(conn->pending);
+    free(conn->inflight);
+    memset(conn, 0, sizeof(UringConn));
+}
+
+// Function to start closing a connection
+void uring_close_conn(int sockfd, UringConn *conn) {
+    if (conn->closing) {
+        return;
+    }
+    conn->closing = 1;
+    pthread_rwlock_wrlock(&registry_lock);
+    remove_user(sockfd);
+    pthread_rwlock_unlock(&registry_lock);
+
+    // Terminate the multishot receive and any running send before closing the fd
+    shutdown(sockfd, SHUT_RDWR);
+    struct io_uring_sqe *sqe = uring_get_sqe(active_ring);
+    if (sqe != NULL) {
+        uring_prep_cancel_fd(sqe, sockfd, URING_DATA(URING_OP_CANCEL, sockfd));
+    }
+    uring_maybe_release(sockfd, conn);
+}
+
+// Function to decode and dispatch received bytes for a connection
+void uring_process_input(int sockfd, UringConn *conn, const char *data, size_t len) {
+    while (len > 0 && !conn->closing) {
+        pthread_rwlock_rdlock(&registry_lock);
+        ClientInfo *current = sockfd_to_client(clientList, sockfd);
+        pthread_rwlock_unlock(&registry_lock);
+        if (current == NULL) {
+            break;
+        }
+
+        if (decoder_reserve(&current->decoder) < 0) {
+            uring_close_conn(sockfd, conn);
+            break;
+        }
+        size_t copied = decoder_fill(&current->decoder, data, len);
+        data += copied;
+        len -= copied;
+
+        if (process_frames(current) < 0) {
+            uring_close_conn(sockfd, conn);
+        }
+    }
+}
+
+// Function to handle a completed accept
+void uring_on_accept(int sfd, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept(sfd);
+    }
+    if (cqe->res < 0) {
+        log_every(LOG_RATE_PER_SEC, LOG_ERROR, "accept: %s", strerror(-cqe->res));
+        return;
+    }
+
+    int newsockfd = cqe->res;
+    struct sockaddr_in clientAddr;
+    socklen_t clientLen = sizeof(clientAddr);
+    memset(&clientAddr, 0, sizeof(clientAddr));
+    getpeername(newsockfd, (struct sockaddr *)&clientAddr, &clientLen);
+
+    UringConn *conn = uring_conn(newsockfd);
+    if (conn == NULL || admit_client(newsockfd, clientAddr) == NULL) {
+        close(newsockfd);
+        return;
+    }
+
+    memset(conn, 0, sizeof(UringConn));
+    conn->active = 1;
+    uring_arm_recv(newsockfd, conn);
+}
+
+// Function to handle a completed (multishot) receive
+void uring_on_recv(UringBufRing *bufs, int sockfd, struct io_uring_cqe *cqe) {
+    UringConn *conn = uring_conn(sockfd);
+    if (conn == NULL) {
+        return;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = 0;
+    }
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        metrics_add(&thread_metrics->socket_bytes_in, cqe->res);
+        uring_process_input(sockfd, conn, uring_buf_addr(bufs, bid), cqe->res);
+        uring_recycle_buf(bufs, bid);
+    } else if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS)) {
+        // Peer closed the connection, or the receive failed
+        uring_close_conn(sockfd, conn);
+    }
+
+    // Out of provided buffers (or multishot ended): re-arm, unless the close above already released the slot
+    if (conn->active && !conn->recv_armed && !conn->closing) {
+        uring_arm_recv(sockfd, conn);
+    }
+    uring_maybe_release(sockfd, conn);
+}
+
+// Function to handle a completed send
+void uring_on_send(int sockfd, struct io_uring_cqe *cqe) {
+    UringConn *conn = uring_conn(sockfd);
+    if (conn == NULL) {
+        return;
+    }
+    conn->send_inflight = 0;
+
+    if (cqe->res < 0) {
+        if (!conn->closing) {
+            log_error("send to socket %d: %s", sockfd, strerror(-cqe->res));
+            metrics_add(&thread_metrics->write_errors, 1);
+            uring_close_conn(sockfd, conn);
+        }
+    } else if (!conn->closing) {
+        conn->inflight_off += cqe->res;
+        metrics_add(&thread_metrics->socket_bytes_out, cqe->res);
+        metrics_add(&thread_metrics->released_bytes, cqe->res);
+        if (conn->inflight_off >= conn->inflight_len) {
+            conn->inflight_len = 0;
+            conn->inflight_off = 0;
+        }
+        // Submits the remainder of a short send, or else what was queued meanwhile
+        uring_start_send(sockfd, conn);
+    }
+    uring_maybe_release(sockfd, conn);
+}
+
+// Function to handle multiple clients (io_uring backend)
+// Returns -1 if io_uring is unavailable so the caller can fall back
+int handle_multiple_clients_uring(int sfd) {
+    Uring ring;
+    UringBufRing bufs;
+
+    if (uring_init(&ring, URING_ENTRIES) < 0) {
+        return -1;
+    }
+    if (uring_setup_buf_ring(&ring, &bufs, URING_BUF_COUNT, URING_BUF_SIZE, URING_BGID) < 0) {
+        uring_exit(&ring);
+        return -1;
+    }
+
+    active_ring = &ring;
+    metrics_register_thread();
+    latency_register_thread();
+    uring_arm_accept(sfd);
+    log_info("Waiting for connections (io_uring)...");
+
+    struct __kernel_timespec login_ts;
+    int timer_armed = 0;
+
+    while (1) {
+        // Wake up for the next login deadline if nothing else does
+        int wait_ms = login_wait_ms();
+        if (wait_ms >= 0 && !timer_armed) {
+            struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+            if (sqe != NULL) {
+                login_ts.tv_sec = wait_ms / 1000;
+                login_ts.tv_nsec = (wait_ms % 1000) * 1000000LL;
+                uring_prep_timeout(sqe, &login_ts, URING_DATA(URING_OP_TIMEOUT, -1));
+                timer_armed = 1;
+            }
+        }
+
+        // One io_uring_enter() submits every send queued during the last tick
+        // Sends that found no free SQE are still listed; then it only submits, and the next tick retries them
+        uring_flush_sends();
+        if (uring_submit_and_wait(&ring, uring_dirty_len > 0 ? 0 : 1) < 0) {
+            log_perror("io_uring_enter");
+            break;
+        }
+        update_tick_clock();
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            struct io_uring_cqe done = *cqe;
+            uring_cqe_seen(&ring);
+
+            int fd = URING_DATA_FD(done.user_data);
+            switch (URING_DATA_OP(done.user_data)) {
+                case URING_OP_ACCEPT:
+                    uring_on_accept(fd, &done);
+                    break;
+                case URING_OP_RECV:
+                    uring_on_recv(&bufs, fd, &done);
+                    break;
+                case URING_OP_SEND:
+                    uring_on_send(fd, &done);
+                    break;
+                case URING_OP_TIMEOUT:
+                    timer_armed = 0;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        int sockfd;
+        while ((sockfd = next_expired_login()) >= 0) {
+            uring_close_conn(sockfd, uring_conn(sockfd));
+        }
+    }
+
+    active_ring = NULL;
+    uring_free_buf_ring(&ring, &bufs);
+    uring_exit(&ring);
+    return 0;
+}
+
+// Function to bind the server to the specified port
+// With reuseport set, several workers can each bind their own listener to the port
+int handle_bind(const char *port, int reuseport) {
+    struct addrinfo hints, *result, *rp;
+    int serverSocket;
+
+    memset(&hints, 0, sizeof(struct addrinfo)); // Clear hints structure
+    hints.ai_family = AF_UNSPEC; // Allow IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM; // Use TCP socket
+    hints.ai_flags = AI_PASSIVE; // For wildcard IP address
+
+    // Get address info for binding
+    if (getaddrinfo(NULL, port, &hints, &result) != 0) {
+        log_perror("getaddrinfo()");
+        exit(EXIT_FAILURE);
+    }
+
+    // Iterate through the results and bind
+    for (rp = result; rp != NULL; rp = rp->ai_next) {
+        serverSocket = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (serverSocket == -1) {
+            continue; // Try next address
+        }
+
+        // Set socket options
+        int opt = 1;
+        setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (reuseport) {
+            setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+        }
+
+        // Bind the socket to the address
+        if (bind(serverSocket, rp->ai_addr, rp->ai_addrlen) == 0) {
+            if (current_worker == NULL && workers == NULL) {
+                log_info("Server launched successfully on port %s.", port);
+            }
+            break; // Successfully bound
+        }
+
+        close(serverSocket); // Close if bind failed
+    }
+
+    // If binding failed
+    if (rp == NULL) {
+        log_error("Could not bind. Please try again.");
+        exit(EXIT_FAILURE);
+    }
+
+    freeaddrinfo(result); // Free the address info
+    return serverSocket; // Return the bound socket
+}
+
+// Main Program 
+// Benchmarks link the server in-process and bring their own main
+#ifndef SERVER_NO_MAIN
+int main(int argc, char *argv[]) {
+    const char *backend = "epoll";
+    int nworkers = 1;
+    size_t prealloc_sessions = 0;
+    size_t prealloc_channels = 0;
+    enum log_level log_level = LOG_INFO;
+    enum log_format log_format = LOG_TEXT;
+    const char *metrics_port = NULL;
+    const char *capture_path = NULL;
+    const char *data_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:w:p:q:l:n:c:v:f:Hu:t:m:r:d:")) != -1) {
+        switch (opt) {
+            case 'b':
+                backend = optarg;
+                break;
+            case 'w':
+                nworkers = atoi(optarg);
+                break;
+            case 'p':
+                if (parse_slow_policy(optarg, &slow_config.policy) < 0) {
+                    printf( "Unknown slow-consumer policy '%s'. Use 'drop-oldest', 'drop-newest' or 'disconnect'.\n" , optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'q':
+                slow_config.max_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                slow_config.max_lag_ms = atol(optarg);
+                break;
+            case 'n':
+                prealloc_sessions = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                prealloc_channels = strtoul(optarg, NULL, 10);
+                break;
+            case 'v':
+                if (log_parse_level(optarg, &log_level) < 0) {
+                    printf( "Unknown log level '%s'. Use 'trace', 'debug', 'info', 'warn' or 'error'.\n" , optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'f':
+                if (log_parse_format(optarg, &log_format) < 0) {
+                    printf( "Unknown log format '%s'. Use 'text' or 'json'.\n" , optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'H':
+                admission.headless = 1;
+                break;
+            case 'u':
+                admission.max_pending = atoi(optarg);
+                break;
+            case 't':
+                admission.login_timeout_ms = atol(optarg);
+                break;
+            case 'm':
+                metrics_port = optarg;
+                break;
+            case 'r':
+                capture_path = optarg;
+                break;
+            case 'd':
+                data_dir = optarg;
+                break;
+            default:
+                printf( "Usage: %s [-b epoll|poll|uring] [-w workers] [-p drop-oldest|drop-newest|disconnect] [-q max_queued_bytes] [-l max_lag_ms] [-n sessions] [-c channels] [-v trace|debug|info|warn|error] [-f text|json] [-H] [-u max_pending_logins] [-t login_timeout_ms] [-m metrics_port] [-r capture_file] [-d data_dir] <server_port>\n" , argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind != argc - 1) {
+        printf( "Missing arguments. Usage: %s [-b epoll|poll|uring] [-w workers] [-p drop-oldest|drop-newest|disconnect] [-q max_queued_bytes] [-l max_lag_ms] [-n sessions] [-c channels] [-v trace|debug|info|warn|error] [-f text|json] [-H] [-u max_pending_logins] [-t login_timeout_ms] [-m metrics_port] [-r capture_file] [-d data_dir] <server_port>\n" , argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(backend, "epoll") != 0 && strcmp(backend, "poll") != 0 && strcmp(backend, "uring") != 0) {
+        printf( "Unknown backend '%s'. Use 'epoll', 'poll' or 'uring'.\n" , backend);
+        exit(EXIT_FAILURE);
+    }
+
+    if (nworkers < 1 || nworkers > MAX_WORKERS) {
+        printf( "The number of workers must be between 1 and %d.\n" , MAX_WORKERS);
+        exit(EXIT_FAILURE);
+    }
+
+    if (slow_config.max_bytes < MSG_LEN + PROTO_V1_HEADER_LEN) {
+        printf( "The send queue limit must hold at least one frame (%zu bytes).\n" , MSG_LEN + PROTO_V1_HEADER_LEN);
+        exit(EXIT_FAILURE);
+    }
+
+    if (nworkers > 1 && strcmp(backend, "epoll") != 0) {
+        printf( "Several workers require the epoll backend.\n" );
+        exit(EXIT_FAILURE);
+    }
+
+    // Write errors on closed sockets are handled where writev() returns
+    signal(SIGPIPE, SIG_IGN);
+
+    // Started first: the threads created after it inherit the blocked dump signal
+    if (latency_start() < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // From here on, the event loops never write to the terminal themselves
+    if (log_init(log_level, log_format) < 0) {
+        printf( "Could not start the log writer.\n" );
+        exit(EXIT_FAILURE);
+    }
+
+    // Reserve sessions and channels before the first accept
+    if (pools_init(prealloc_sessions, prealloc_channels) < 0) {
+        log_error("Could not reserve memory for %zu sessions and %zu channels.", prealloc_sessions, prealloc_channels);
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(backend, "uring") == 0 && prealloc_sessions > 0) {
+        uring_conn((int)prealloc_sessions + PREALLOC_FD_SLACK);
+    }
+    print_pool_stats();
+
+    // Record inbound traffic for bench/replay
+    if (capture_path != NULL && capture_start(capture_path) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Keep channel history and offline mailboxes on disk
+    if (data_dir != NULL && (history_start(data_dir) < 0 || mailbox_start(data_dir) < 0)) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Prefer writers so registry changes are not starved by fan-out traffic
+    pthread_rwlockattr_t lock_attr;
+    pthread_rwlockattr_init(&lock_attr);
+    pthread_rwlockattr_setkind_np(&lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&registry_lock, &lock_attr);
+    pthread_rwlockattr_destroy(&lock_attr);
+
+   const char *server_port = argv[optind];
+    int sfd; 
+    sfd = handle_bind(server_port, nworkers > 1);
+
+    if ((listen(sfd, SOMAXCONN)) != 0) {
+        log_perror("listen");
+        exit(EXIT_FAILURE);
+    }
+
+    // Scrapes are answered by their own thread, the event loops only bump counters
+    if (metrics_port != NULL && metrics_start(metrics_port, write_server_metrics) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(backend, "poll") == 0) {
+        handle_multiple_clients(sfd);
+    } else if (strcmp(backend, "uring") == 0) {
+        raise_fd_limit();
+        if (handle_multiple_clients_uring(sfd) < 0) {
+            log_warn("io_uring unavailable, falling back to epoll.");
+            handle_multiple_clients_epoll(sfd, server_port, 1);
+        }
+    } else {
+        raise_fd_limit();
+        handle_multiple_clients_epoll(sfd, server_port, nworkers);
+    }
 
     close(sfd);
     return EXIT_SUCCESS;
 }
+#endif
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include "log.h"
+#include "uring.h"
+
+// Function to set up a ring and map its submission/completion queues
+int uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(Uring));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+
+    ring->ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->ring_fd < 0) {
+        log_perror("io_uring_setup");
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring_ptr = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring_ptr == MAP_FAILED) {
+        log_perror("mmap");
+        close(ring->ring_fd);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring_ptr = ring->sq_ring_ptr;
+    } else {
+        ring->cq_ring_ptr = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring_ptr == MAP_FAILED) {
+            log_perror("mmap");
+            munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+            close(ring->ring_fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        log_perror("mmap");
+        uring_exit(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_ring_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    char *cq = ring->cq_ring_ptr;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+// Function to release a ring
+void uring_exit(Uring *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring_ptr != NULL && ring->cq_ring_ptr != ring->sq_ring_ptr) {
+        munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+    }
+    if (ring->sq_ring_ptr != NULL) {
+        munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+    }
+    close(ring->ring_fd);
+}
+
+// Function to publish prepared SQEs to the kernel-visible tail
+static void uring_flush_sq(Uring *ring) {
+    unsigned tail = *ring->sq_tail;
+    if (tail != ring->sq_local_tail) {
+        ring->to_submit += ring->sq_local_tail - tail;
+        __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    }
+}
+
+// Function to submit pending SQEs and wait for at least wait_nr completions
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr) {
+    uring_flush_sq(ring);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    while (1) {
+        int ret = syscall(__NR_io_uring_enter, ring->ring_fd, ring->to_submit, wait_nr, flags, NULL, 0);
+        if (ret >= 0) {
+            ring->to_submit -= (unsigned)ret < ring->to_submit ? (unsigned)ret : ring->to_submit;
+            return ret;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+// Function to get a free SQE, submitting queued ones if the queue is full
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        if (uring_submit_and_wait(ring, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local_tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+// Function to peek at the next completion (NULL if none)
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+// Function to mark the current completion as consumed
+void uring_cqe_seen(Uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Function to register a provided buffer ring with the kernel
+int uring_setup_buf_ring(Uring *ring, UringBufRing *bufs, unsigned entries, unsigned buf_size, unsigned short bgid) {
+    memset(bufs, 0, sizeof(UringBufRing));
+    bufs->ring_size = entries * sizeof(struct io_uring_buf);
+    bufs->br = mmap(NULL, bufs->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->br == MAP_FAILED) {
+        log_perror("mmap");
+        return -1;
+    }
+    bufs->buffers = malloc((size_t)entries * buf_size);
+    if (bufs->buffers == NULL) {
+        log_perror("malloc");
+        munmap(bufs->br, bufs->ring_size);
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)bufs->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        log_perror("io_uring_register");
+        free(bufs->buffers);
+        munmap(bufs->br, bufs->ring_size);
+        return -1;
+    }
+
+    bufs->entries = entries;
+    bufs->buf_size = buf_size;
+    bufs->bgid = bgid;
+    bufs->br->tail = 0;
+    for (unsigned i = 0; i < entries; i++) {
+        uring_recycle_buf(bufs, i);
+    }
+    return 0;
+}
+
+// Function to unregister and free a provided buffer ring
+void uring_free_buf_ring(Uring *ring, UringBufRing *bufs) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = bufs->bgid;
+    syscall(__NR_io_uring_register, ring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    free(bufs->buffers);
+    munmap(bufs->br, bufs->ring_size);
+}
+
+// Function to get the address of a provided buffer
+char *uring_buf_addr(UringBufRing *bufs, unsigned short bid) {
+    return bufs->buffers + (size_t)bid * bufs->buf_size;
+}
+
+// Function to hand a provided buffer back to the kernel
+void uring_recycle_buf(UringBufRing *bufs, unsigned short bid) {
+    unsigned short tail = bufs->br->tail;
+    struct io_uring_buf *buf = &bufs->br->bufs[tail & (bufs->entries - 1)];
+    buf->addr = (unsigned long)uring_buf_addr(bufs, bid);
+    buf->len = bufs->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&bufs->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+// Function to prepare a multishot accept
+void uring_prep_multishot_accept(struct io_uring_sqe *sqe, int sfd, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+}
+
+// Function to prepare a multishot receive using a provided buffer group
+void uring_prep_multishot_recv(struct io_uring_sqe *sqe, int sockfd, unsigned short bgid, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+    sqe->user_data = user_data;
+}
+
+// Function to prepare a send
+void uring_prep_send(struct io_uring_sqe *sqe, int sockfd, const void *buf, size_t len, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sockfd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+}
+
+// Function to prepare a one-shot timer; ts is read when the request is submitted
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)ts;
+    sqe->len = 1;
+    sqe->user_data = user_data;
+}
+
+// Function to prepare the cancellation of every request on a socket
+void uring_prep_cancel_fd(struct io_uring_sqe *sqe, int sockfd, unsigned long long user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = sockfd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = user_data;
+}
@@ -0,0 +1,60 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper built directly on the kernel interface (no liburing)
+
+typedef struct Uring {
+    int ring_fd;
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sq_local_tail;    // Tail of SQEs prepared but not yet published
+    unsigned to_submit;        // SQEs published since the last io_uring_enter()
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // Mappings to release
+    void *sq_ring_ptr;
+    size_t sq_ring_size;
+    void *cq_ring_ptr;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Uring;
+
+// Provided buffer ring used by multishot receives
+typedef struct UringBufRing {
+    struct io_uring_buf_ring *br;
+    char *buffers;
+    unsigned entries;
+    unsigned buf_size;
+    unsigned short bgid;
+    size_t ring_size;
+} UringBufRing;
+
+int uring_init(Uring *ring, unsigned entries);
+void uring_exit(Uring *ring);
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+int uring_setup_buf_ring(Uring *ring, UringBufRing *bufs, unsigned entries, unsigned buf_size, unsigned short bgid);
+void uring_free_buf_ring(Uring *ring, UringBufRing *bufs);
+char *uring_buf_addr(UringBufRing *bufs, unsigned short bid);
+void uring_recycle_buf(UringBufRing *bufs, unsigned short bid);
+
+void uring_prep_multishot_accept(struct io_uring_sqe *sqe, int sfd, unsigned long long user_data);
+void uring_prep_multishot_recv(struct io_uring_sqe *sqe, int sockfd, unsigned short bgid, unsigned long long user_data);
+void uring_prep_send(struct io_uring_sqe *sqe, int sockfd, const void *buf, size_t len, unsigned long long user_data);
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts, unsigned long long user_data);
+void uring_prep_cancel_fd(struct io_uring_sqe *sqe, int sockfd, unsigned long long user_data);
+
+#endif